@@ -0,0 +1,82 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include "lv2/lv2plug.in/ns/ext/atom/atom.h"
+#include "lv2/lv2plug.in/ns/ext/atom/util.h"
+#include "lv2/lv2plug.in/ns/ext/urid/urid.h"
+
+/**
+ * Helpers for the atom sequences exchanged with the plugins. Each sequence
+ * lives in a buffer of fixed capacity, in bytes including the header of
+ * the sequence. None of these allocate.
+ */
+
+/// make `seq` an empty sequence timestamped in frames
+static inline void atomSequenceClear(LV2_Atom_Sequence* seq, LV2_URID sequenceType)
+{
+	seq->atom.size = sizeof(LV2_Atom_Sequence_Body);
+	seq->atom.type = sequenceType;
+	seq->body.unit = 0;
+	seq->body.pad = 0;
+}
+
+/// tell the plugin how much room it has to write its output sequence into
+static inline void atomSequencePrepareOutput(LV2_Atom_Sequence* seq, uint32_t capacity, LV2_URID chunkType)
+{
+	seq->atom.size = capacity - sizeof(LV2_Atom);
+	seq->atom.type = chunkType;
+}
+
+/**
+ * Append an event at the end of the sequence. The caller makes sure that
+ * the events stay in time order.
+ *
+ * @return false if there is no room for it
+ */
+static inline bool atomSequenceAppend(LV2_Atom_Sequence* seq, uint32_t capacity, int64_t frames, uint32_t type, uint32_t size, const void* body)
+{
+	uint32_t eventSize = sizeof(LV2_Atom_Event) + lv2_atom_pad_size(size);
+	if(sizeof(LV2_Atom) + lv2_atom_pad_size(seq->atom.size) + eventSize > capacity)
+		return false;
+	LV2_Atom_Event* event = lv2_atom_sequence_end(&seq->body, seq->atom.size);
+	event->time.frames = frames;
+	event->body.size = size;
+	event->body.type = type;
+	memcpy(event + 1, body, size);
+	seq->atom.size = lv2_atom_pad_size(seq->atom.size) + eventSize;
+	return true;
+}
+
+/**
+ * Insert an event after those with the same or an earlier timestamp.
+ *
+ * @return false if there is no room for it
+ */
+static inline bool atomSequenceInsert(LV2_Atom_Sequence* seq, uint32_t capacity, int64_t frames, uint32_t type, uint32_t size, const void* body)
+{
+	LV2_Atom_Event* last = nullptr;
+	LV2_ATOM_SEQUENCE_FOREACH(seq, event)
+		last = event;
+	if(!last || last->time.frames <= frames)
+		return atomSequenceAppend(seq, capacity, frames, type, size, body);
+	uint32_t eventSize = sizeof(LV2_Atom_Event) + lv2_atom_pad_size(size);
+	if(sizeof(LV2_Atom) + lv2_atom_pad_size(seq->atom.size) + eventSize > capacity)
+		return false;
+	LV2_Atom_Event* position = nullptr;
+	LV2_ATOM_SEQUENCE_FOREACH(seq, event)
+	{
+		if(event->time.frames > frames)
+		{
+			position = event;
+			break;
+		}
+	}
+	char* end = (char*)lv2_atom_sequence_end(&seq->body, seq->atom.size);
+	memmove((char*)position + eventSize, position, end - (char*)position);
+	position->time.frames = frames;
+	position->body.size = size;
+	position->body.type = type;
+	memcpy(position + 1, body, size);
+	seq->atom.size = lv2_atom_pad_size(seq->atom.size) + eventSize;
+	return true;
+}
@@ -0,0 +1,244 @@
+#include "DagScheduler.h"
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+// how many times an idle worker polls for a new block before going to sleep
+static const unsigned int kSpinCount = 10000;
+
+DagScheduler::DagScheduler() :
+	graph(nullptr),
+	remaining(0),
+	blockGen(0),
+	busy(0),
+	sleepers(0),
+	running(false),
+	task(nullptr),
+	taskArg(nullptr)
+{
+	pthread_mutex_init(&mutex, NULL);
+	pthread_cond_init(&cond, NULL);
+	std::vector<Deque>(1).swap(deques);
+}
+
+bool DagScheduler::start(unsigned int nWorkers, int priority)
+{
+	stop();
+	// one deque per worker, plus one for the thread calling process()
+	std::vector<Deque>(nWorkers + 1).swap(deques);
+	running = true;
+	workers.resize(nWorkers);
+	workerArgs.resize(nWorkers);
+	long nCpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if(nCpus < 1)
+		nCpus = 1;
+	for(unsigned int n = 0; n < nWorkers; ++n)
+	{
+		workerArgs[n].that = this;
+		workerArgs[n].id = n + 1;
+		pthread_attr_t attr;
+		pthread_attr_init(&attr);
+		pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+		pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+		struct sched_param param;
+		param.sched_priority = priority;
+		pthread_attr_setschedparam(&attr, &param);
+		int ret = pthread_create(&workers[n], &attr, workerLoop, &workerArgs[n]);
+		pthread_attr_destroy(&attr);
+		if(ret)
+		{
+			fprintf(stderr, "Unable to create RT worker thread %u: %s. Retrying without RT priority\n", n, strerror(ret));
+			ret = pthread_create(&workers[n], NULL, workerLoop, &workerArgs[n]);
+		}
+		if(ret)
+		{
+			fprintf(stderr, "Unable to create worker thread %u: %s\n", n, strerror(ret));
+			workers.resize(n);
+			stop();
+			return false;
+		}
+		cpu_set_t cpuset;
+		CPU_ZERO(&cpuset);
+		CPU_SET((n + 1) % nCpus, &cpuset);
+		ret = pthread_setaffinity_np(workers[n], sizeof(cpuset), &cpuset);
+		if(ret)
+			fprintf(stderr, "Unable to pin worker thread %u: %s\n", n, strerror(ret));
+	}
+	return true;
+}
+
+void DagScheduler::stop()
+{
+	if(!running)
+		return;
+	running = false;
+	pthread_mutex_lock(&mutex);
+	pthread_cond_broadcast(&cond);
+	pthread_mutex_unlock(&mutex);
+	for(auto& worker : workers)
+		pthread_join(worker, NULL);
+	workers.clear();
+	std::vector<Deque>(1).swap(deques);
+}
+
+void DagScheduler::Graph::setup(std::vector<std::vector<unsigned int>> const& successors, unsigned int nThreads)
+{
+	this->successors = successors;
+	this->nThreads = nThreads;
+	unsigned int nNodes = successors.size();
+	nPredecessors.assign(nNodes, 0);
+	for(auto& nodeSuccessors : successors)
+		for(auto s : nodeSuccessors)
+			++nPredecessors[s];
+	roots.clear();
+	for(unsigned int n = 0; n < nNodes; ++n)
+		if(0 == nPredecessors[n])
+			roots.push_back(n);
+	pending.reset(new std::atomic<unsigned int>[nNodes]);
+	items.reset(new std::atomic<int>[nNodes * nThreads]);
+}
+
+void DagScheduler::process(Graph& graph, Task task, void* arg)
+{
+	unsigned int nNodes = graph.size();
+	if(!nNodes)
+		return;
+	if(graph.nThreads != deques.size() || deques.size() < 2)
+	{
+		for(unsigned int n = 0; n < nNodes; ++n)
+			task(arg, n);
+		return;
+	}
+	this->graph = &graph;
+	this->task = task;
+	this->taskArg = arg;
+	for(unsigned int n = 0; n < nNodes; ++n)
+		graph.pending[n].store(graph.nPredecessors[n], std::memory_order_relaxed);
+	for(unsigned int n = 0; n < deques.size(); ++n)
+	{
+		deques[n].items = &graph.items[n * nNodes];
+		deques[n].top.store(0, std::memory_order_relaxed);
+		deques[n].bottom.store(0, std::memory_order_relaxed);
+	}
+	remaining.store(nNodes, std::memory_order_relaxed);
+	for(auto root : graph.roots)
+		push(0, root);
+	// let the workers in
+	blockGen.fetch_add(1);
+	if(sleepers.load())
+	{
+		pthread_mutex_lock(&mutex);
+		pthread_cond_broadcast(&cond);
+		pthread_mutex_unlock(&mutex);
+	}
+	work(0);
+	// close the block and wait for any worker still looking for work
+	blockGen.fetch_add(1);
+	while(busy.load())
+		;
+}
+
+void* DagScheduler::workerLoop(void* arg)
+{
+	WorkerArg* workerArg = (WorkerArg*)arg;
+	DagScheduler* that = workerArg->that;
+	unsigned int seen = that->blockGen.load();
+	while(that->running)
+	{
+		unsigned int gen;
+		unsigned int spin = 0;
+		while(1)
+		{
+			gen = that->blockGen.load();
+			if(((gen & 1) && gen != seen) || !that->running)
+				break;
+			if(++spin < kSpinCount)
+				continue;
+			pthread_mutex_lock(&that->mutex);
+			that->sleepers.fetch_add(1);
+			gen = that->blockGen.load();
+			if(!((gen & 1) && gen != seen) && that->running)
+				pthread_cond_wait(&that->cond, &that->mutex);
+			that->sleepers.fetch_sub(1);
+			pthread_mutex_unlock(&that->mutex);
+			spin = 0;
+		}
+		if(!that->running)
+			break;
+		seen = gen;
+		that->busy.fetch_add(1);
+		// only touch the deques if the block is still open
+		if(that->blockGen.load() == gen)
+			that->work(workerArg->id);
+		that->busy.fetch_sub(1);
+	}
+	return NULL;
+}
+
+void DagScheduler::work(unsigned int id)
+{
+	unsigned int nDeques = deques.size();
+	while(remaining.load(std::memory_order_acquire))
+	{
+		int node = pop(id);
+		for(unsigned int n = 1; node < 0 && n < nDeques; ++n)
+			node = steal((id + n) % nDeques);
+		if(node < 0)
+			continue;
+		task(taskArg, node);
+		for(auto s : graph->successors[node])
+		{
+			if(1 == graph->pending[s].fetch_sub(1, std::memory_order_acq_rel))
+				push(id, s);
+		}
+		remaining.fetch_sub(1, std::memory_order_release);
+	}
+}
+
+// The deques never wrap around: each node is pushed at most once per
+// block, so `items` only needs room for all the nodes.
+void DagScheduler::push(unsigned int id, int node)
+{
+	Deque& d = deques[id];
+	int b = d.bottom.load(std::memory_order_relaxed);
+	d.items[b].store(node, std::memory_order_relaxed);
+	d.bottom.store(b + 1, std::memory_order_release);
+}
+
+int DagScheduler::pop(unsigned int id)
+{
+	Deque& d = deques[id];
+	int b = d.bottom.load(std::memory_order_relaxed) - 1;
+	d.bottom.store(b, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	int t = d.top.load(std::memory_order_relaxed);
+	if(t > b)
+	{
+		d.bottom.store(b + 1, std::memory_order_relaxed);
+		return -1;
+	}
+	int node = d.items[b].load(std::memory_order_relaxed);
+	if(t == b)
+	{
+		// last item: race against stealers
+		if(!d.top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+			node = -1;
+		d.bottom.store(b + 1, std::memory_order_relaxed);
+	}
+	return node;
+}
+
+int DagScheduler::steal(unsigned int id)
+{
+	Deque& d = deques[id];
+	int t = d.top.load(std::memory_order_acquire);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	int b = d.bottom.load(std::memory_order_acquire);
+	if(t >= b)
+		return -1;
+	int node = d.items[t].load(std::memory_order_relaxed);
+	if(!d.top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+		return -1;
+	return node;
+}
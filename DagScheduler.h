@@ -0,0 +1,102 @@
+#pragma once
+#include <vector>
+#include <atomic>
+#include <memory>
+#include <pthread.h>
+
+/**
+ * Runs the nodes of a dependency graph on a pool of real-time worker
+ * threads. The thread calling process() takes part in the work, so with
+ * nWorkers helper threads there are nWorkers + 1 threads running nodes.
+ *
+ * Each thread has its own deque of ready nodes: when a node completes, the
+ * successors that become ready are pushed to the deque of the thread that
+ * completed it, and idle threads steal from the other deques.
+ */
+class DagScheduler
+{
+public:
+	typedef void (*Task)(void* arg, unsigned int node);
+	/**
+	 * A graph ready to be passed to process(). It is built outside the
+	 * audio thread; process() only uses the scratch memory reserved here.
+	 */
+	class Graph
+	{
+	public:
+		Graph() : nThreads(0) {};
+		/**
+		 * @param successors for each node, the nodes that can only
+		 * start once it has completed. The graph must be acyclic and
+		 * node indices have to be a valid execution order.
+		 * @param nThreads the value returned by getNumThreads() on the
+		 * scheduler that will process the graph.
+		 */
+		void setup(std::vector<std::vector<unsigned int>> const& successors, unsigned int nThreads);
+		unsigned int size() { return successors.size(); };
+	private:
+		friend class DagScheduler;
+		std::vector<std::vector<unsigned int>> successors;
+		std::vector<unsigned int> nPredecessors;
+		std::vector<unsigned int> roots;
+		std::unique_ptr<std::atomic<unsigned int>[]> pending;
+		// room for all the nodes in each thread's deque
+		std::unique_ptr<std::atomic<int>[]> items;
+		unsigned int nThreads;
+	};
+	DagScheduler();
+	~DagScheduler() { stop(); };
+	/**
+	 * Start the worker threads.
+	 *
+	 * @param nWorkers the number of helper threads. Worker n is pinned
+	 * to CPU (n + 1) modulo the number of online CPUs, leaving CPU 0 to
+	 * the thread calling process().
+	 * @param priority the SCHED_FIFO priority of the workers. If this
+	 * cannot be set, the workers run with the default policy.
+	 */
+	bool start(unsigned int nWorkers, int priority);
+	/// stop and join the worker threads
+	void stop();
+	unsigned int getNumWorkers() { return workers.size(); };
+	/// the number of threads running nodes, including the one calling process()
+	unsigned int getNumThreads() { return deques.size(); };
+	/**
+	 * Run task() once for each node of the graph, in dependency order,
+	 * and return when all of them have completed. This is meant to be
+	 * called from the audio thread. If the graph was set up for a
+	 * different number of threads, the nodes are run serially.
+	 */
+	void process(Graph& graph, Task task, void* arg);
+
+private:
+	struct Deque {
+		std::atomic<int>* items;
+		std::atomic<int> top;
+		std::atomic<int> bottom;
+	};
+	struct WorkerArg {
+		DagScheduler* that;
+		unsigned int id;
+	};
+	static void* workerLoop(void* arg);
+	void work(unsigned int id);
+	void push(unsigned int id, int node);
+	int pop(unsigned int id);
+	int steal(unsigned int id);
+
+	std::vector<pthread_t> workers;
+	std::vector<WorkerArg> workerArgs;
+	std::vector<Deque> deques;
+	Graph* graph;
+	std::atomic<unsigned int> remaining;
+	// odd while a block is being processed, even otherwise
+	std::atomic<unsigned int> blockGen;
+	std::atomic<unsigned int> busy;
+	std::atomic<unsigned int> sleepers;
+	std::atomic<bool> running;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	Task task;
+	void* taskArg;
+};
@@ -0,0 +1,226 @@
+#pragma once
+#include <stdint.h>
+#include <math.h>
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/**
+ * Kernels converting between the interleaved buffers of an audio device
+ * and the non-interleaved float buffers of the chain, vectorised with NEON
+ * or SSE2 for stereo, the common case. Integer samples are scaled so that
+ * full scale maps to [-1, 1), and float samples are clipped on the way
+ * back. They are rounded to the nearest integer, ties to even, whichever
+ * path converts them: the default mode of SSE2 and lrintf(), and
+ * vcvtnq_s32_f32() on ARMv8. ARMv7 has no such conversion, so it uses the
+ * scalar code there.
+ */
+
+/// dst[c][n] = src[n * nChannels + c]
+static inline void deinterleaveFloat(float* const* dst, const float* src, unsigned int nChannels, unsigned int nFrames)
+{
+	unsigned int n = 0;
+	if(2 == nChannels)
+	{
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+		for(; n + 4 <= nFrames; n += 4)
+		{
+			float32x4x2_t v = vld2q_f32(src + 2 * n);
+			vst1q_f32(dst[0] + n, v.val[0]);
+			vst1q_f32(dst[1] + n, v.val[1]);
+		}
+#elif defined(__SSE2__)
+		for(; n + 4 <= nFrames; n += 4)
+		{
+			__m128 a = _mm_loadu_ps(src + 2 * n);
+			__m128 b = _mm_loadu_ps(src + 2 * n + 4);
+			_mm_storeu_ps(dst[0] + n, _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+			_mm_storeu_ps(dst[1] + n, _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+		}
+#endif
+	}
+	for(unsigned int c = 0; c < nChannels; ++c)
+		for(unsigned int f = n; f < nFrames; ++f)
+			dst[c][f] = src[f * nChannels + c];
+}
+
+/// dst[n * nChannels + c] = src[c][n]
+static inline void interleaveFloat(float* dst, const float* const* src, unsigned int nChannels, unsigned int nFrames)
+{
+	unsigned int n = 0;
+	if(2 == nChannels)
+	{
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+		for(; n + 4 <= nFrames; n += 4)
+		{
+			float32x4x2_t v = { { vld1q_f32(src[0] + n), vld1q_f32(src[1] + n) } };
+			vst2q_f32(dst + 2 * n, v);
+		}
+#elif defined(__SSE2__)
+		for(; n + 4 <= nFrames; n += 4)
+		{
+			__m128 l = _mm_loadu_ps(src[0] + n);
+			__m128 r = _mm_loadu_ps(src[1] + n);
+			_mm_storeu_ps(dst + 2 * n, _mm_unpacklo_ps(l, r));
+			_mm_storeu_ps(dst + 2 * n + 4, _mm_unpackhi_ps(l, r));
+		}
+#endif
+	}
+	for(unsigned int c = 0; c < nChannels; ++c)
+		for(unsigned int f = n; f < nFrames; ++f)
+			dst[f * nChannels + c] = src[c][f];
+}
+
+/// dst[c][n] = src[n * nChannels + c] / 32768
+static inline void deinterleaveInt16(float* const* dst, const int16_t* src, unsigned int nChannels, unsigned int nFrames)
+{
+	const float scale = 1.f / 32768.f;
+	unsigned int n = 0;
+	if(2 == nChannels)
+	{
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+		for(; n + 4 <= nFrames; n += 4)
+		{
+			int16x4x2_t v = vld2_s16(src + 2 * n);
+			vst1q_f32(dst[0] + n, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(v.val[0])), scale));
+			vst1q_f32(dst[1] + n, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(v.val[1])), scale));
+		}
+#elif defined(__SSE2__)
+		__m128 s = _mm_set1_ps(scale);
+		for(; n + 4 <= nFrames; n += 4)
+		{
+			__m128i v = _mm_loadu_si128((const __m128i*)(src + 2 * n));
+			// sign-extend to 32 bits: l0 r0 l1 r1 and l2 r2 l3 r3
+			__m128 a = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16));
+			__m128 b = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16));
+			_mm_storeu_ps(dst[0] + n, _mm_mul_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)), s));
+			_mm_storeu_ps(dst[1] + n, _mm_mul_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)), s));
+		}
+#endif
+	}
+	for(unsigned int c = 0; c < nChannels; ++c)
+		for(unsigned int f = n; f < nFrames; ++f)
+			dst[c][f] = src[f * nChannels + c] * scale;
+}
+
+/// dst[n * nChannels + c] = src[c][n] * 32768, clipped
+static inline void interleaveInt16(int16_t* dst, const float* const* src, unsigned int nChannels, unsigned int nFrames)
+{
+	unsigned int n = 0;
+	if(2 == nChannels)
+	{
+#if defined(__aarch64__)
+		for(; n + 4 <= nFrames; n += 4)
+		{
+			int16x4x2_t v;
+			for(unsigned int c = 0; c < 2; ++c)
+			{
+				float32x4_t x = vmulq_n_f32(vld1q_f32(src[c] + n), 32768.f);
+				// both conversions saturate
+				v.val[c] = vqmovn_s32(vcvtnq_s32_f32(x));
+			}
+			vst2_s16(dst + 2 * n, v);
+		}
+#elif defined(__SSE2__)
+		__m128 s = _mm_set1_ps(32768.f);
+		__m128 lo = _mm_set1_ps(-32768.f);
+		__m128 hi = _mm_set1_ps(32767.f);
+		for(; n + 4 <= nFrames; n += 4)
+		{
+			__m128i l = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(src[0] + n), s), lo), hi));
+			__m128i r = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(src[1] + n), s), lo), hi));
+			__m128i v = _mm_packs_epi32(_mm_unpacklo_epi32(l, r), _mm_unpackhi_epi32(l, r));
+			_mm_storeu_si128((__m128i*)(dst + 2 * n), v);
+		}
+#endif
+	}
+	for(unsigned int c = 0; c < nChannels; ++c)
+	{
+		for(unsigned int f = n; f < nFrames; ++f)
+		{
+			float x = src[c][f] * 32768.f;
+			x = x < -32768.f ? -32768.f : (x > 32767.f ? 32767.f : x);
+			dst[f * nChannels + c] = lrintf(x);
+		}
+	}
+}
+
+/**
+ * dst[c][n] = src[n * nChannels + c] / fullScale. fullScale is 2^31 for
+ * 32-bit samples and 2^23 for 24-bit samples in the low bits of 32.
+ */
+static inline void deinterleaveInt32(float* const* dst, const int32_t* src, float fullScale, unsigned int nChannels, unsigned int nFrames)
+{
+	const float scale = 1.f / fullScale;
+	unsigned int n = 0;
+	if(2 == nChannels)
+	{
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+		for(; n + 4 <= nFrames; n += 4)
+		{
+			int32x4x2_t v = vld2q_s32(src + 2 * n);
+			vst1q_f32(dst[0] + n, vmulq_n_f32(vcvtq_f32_s32(v.val[0]), scale));
+			vst1q_f32(dst[1] + n, vmulq_n_f32(vcvtq_f32_s32(v.val[1]), scale));
+		}
+#elif defined(__SSE2__)
+		__m128 s = _mm_set1_ps(scale);
+		for(; n + 4 <= nFrames; n += 4)
+		{
+			__m128 a = _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*)(src + 2 * n)));
+			__m128 b = _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*)(src + 2 * n + 4)));
+			_mm_storeu_ps(dst[0] + n, _mm_mul_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)), s));
+			_mm_storeu_ps(dst[1] + n, _mm_mul_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)), s));
+		}
+#endif
+	}
+	for(unsigned int c = 0; c < nChannels; ++c)
+		for(unsigned int f = n; f < nFrames; ++f)
+			dst[c][f] = src[f * nChannels + c] * scale;
+}
+
+/// dst[n * nChannels + c] = src[c][n] * fullScale, clipped
+static inline void interleaveInt32(int32_t* dst, const float* const* src, float fullScale, unsigned int nChannels, unsigned int nFrames)
+{
+	// the largest float below 2^31 is 2^31 - 128
+	const float lo = -fullScale;
+	const float hi = fullScale >= 2147483648.f ? 2147483520.f : fullScale - 1;
+	unsigned int n = 0;
+	if(2 == nChannels)
+	{
+#if defined(__aarch64__)
+		for(; n + 4 <= nFrames; n += 4)
+		{
+			int32x4x2_t v;
+			for(unsigned int c = 0; c < 2; ++c)
+			{
+				float32x4_t x = vmulq_n_f32(vld1q_f32(src[c] + n), fullScale);
+				x = vminq_f32(vmaxq_f32(x, vdupq_n_f32(lo)), vdupq_n_f32(hi));
+				v.val[c] = vcvtnq_s32_f32(x);
+			}
+			vst2q_s32(dst + 2 * n, v);
+		}
+#elif defined(__SSE2__)
+		__m128 s = _mm_set1_ps(fullScale);
+		__m128 vlo = _mm_set1_ps(lo);
+		__m128 vhi = _mm_set1_ps(hi);
+		for(; n + 4 <= nFrames; n += 4)
+		{
+			__m128i l = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(src[0] + n), s), vlo), vhi));
+			__m128i r = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(src[1] + n), s), vlo), vhi));
+			_mm_storeu_si128((__m128i*)(dst + 2 * n), _mm_unpacklo_epi32(l, r));
+			_mm_storeu_si128((__m128i*)(dst + 2 * n + 4), _mm_unpackhi_epi32(l, r));
+		}
+#endif
+	}
+	for(unsigned int c = 0; c < nChannels; ++c)
+	{
+		for(unsigned int f = n; f < nFrames; ++f)
+		{
+			float x = src[c][f] * fullScale;
+			x = x < lo ? lo : (x > hi ? hi : x);
+			dst[f * nChannels + c] = lrintf(x);
+		}
+	}
+}
@@ -1,9 +1,26 @@
 #include <Lv2Host.h>
 #include <algorithm>
 #include "lilv_interface_private.h"
+#include "MixKernels.h"
+#include "FormatKernels.h"
+#include "AtomSequence.h"
+#include "lv2/lv2plug.in/ns/ext/midi/midi.h"
+#include "lv2/lv2plug.in/ns/ext/state/state.h"
 #include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
 
-enum {kMapNotConnected = -255};
+static const unsigned int kControlQueueSize = 1024;
+static const unsigned int kDefaultMinSubBlockSize = 16;
+static const unsigned int kRetiredPlansSize = 16;
+static const unsigned int kAppliedControlsSize = 16;
+static const size_t kDefaultArenaSize = 1024 * 1024;
+static const unsigned int kDefaultBypassFadeFrames = 256;
+// in seconds
+static const float kDefaultMeterWindow = 0.05;
+static const unsigned int kWorkerBufferSize = 8192;
+static const uint32_t kAtomBufferSize = 8192;
+static const unsigned int kAtomQueueSize = 8192;
 
 Lv2Host::Lv2Host(float sampleRate, unsigned int maxBlockSize, unsigned int nAudioInputs, unsigned int nAudioOutputs)
 {
@@ -12,224 +29,2361 @@ Lv2Host::Lv2Host(float sampleRate, unsigned int maxBlockSize, unsigned int nAudi
 
 bool Lv2Host::setup(float sampleRate, unsigned int maxBlockSize, unsigned int nAudioInputs, unsigned int nAudioOutputs)
 {
-	world = LV2Apply_initializeWorld();
-	if(!world)
+	if(!context)
+	{
+		context.reset(new Lv2HostContext);
+		if(!context->setup(catalogueEnabled, cataloguePath))
+		{
+			context.reset();
+			return false;
+		}
+	}
+	if(!worker.setup(kWorkerBufferSize))
 		return false;
-	this->maxBlockSize = maxBlockSize;
+	// the plugins only ever see blocks of the internal size
+	this->maxBlockSize = internalBlockSize ? internalBlockSize : maxBlockSize;
 	this->sampleRate = sampleRate;
 	this->nAudioInputs = nAudioInputs;
 	this->nAudioOutputs = nAudioOutputs;
-	dummyInput.resize(maxBlockSize);
-	struct map defaultMap;
-	defaultMap.slot = kMapNotConnected;
-	defaultMap.channel = 0;
-	inputMap.resize(nAudioInputs, defaultMap);
-	outputMap.resize(nAudioOutputs, defaultMap);
-	symap = symap_new();
-	map.handle = symap;
-	map.map = (LV2_URID (*)(LV2_URID_Map_Handle, const char *))symap_map;
-	mapFeature.URI = LV2_URID__map;
-	mapFeature.data = &map;
-	unmap.handle = symap;
-	unmap.unmap = (const char *(*)(LV2_URID_Unmap_Handle, LV2_URID))symap_unmap;
-	unmapFeature.URI = LV2_URID__unmap;
-	unmapFeature.data = &unmap;
-	featureList.push_back(&mapFeature);
-	featureList.push_back(&unmapFeature);
-	featureList.push_back(NULL);
+	if(!arenaSize)
+		arenaSize = kDefaultArenaSize;
+	if(!arena.setup(arenaSize, arenaHugePages, arenaLockMemory))
+		fprintf(stderr, "Lv2Host: allocating buffers on the heap\n");
+	dummyInput = (float*)allocate(this->maxBlockSize * sizeof(float));
+	probeInput = (float*)allocate(this->maxBlockSize * sizeof(float));
+	probeOutput = (float*)allocate(this->maxBlockSize * sizeof(float));
+	partInputs.resize(nAudioInputs);
+	partOutputs.resize(nAudioOutputs);
+	formatInputs.resize(nAudioInputs);
+	for(auto& buffer : formatInputs)
+		buffer = (float*)allocate(this->maxBlockSize * sizeof(float));
+	formatOutputs.resize(nAudioOutputs);
+	for(auto& buffer : formatOutputs)
+		buffer = (float*)allocate(this->maxBlockSize * sizeof(float));
+	formatSources.resize(nAudioOutputs);
+	if(internalBlockSize)
+	{
+		inputFifos.resize(nAudioInputs);
+		for(auto& fifo : inputFifos)
+		{
+			fifo = (float*)allocate(internalBlockSize * sizeof(float));
+			memset(fifo, 0, internalBlockSize * sizeof(float));
+		}
+		outputFifos.resize(nAudioOutputs);
+		for(auto& fifo : outputFifos)
+		{
+			fifo = (float*)allocate(internalBlockSize * sizeof(float));
+			memset(fifo, 0, internalBlockSize * sizeof(float));
+		}
+		fifoFrames = 0;
+	}
+	controlQueue.setup(kControlQueueSize);
+	retiredPlans.setup(kRetiredPlansSize);
+	appliedControls.setup(kAppliedControlsSize);
+	minSubBlockSize = kDefaultMinSubBlockSize;
+	bypassFadeFrames = kDefaultBypassFadeFrames;
+	outputMap.resize(nAudioOutputs);
+	atomSequenceUrid = context->mapUri(LV2_ATOM__Sequence);
+	atomChunkUrid = context->mapUri(LV2_ATOM__Chunk);
+	midiEventUrid = context->mapUri(LV2_MIDI__MidiEvent);
+	atomFloatUrid = context->mapUri(LV2_ATOM__Float);
+	atomDoubleUrid = context->mapUri(LV2_ATOM__Double);
+	atomIntUrid = context->mapUri(LV2_ATOM__Int);
+	atomLongUrid = context->mapUri(LV2_ATOM__Long);
+	atomBoolUrid = context->mapUri(LV2_ATOM__Bool);
+	updatePlan();
+	return true;
+}
+
+void Lv2Host::cleanup()
+{
+	scheduler.stop();
+	freeRetiredSlots(true);
+	// the worker thread may be using the plugins
+	worker.cleanup();
+	restores.clear();
+	slotWorkers.clear();
+	delete plan;
+	plan = nullptr;
+	delete nextPlan.exchange(nullptr);
+	renderPlan* retired;
+	while(retiredPlans.pop(retired))
+		delete retired;
+	delete stagedControls.exchange(nullptr);
+	freeAppliedControls();
+	meters.clear();
+	if(context)
+		context->lock();
+	for(auto slot : slots)
+	{
+		LV2Apply_free(slot);
+	}
+	if(context)
+		context->unlock();
+	slots.clear();
+	for(auto& atoms : slotAtoms)
+		releaseAtoms(*atoms);
+	slotAtoms.clear();
+	atomSources.clear();
+	for(auto buffer : buffers)
+		release(buffer);
+	buffers.clear();
+	for(auto& line : delayLines)
+		release(line->buffer);
+	delayLines.clear();
+	release(dummyInput);
+	dummyInput = nullptr;
+	for(auto buffer : scratchOutputs)
+		release(buffer);
+	scratchOutputs.clear();
+	release(probeInput);
+	release(probeOutput);
+	probeInput = probeOutput = nullptr;
+	for(auto buffer : formatInputs)
+		release(buffer);
+	formatInputs.clear();
+	for(auto buffer : formatOutputs)
+		release(buffer);
+	formatOutputs.clear();
+	for(auto fifo : inputFifos)
+		release(fifo);
+	inputFifos.clear();
+	for(auto fifo : outputFifos)
+		release(fifo);
+	outputFifos.clear();
+	arena.cleanup();
+	// the last host using the context frees it
+	context.reset();
+}
+
+void Lv2Host::setArenaOptions(size_t size, bool hugePages, bool lockMemory)
+{
+	arenaSize = size;
+	arenaHugePages = hugePages;
+	arenaLockMemory = lockMemory;
+}
+
+void Lv2Host::setCatalogueOptions(bool enabled, std::string const& path)
+{
+	catalogueEnabled = enabled;
+	cataloguePath = path;
+}
+
+void Lv2Host::setContext(std::shared_ptr<Lv2HostContext> const& context)
+{
+	this->context = context;
+}
+
+void Lv2Host::setInternalBlockSize(unsigned int frames)
+{
+	internalBlockSize = frames;
+}
+
+struct PluginCatalogue::stats Lv2Host::getCatalogueStats()
+{
+	struct PluginCatalogue::stats stats;
+	memset(&stats, 0, sizeof(stats));
+	if(context && context->getCatalogue())
+		stats = context->getCatalogue()->getStats();
+	return stats;
+}
+
+// Allocate zeroed, aligned memory from the arena, or from the heap if
+// the arena is full.
+void* Lv2Host::allocate(size_t size)
+{
+	void* ptr = arena.allocate(size);
+	if(ptr)
+		return ptr;
+	if(arena.getStats().capacity)
+		fprintf(stderr, "Lv2Host: the arena is full, allocating %zu bytes from the heap\n", size);
+	if(posix_memalign(&ptr, RtArena::kAlignment, size ? size : 1))
+		return nullptr;
+	memset(ptr, 0, size);
+	return ptr;
+}
+
+// Give memory back. Blocks of the arena are reused by later allocations of
+// the same size.
+void Lv2Host::release(void* ptr)
+{
+	if(!ptr)
+		return;
+	if(arena.contains(ptr))
+		arena.release(ptr);
+	else
+		free(ptr);
+}
+
+void* Lv2Host::allocate(void* arg, size_t size)
+{
+	return ((Lv2Host*)arg)->allocate(size);
+}
+
+void Lv2Host::release(void* arg, void* ptr)
+{
+	((Lv2Host*)arg)->release(ptr);
+}
+
+bool Lv2Host::prepareSlot(struct pendingSlot& pending)
+{
+	LV2Apply_Allocator allocator;
+	allocator.allocate = allocate;
+	allocator.release = release;
+	allocator.handle = this;
+	auto& featureList = context->getFeatures();
+	PluginCatalogue* catalogue = context->getCatalogue();
+	context->lock();
+	if(catalogue)
+	{
+		struct PluginCatalogue::plugin info;
+		if(catalogue->find(pending.uri.c_str(), info))
+		{
+			// warn about the features we cannot provide
+			std::string features = info.requiredFeatures;
+			for(size_t start = 0, end; (end = features.find('\n', start)) != std::string::npos; start = end + 1)
+			{
+				std::string feature = features.substr(start, end - start);
+				bool supported = feature == LV2_WORKER__schedule;
+				for(unsigned int n = 0; n + 1 < featureList.size(); ++n)
+					supported |= feature == featureList[n]->URI;
+				if(!supported)
+					fprintf(stderr, "Lv2Host: %s requires unsupported feature %s\n", pending.uri.c_str(), feature.c_str());
+			}
+		}
+		if(!catalogue->load(pending.uri.c_str()))
+		{
+			context->unlock();
+			fprintf(stderr, "Lv2Host: plugin %s is not installed\n", pending.uri.c_str());
+			return false;
+		}
+	}
+	pending.slot = LV2Apply_describePluginWithAllocator(context->getWorld(), pending.uri.c_str(), &allocator);
+	if(pending.slot && (!LV2Apply_setCopies(pending.slot, pending.nCopies) || !LV2Apply_openLibrary(pending.slot)))
+	{
+		LV2Apply_free(pending.slot);
+		pending.slot = nullptr;
+	}
+	context->unlock();
+	if(!pending.slot)
+		return false;
+	// each instance gets its own worker
+	pending.workers.resize(pending.nCopies);
+	pending.features.resize(pending.nCopies);
+	pending.ready.assign(pending.nCopies, false);
+	for(unsigned int k = 0; k < pending.nCopies; ++k)
+	{
+		pending.workers[k] = worker.addInstance();
+		pending.features[k].assign(featureList.begin(), featureList.end() - 1);
+		pending.features[k].push_back(pending.workers[k]->getFeature());
+		pending.features[k].push_back(NULL);
+	}
+	return true;
+}
+
+// the library of the plugin was opened by prepareSlot(), so instantiating
+// and activating a copy only run the plugin's code, alongside other copies
+bool Lv2Host::instantiateCopy(struct pendingSlot& pending, unsigned int copy)
+{
+	bool ok = LV2Apply_instantiate(pending.slot, copy, sampleRate, pending.features[copy].data());
+	if(ok)
+		LV2Apply_activate(pending.slot, copy);
+	pending.ready[copy] = ok;
+	return ok;
+}
+
+// free the slot if any of its copies failed to instantiate
+bool Lv2Host::finishInstantiation(struct pendingSlot& pending)
+{
+	bool ok = true;
+	for(unsigned int k = 0; k < pending.nCopies; ++k)
+		ok &= (bool)pending.ready[k];
+	if(!ok)
+	{
+		context->lock();
+		LV2Apply_free(pending.slot);
+		context->unlock();
+	}
+	if(!ok)
+	{
+		for(auto slotWorker : pending.workers)
+			worker.removeInstance(slotWorker);
+		pending.slot = nullptr;
+	}
+	return ok;
+}
+
+struct Lv2Host::instantiateJob {
+	Lv2Host* host;
+	std::vector<struct pendingSlot>* pending;
+	// the slot and copy of each instance
+	std::vector<std::pair<unsigned int, unsigned int>> instances;
+	std::atomic<unsigned int> next;
+};
+
+void* Lv2Host::instantiateSlots(void* arg)
+{
+	struct instantiateJob* job = (struct instantiateJob*)arg;
+	auto& pending = *job->pending;
+	unsigned int n;
+	while((n = job->next++) < job->instances.size())
+	{
+		auto& p = pending[job->instances[n].first];
+		unsigned int k = job->instances[n].second;
+		job->host->instantiateCopy(p, k);
+	}
+	return NULL;
+}
+
+int Lv2Host::add(std::string const& pluginUri)
+{
+	return addChain(std::vector<std::string>(1, pluginUri), 1)[0];
+}
+
+int Lv2Host::addMulti(std::string const& pluginUri, unsigned int nCopies, bool parallel, unsigned int nThreads)
+{
+	if(!nCopies)
+		return -1;
+	std::vector<struct pendingSlot> pending(1);
+	pending[0].uri = pluginUri;
+	pending[0].nCopies = nCopies;
+	pending[0].parallel = parallel;
+	return addSlots(pending, nThreads)[0];
+}
+
+std::vector<int> Lv2Host::addChain(std::vector<std::string> const& pluginUris, unsigned int nThreads)
+{
+	std::vector<struct pendingSlot> pending(pluginUris.size());
+	for(unsigned int n = 0; n < pending.size(); ++n)
+		pending[n].uri = pluginUris[n];
+	return addSlots(pending, nThreads);
+}
+
+std::vector<int> Lv2Host::addSlots(std::vector<struct pendingSlot>& pending, unsigned int nThreads)
+{
+	// looking plugins up, allocating their ports and opening their
+	// libraries use the world and the arena, which are not thread-safe
+	struct instantiateJob job;
+	for(unsigned int n = 0; n < pending.size(); ++n)
+	{
+		if(!prepareSlot(pending[n]))
+			continue;
+		for(unsigned int k = 0; k < pending[n].nCopies; ++k)
+			job.instances.emplace_back(n, k);
+	}
+	if(nThreads == 0)
+		nThreads = std::max(1L, sysconf(_SC_NPROCESSORS_ONLN));
+	nThreads = std::max(1u, std::min<unsigned int>(nThreads, job.instances.size()));
+	job.host = this;
+	job.pending = &pending;
+	job.next = 0;
+	std::vector<pthread_t> threads(nThreads - 1);
+	unsigned int nStarted = 0;
+	for(auto& thread : threads)
+	{
+		if(pthread_create(&thread, NULL, instantiateSlots, &job))
+			break;
+		++nStarted;
+	}
+	// this thread takes its share too
+	instantiateSlots(&job);
+	for(unsigned int n = 0; n < nStarted; ++n)
+		pthread_join(threads[n], NULL);
+	// wire the slots in order
+	std::vector<int> indices(pending.size(), -1);
+	for(unsigned int n = 0; n < pending.size(); ++n)
+	{
+		auto& p = pending[n];
+		if(!p.slot || !finishInstantiation(p))
+			continue;
+		insertSlot(p.slot, p.workers, p.parallel);
+		indices[n] = slots.size() - 1;
+	}
+	updatePlan();
+	return indices;
+}
+
+// set up what a new slot needs besides the plugin: its worker, its atom
+// ports and its latency
+struct Lv2Host::atomPorts* Lv2Host::setupSlot(LV2Apply* slot, std::vector<Lv2Worker::Instance*> const& workers)
+{
+	for(unsigned int k = 0; k < slot->n_copies; ++k)
+		workers[k]->setup(slot->instances[k]);
+	// the buffers of the atom ports are allocated once and for all
+	struct atomPorts* atoms = new struct atomPorts;
+	for(unsigned int n = 0; n < slot->n_atom_in + slot->n_atom_out; ++n)
+	{
+		bool isInput = n < slot->n_atom_in;
+		unsigned int channel = isInput ? n : n - slot->n_atom_in;
+		struct atomPort* port = new struct atomPort;
+		port->port = LV2Apply_getAtomPortIndex(slot, channel, isInput);
+		port->capacity = lv2_atom_pad_size(std::max(kAtomBufferSize, slot->ports[port->port].min_size));
+		port->buffer = (LV2_Atom_Sequence*)allocate(port->capacity);
+		port->pending = isInput ? (LV2_Atom_Sequence*)allocate(port->capacity) : nullptr;
+		port->scratch = (LV2_Atom_Sequence*)allocate(port->capacity);
+		port->queue.setup(kAtomQueueSize);
+		atomSequenceClear(port->buffer, atomSequenceUrid);
+		if(isInput)
+		{
+			atomSequenceClear(port->pending, atomSequenceUrid);
+			slot->atom_in_bufs[channel] = port->buffer;
+			atoms->inputs.emplace_back(port);
+		} else {
+			slot->atom_out_bufs[channel] = port->buffer;
+			atoms->outputs.emplace_back(port);
+		}
+	}
+	// plugins report their latency when they run: run this one once on
+	// silence before it goes into a plan. render() may be running the
+	// other slots, so this uses buffers of its own.
+	if(slot->latency_port >= 0)
+	{
+		memset(probeInput, 0, maxBlockSize * sizeof(probeInput[0]));
+		std::fill(slot->in_bufs, slot->in_bufs + slot->n_audio_in, probeInput);
+		std::fill(slot->out_bufs, slot->out_bufs + slot->n_audio_out, probeOutput);
+		for(auto& port : atoms->outputs)
+			atomSequencePrepareOutput(port->buffer, port->capacity, atomChunkUrid);
+		LV2Apply_connectPorts(slot);
+		LV2Apply_run(slot, maxBlockSize);
+	}
+	context->lock();
+	LV2Apply_printPorts(context->getWorld(), slot->plugin);
+	context->unlock();
+	// verbose
+	unsigned int inAudio, outAudio, inCtl, outCtl;
+	LV2Apply_getPortCount(slot, &inAudio, &outAudio, &inCtl, &outCtl);
+	printf("Ports: in audio %u, out audio %u, in ctl %u, out ctl %u\n", inAudio, outAudio, inCtl, outCtl);
+	return atoms;
+}
+
+void Lv2Host::releaseAtoms(struct atomPorts& atoms)
+{
+	for(auto ports : {&atoms.inputs, &atoms.outputs})
+	{
+		for(auto& port : *ports)
+		{
+			release(port->buffer);
+			release(port->pending);
+			release(port->scratch);
+		}
+	}
+}
+
+void Lv2Host::insertSlot(LV2Apply* slot, std::vector<Lv2Worker::Instance*> const& workers, bool parallel)
+{
+	slotAtoms.emplace_back(setupSlot(slot, workers));
+	slots.push_back(slot);
+	slotWorkers.push_back(workers);
+	parallelCopies.push_back(parallel);
+	slotEvents.emplace_back(new std::vector<struct controlEvent>);
+	slotEvents.back()->reserve(kControlQueueSize);
+	slotGenerations.push_back(planGeneration + 1);
+	bypassFades.emplace_back(new unsigned int(0));
+#ifdef LV2HOST_PROFILE
+	slotProfiles.emplace_back(new RtProfile);
+#endif
+	bypassChangeFrames.push_back(0);
+	bypassChanged.push_back(false);
+	slotLatencies.push_back(LV2Apply_getLatency(slot));
+	unsigned int inAudio = slot->n_audio_in;
+	unsigned int outAudio = slot->n_audio_out;
+
+	auto idx = slots.size() - 1;
+
+	inputSources.emplace_back(inAudio);
+	auto& sources = inputSources.back();
+	struct map source;
+	source.gain = 1;
+	source.delay = 0;
+	if(idx == 0)
+	{
+		// automap inputs of first plugin to audio inputs
+		for(unsigned int n = 0; n < std::min(inAudio, nAudioInputs); ++n)
+		{
+			source.slot = -1;
+			source.channel = n;
+			sources[n].push_back(source);
+		}
+	} else {
+		// connect the outputs of the previous slot to the input of the
+		// current one.
+		// When the channel count differs, the last outputs are mixed
+		// into the last input, or the last output is duplicated to the
+		// remaining inputs.
+		unsigned int prevNOut = slots[idx-1]->n_audio_out;
+		unsigned int currNIn = slots[idx]->n_audio_in;
+		source.slot = idx - 1;
+		for(unsigned int n = 0; prevNOut && n < currNIn; ++n)
+		{
+			source.channel = std::min(prevNOut - 1, n);
+			sources[n].push_back(source);
+		}
+		if(currNIn && prevNOut > currNIn)
+		{
+			auto& last = sources[currNIn - 1];
+			last.clear();
+			source.gain = 1.f / (prevNOut - currNIn + 1);
+			for(unsigned int n = currNIn - 1; n < prevNOut; ++n)
+			{
+				source.channel = n;
+				last.push_back(source);
+			}
+		}
+	}
+	// map the outputs of the last plugin to the outputs of the host
+	source.slot = idx;
+	source.gain = 1;
+	for(unsigned int n = 0; n < std::min(nAudioOutputs, outAudio); ++n)
+	{
+		source.channel = n;
+		outputMap[n].assign(1, source);
+	}
+	// feed the MIDI inputs with the MIDI outputs of the previous slot, in
+	// order, and everything else with the events sent to it
+	atomSources.emplace_back(slot->n_atom_in);
+	std::vector<unsigned int> midiOutputs;
+	if(idx > 0)
+	{
+		auto prev = slots[idx - 1];
+		for(unsigned int n = 0; n < prev->n_atom_out; ++n)
+			if(prev->ports[LV2Apply_getAtomPortIndex(prev, n, false)].supports_midi)
+				midiOutputs.push_back(n);
+	}
+	unsigned int nMidiInputs = 0;
+	for(unsigned int n = 0; n < slot->n_atom_in; ++n)
+	{
+		auto& atomSource = atomSources.back()[n];
+		atomSource.slot = -1;
+		atomSource.channel = 0;
+		atomSource.gain = 1;
+		atomSource.delay = 0;
+		if(!slot->ports[LV2Apply_getAtomPortIndex(slot, n, true)].supports_midi || midiOutputs.empty())
+			continue;
+		atomSource.slot = idx - 1;
+		atomSource.channel = midiOutputs[std::min<unsigned int>(nMidiInputs, midiOutputs.size() - 1)];
+		++nMidiInputs;
+	}
+}
+
+bool Lv2Host::replace(unsigned int slotNumber, std::string const& pluginUri)
+{
+	if(slotNumber >= slots.size())
+		return false;
+	freeRetiredSlots(false);
+	LV2Apply* old = slots[slotNumber];
+	struct pendingSlot pending;
+	pending.uri = pluginUri;
+	// a multi-instance slot keeps its number of copies
+	pending.nCopies = old->n_copies;
+	if(!prepareSlot(pending))
+		return false;
+	for(unsigned int k = 0; k < pending.nCopies; ++k)
+		instantiateCopy(pending, k);
+	if(!finishInstantiation(pending))
+		return false;
+	LV2Apply* slot = pending.slot;
+	// carry the control values over to the ports with the same symbol
+	for(unsigned int p = 0; p < slot->n_ports; ++p)
+	{
+		auto info = LV2Apply_getPortInfo(slot, p);
+		if(slot->ports[p].type != TYPE_CONTROL || !slot->ports[p].is_input || !info->symbol)
+			continue;
+		for(unsigned int o = 0; o < old->n_ports; ++o)
+		{
+			auto oldInfo = LV2Apply_getPortInfo(old, o);
+			if(old->ports[o].type == TYPE_CONTROL && old->ports[o].is_input
+				&& oldInfo->symbol && !strcmp(oldInfo->symbol, info->symbol))
+			{
+				for(unsigned int k = 0; k < slot->n_copies; ++k)
+				{
+					float value = old->ports[k * old->n_ports + o].value;
+					auto& port = slot->ports[k * slot->n_ports + p];
+					port.value = std::min(std::max(value, port.minValue), port.maxValue);
+				}
+				break;
+			}
+		}
+	}
+	// a state still waiting to be restored was meant for the old plugin
+	cancelRestores(slotNumber);
+	slot->bypass = old->bypass;
+	struct retiredSlot retired;
+	retired.slot = old;
+	retired.workers = slotWorkers[slotNumber];
+	retired.atoms = std::move(slotAtoms[slotNumber]);
+	// the timestamped changes still pending refer to the ports of the
+	// old plugin
+	retired.events = std::move(slotEvents[slotNumber]);
+	retired.generation = planGeneration + 1;
+	retiredSlots.push_back(std::move(retired));
+
+	slotAtoms[slotNumber].reset(setupSlot(slot, pending.workers));
+	slots[slotNumber] = slot;
+	slotWorkers[slotNumber] = pending.workers;
+	slotEvents[slotNumber].reset(new std::vector<struct controlEvent>);
+	slotEvents[slotNumber]->reserve(kControlQueueSize);
+	slotGenerations[slotNumber] = planGeneration + 1;
+	slotLatencies[slotNumber] = LV2Apply_getLatency(slot);
+
+	// keep the connections, within the channels the new plugin has: the
+	// inputs it has in excess get the sources of the last one, and those
+	// reading outputs it does not have read its last one instead
+	auto& sources = inputSources[slotNumber];
+	if(!sources.empty())
+		sources.resize(slot->n_audio_in, sources.back());
+	else
+		sources.resize(slot->n_audio_in);
+	auto fixSources = [this, slotNumber, slot](std::vector<struct map>& sources) {
+		for(auto it = sources.begin(); it != sources.end();)
+		{
+			if(it->slot == (int)slotNumber && it->channel >= (int)slot->n_audio_out)
+			{
+				if(!slot->n_audio_out)
+				{
+					it = sources.erase(it);
+					continue;
+				}
+				it->channel = slot->n_audio_out - 1;
+			}
+			++it;
+		}
+	};
+	for(auto& slotSources : inputSources)
+		for(auto& channelSources : slotSources)
+			fixSources(channelSources);
+	for(auto& channelSources : outputMap)
+		fixSources(channelSources);
+	struct map hostEvents;
+	hostEvents.slot = -1;
+	hostEvents.channel = 0;
+	hostEvents.gain = 1;
+	hostEvents.delay = 0;
+	atomSources[slotNumber].resize(slot->n_atom_in, hostEvents);
+	for(auto& slotSources : atomSources)
+		for(auto& source : slotSources)
+			if(source.slot == (int)slotNumber && source.channel >= (int)slot->n_atom_out)
+				source = hostEvents;
+
+	updatePlan();
+	return true;
+}
+
+std::vector<struct Lv2Host::preset> Lv2Host::getPresets(unsigned int slotN)
+{
+	std::vector<struct preset> presets;
+	if(slotN >= slots.size())
+		return presets;
+	context->lock();
+	LV2Apply_getPresets(slots[slotN], context->getWorld(), [](void* arg, const char* uri, const char* label) {
+		((std::vector<struct preset>*)arg)->push_back({uri, label ? label : ""});
+	}, &presets);
+	context->unlock();
+	return presets;
+}
+
+bool Lv2Host::loadPreset(unsigned int slotN, std::string const& presetUri)
+{
+	if(slotN >= slots.size())
+		return false;
+	LilvWorld* world = context->getWorld();
+	context->lock();
+	LilvNode* preset = lilv_new_uri(world, presetUri.c_str());
+	lilv_world_load_resource(world, preset);
+	LilvState* state = lilv_state_new_from_world(world, context->getMap(), preset);
+	lilv_node_free(preset);
+	context->unlock();
+	if(!state)
+	{
+		fprintf(stderr, "Lv2Host: unable to load preset %s\n", presetUri.c_str());
+		return false;
+	}
+	return restoreState(slotN, state);
+}
+
+bool Lv2Host::loadState(unsigned int slotN, std::string const& path)
+{
+	if(slotN >= slots.size())
+		return false;
+	context->lock();
+	LilvState* state = lilv_state_new_from_file(context->getWorld(), context->getMap(), NULL, path.c_str());
+	context->unlock();
+	if(!state)
+	{
+		fprintf(stderr, "Lv2Host: unable to load state from %s\n", path.c_str());
+		return false;
+	}
+	return restoreState(slotN, state);
+}
+
+bool Lv2Host::saveState(unsigned int slotN, std::string const& directory)
+{
+	if(slotN >= slots.size())
+		return false;
+	LV2Apply* slot = slots[slotN];
+	const char* dir = directory.c_str();
+	struct stateValues values;
+	values.host = this;
+	values.slot = slot;
+	values.slotNumber = slotN;
+	values.staged = false;
+	context->lock();
+	// plugins may save their state while they run
+	LilvState* state = lilv_state_new_from_instance(slot->plugin, slot->instance, context->getMap(),
+		NULL, dir, dir, dir, getStateValue, &values,
+		LV2_STATE_IS_POD | LV2_STATE_IS_PORTABLE, context->getFeatures().data());
+	int ret = -1;
+	if(state)
+		ret = lilv_state_save(context->getWorld(), context->getMap(), context->getUnmap(), state, NULL, dir, "state.ttl");
+	context->unlock();
+	lilv_state_free(state);
+	if(ret)
+	{
+		fprintf(stderr, "Lv2Host: unable to save the state of slot %u to %s\n", slotN, dir);
+		return false;
+	}
+	return true;
+}
+
+// Restore a state into a slot, taking ownership of it.
+bool Lv2Host::restoreState(unsigned int slotNumber, LilvState* state)
+{
+	LV2Apply* slot = slots[slotNumber];
+	// the control values are applied by render() in one go
+	struct stateValues values;
+	values.host = this;
+	values.slot = slot;
+	values.slotNumber = slotNumber;
+	values.staged = true;
+	lilv_state_emit_port_values(state, setStateValue, &values);
+	stageControls(values.events);
+	if(!LV2Apply_hasStateInterface(slot))
+	{
+		lilv_state_free(state);
+		return true;
+	}
+	// the rest is restored by the worker thread, once render() has
+	// switched to a plan that does not run the slot
+	std::shared_ptr<struct stateRestore> restore(new struct stateRestore);
+	restore->host = this;
+	restore->slotNumber = slotNumber;
+	restore->slot = slot;
+	restore->state = state;
+	auto& featureList = context->getFeatures();
+	restore->features.resize(slot->n_copies);
+	for(unsigned int k = 0; k < slot->n_copies; ++k)
+	{
+		restore->features[k].assign(featureList.begin(), featureList.end() - 1);
+		restore->features[k].push_back(slotWorkers[slotNumber][k]->getFeature());
+		restore->features[k].push_back(NULL);
+	}
+	restores.push_back(restore);
+	updatePlan();
+	worker.addJob(restoreJob, restore.get());
+	return true;
+}
+
+// called on the worker thread until it can restore the state
+bool Lv2Host::restoreJob(void* arg)
+{
+	struct stateRestore* restore = (struct stateRestore*)arg;
+	if((int)(restore->host->installedGeneration.load() - restore->generation) < 0)
+		return false;
+	// the control values have been staged already
+	for(unsigned int k = 0; k < restore->slot->n_copies; ++k)
+		lilv_state_restore(restore->state, restore->slot->instances[k], NULL, NULL, 0, restore->features[k].data());
+	restore->done.store(true);
+	return true;
+}
+
+// drop the restores into a slot that have not happened yet
+void Lv2Host::cancelRestores(unsigned int slotNumber)
+{
+	for(auto& restore : restores)
+	{
+		if(restore->slotNumber != slotNumber)
+			continue;
+		worker.removeJobs(restore.get());
+		restore->done.store(true);
+	}
+}
+
+void Lv2Host::stageControls(std::vector<struct controlEvent> const& events)
+{
+	freeAppliedControls();
+	// add to those render() has not picked up yet, if any
+	std::vector<struct controlEvent>* staged = stagedControls.exchange(nullptr);
+	if(!staged)
+		staged = new std::vector<struct controlEvent>;
+	staged->insert(staged->end(), events.begin(), events.end());
+	stagedControls.store(staged);
+}
+
+void Lv2Host::freeAppliedControls()
+{
+	std::vector<struct controlEvent>* applied;
+	while(appliedControls.pop(applied))
+		delete applied;
+}
+
+void Lv2Host::setStateValue(const char* symbol, void* arg, const void* value, uint32_t size, uint32_t type)
+{
+	struct stateValues* values = (struct stateValues*)arg;
+	Lv2Host* that = values->host;
+	float v;
+	if(type == that->atomFloatUrid && size == sizeof(float))
+		v = *(const float*)value;
+	else if(type == that->atomDoubleUrid && size == sizeof(double))
+		v = *(const double*)value;
+	else if((type == that->atomIntUrid || type == that->atomBoolUrid) && size == sizeof(int32_t))
+		v = *(const int32_t*)value;
+	else if(type == that->atomLongUrid && size == sizeof(int64_t))
+		v = *(const int64_t*)value;
+	else
+	{
+		fprintf(stderr, "Lv2Host: unsupported value type for port %s\n", symbol);
+		return;
+	}
+	LV2Apply* slot = values->slot;
+	int p = LV2Apply_getPortIndex(slot, symbol);
+	if(p < 0 || slot->ports[p].type != TYPE_CONTROL || !slot->ports[p].is_input)
+		return;
+	if(values->staged)
+	{
+		struct controlEvent event;
+		event.slot = values->slotNumber;
+		event.port = p;
+		event.value = v;
+		event.frame = 0;
+		event.generation = that->slotGenerations[values->slotNumber];
+		values->events.push_back(event);
+		return;
+	}
+	for(unsigned int k = 0; k < slot->n_copies; ++k)
+	{
+		auto& port = slot->ports[k * slot->n_ports + p];
+		port.value = std::min(std::max(v, port.minValue), port.maxValue);
+	}
+}
+
+const void* Lv2Host::getStateValue(const char* symbol, void* arg, uint32_t* size, uint32_t* type)
+{
+	struct stateValues* values = (struct stateValues*)arg;
+	LV2Apply* slot = values->slot;
+	int p = LV2Apply_getPortIndex(slot, symbol);
+	if(p < 0 || slot->ports[p].type != TYPE_CONTROL)
+		return NULL;
+	*size = sizeof(float);
+	*type = values->host->atomFloatUrid;
+	return &slot->ports[p].value;
+}
+
+// free the slots replaced by replace() that render() is done with, or all
+// of them
+void Lv2Host::freeRetiredSlots(bool all)
+{
+	unsigned int installed = installedGeneration.load();
+	for(auto it = retiredSlots.begin(); it != retiredSlots.end();)
+	{
+		if(!all && (int)(installed - it->generation) < 0)
+		{
+			++it;
+			continue;
+		}
+		// this waits for the worker thread to be done with the plugin
+		for(auto slotWorker : it->workers)
+			worker.removeInstance(slotWorker);
+		context->lock();
+		LV2Apply_free(it->slot);
+		context->unlock();
+		releaseAtoms(*it->atoms);
+		it = retiredSlots.erase(it);
+	}
+	for(auto it = retiredDelayLines.begin(); it != retiredDelayLines.end();)
+	{
+		if(!all && (int)(installed - it->generation) < 0)
+		{
+			++it;
+			continue;
+		}
+		release(it->line->buffer);
+		it = retiredDelayLines.erase(it);
+	}
+}
+
+bool Lv2Host::connect(int sourceSlotNumber, unsigned int sourceChannel, unsigned int destinationSlotNumber, unsigned int destinationChannel, float gain)
+{
+	struct map source;
+	source.slot = sourceSlotNumber;
+	source.channel = sourceChannel;
+	source.gain = gain;
+	source.delay = 0;
+	return setSource(source, destinationSlotNumber, destinationChannel, true);
+}
+
+bool Lv2Host::mix(int sourceSlotNumber, unsigned int sourceChannel, unsigned int destinationSlotNumber, unsigned int destinationChannel, float gain)
+{
+	struct map source;
+	source.slot = sourceSlotNumber;
+	source.channel = sourceChannel;
+	source.gain = gain;
+	source.delay = 0;
+	return setSource(source, destinationSlotNumber, destinationChannel, false);
+}
+
+bool Lv2Host::setSource(struct map const& source, unsigned int destinationSlotNumber, unsigned int destinationChannel, bool replace)
+{
+	if(-1 == source.slot) {
+		if(source.channel < 0 || source.channel >= (int)nAudioInputs)
+			return false;
+	} else if(!isSlotOutput(source)) {
+		return false;
+	}
+	try {
+		auto& sources = slots.size() == destinationSlotNumber
+			? outputMap.at(destinationChannel)
+			: inputSources.at(destinationSlotNumber).at(destinationChannel);
+		if(replace)
+			sources.clear();
+		auto it = std::find_if(sources.begin(), sources.end(), [&source](struct map const& m) {
+			return m.slot == source.slot && m.channel == source.channel;
+		});
+		if(it != sources.end())
+			it->gain = source.gain;
+		else
+			sources.push_back(source);
+	} catch (std::exception e) {
+		return false;
+	}
+	updatePlan();
 	return true;
 }
 
-void Lv2Host::cleanup()
+bool Lv2Host::connectEvents(int sourceSlotNumber, unsigned int sourcePort, unsigned int destinationSlotNumber, unsigned int destinationPort)
+{
+	if(-1 != sourceSlotNumber && (sourceSlotNumber < 0 || sourceSlotNumber >= (int)slots.size()
+		|| sourcePort >= slots[sourceSlotNumber]->n_atom_out))
+		return false;
+	if(destinationSlotNumber >= slots.size() || destinationPort >= slots[destinationSlotNumber]->n_atom_in)
+		return false;
+	auto& source = atomSources[destinationSlotNumber][destinationPort];
+	source.slot = sourceSlotNumber;
+	source.channel = -1 == sourceSlotNumber ? 0 : sourcePort;
+	updatePlan();
+	return true;
+}
+
+bool Lv2Host::disconnect(unsigned int destinationSlotNumber, unsigned int destinationChannel)
+{
+	try {
+		if(-1 == destinationSlotNumber) {
+			for(auto& slotSources : inputSources)
+				for(auto& sources : slotSources)
+					sources.erase(std::remove_if(sources.begin(), sources.end(), [destinationChannel](struct map const& m) {
+						return -1 == m.slot && (int)destinationChannel == m.channel;
+					}), sources.end());
+		} else if(slots.size() == destinationSlotNumber) {
+			outputMap.at(destinationChannel).clear();
+		} else {
+			inputSources.at(destinationSlotNumber).at(destinationChannel).clear();
+		}
+	} catch (std::exception e) {
+		return false;
+	}
+	updatePlan();
+	return true;
+}
+
+void Lv2Host::bypass(unsigned int slotNumber, bool bypassed)
+{
+	auto slot = slots[slotNumber];
+	if(slot->bypass == bypassed)
+		return;
+	slot->bypass = bypassed;
+	bypassChanged[slotNumber] = true;
+	bypassChangeFrames[slotNumber] = renderedFrames.load();
+	updatePlan();
+}
+
+bool Lv2Host::checkLatency()
+{
+	if(!latencyChanged.exchange(false))
+		return false;
+	bool changed = false;
+	for(unsigned int s = 0; s < slots.size(); ++s)
+	{
+		unsigned int latency = LV2Apply_getLatency(slots[s]);
+		if(latency != slotLatencies[s])
+		{
+			slotLatencies[s] = latency;
+			changed = true;
+		}
+	}
+	if(changed)
+		updatePlan();
+	return changed;
+}
+
+void Lv2Host::setBypassFade(unsigned int frames)
+{
+	bypassFadeFrames = frames;
+}
+
+// Whether the slot may still be crossfading. This errs on the long side:
+// a plan with a slot that has already completed its crossfade gets
+// replaced after one block.
+bool Lv2Host::isFading(unsigned int slotNumber)
+{
+	if(!bypassChanged[slotNumber] || !bypassFadeFrames)
+		return false;
+	if(renderedFrames.load() - bypassChangeFrames[slotNumber] < bypassFadeFrames + 2 * maxBlockSize)
+		return true;
+	bypassChanged[slotNumber] = false;
+	return false;
+}
+
+bool Lv2Host::setParallel(unsigned int nWorkers, int priority)
+{
+	bool ret = true;
+	if(0 == nWorkers)
+		scheduler.stop();
+	else
+		ret = scheduler.start(nWorkers, priority);
+	// the scheduler's graph depends on the number of threads
+	updatePlan();
+	return ret;
+}
+
+bool Lv2Host::isSlotOutput(struct map const& source)
+{
+	return source.slot >= 0 && source.slot < (int)slots.size()
+		&& source.channel >= 0 && source.channel < (int)slots[source.slot]->n_audio_out;
+}
+
+// Append to `active` the sources that actually contribute to an input,
+// with their gain multiplied by `gain`. Invalid channels are silent, and
+// the outputs of bypassed slots are replaced with the sources of their
+// inputs.
+void Lv2Host::resolveSources(std::vector<struct map> const& sources, float gain, std::vector<bool> const& bypassed, std::vector<bool> const& fading, std::vector<struct map>& active, unsigned int depth)
+{
+	for(auto& source : sources)
+	{
+		if(-1 == source.slot)
+		{
+			if(source.channel < 0 || source.channel >= (int)nAudioInputs)
+				continue;
+		} else if(!isSlotOutput(source)) {
+			continue;
+		} else if(bypassed[source.slot] && !fading[source.slot]) {
+			auto slot = slots[source.slot];
+			// stop at loops of bypassed slots
+			if(slot->n_audio_in && depth < slots.size())
+			{
+				unsigned int channel = std::min<unsigned int>(source.channel, slot->n_audio_in - 1);
+				resolveSources(inputSources[source.slot][channel], gain * source.gain, bypassed, fading, active, depth + 1);
+			}
+			continue;
+		}
+		auto it = std::find_if(active.begin(), active.end(), [&source](struct map const& m) {
+			return m.slot == source.slot && m.channel == source.channel;
+		});
+		if(it != active.end())
+		{
+			it->gain += gain * source.gain;
+		} else {
+			active.push_back(source);
+			active.back().gain *= gain;
+		}
+	}
+}
+
+void Lv2Host::updatePlan()
+{
+	std::vector<bool> bypassed(slots.size());
+	std::vector<bool> fading(slots.size());
+	bool anyFading = false;
+	for(unsigned int s = 0; s < slots.size(); ++s)
+	{
+		bypassed[s] = slots[s]->bypass;
+		fading[s] = isFading(s);
+		anyFading |= fading[s];
+	}
+	// forget the restores that are over: the plans that wait for them
+	// keep them alive for as long as render() may look at them
+	for(auto it = restores.begin(); it != restores.end();)
+	{
+		if((*it)->done.load())
+			it = restores.erase(it);
+		else
+			++it;
+	}
+	// The slots restoring a state do not run while the worker thread
+	// restores it. Those that start restoring now fade out first, and
+	// those that run again afterwards fade back in. Those left to restore
+	// by an earlier plan may already be restoring, so they stop right
+	// away.
+	std::vector<bool> restoring(bypassed);
+	std::vector<bool> resuming(slots.size(), false);
+	bool anyStopping = false;
+	bool anyResuming = false;
+	for(auto& restore : restores)
+	{
+		unsigned int s = restore->slotNumber;
+		bool running = !bypassed[s] || fading[s];
+		restoring[s] = true;
+		fading[s] = !restore->generation && running && bypassFadeFrames;
+		resuming[s] = !bypassed[s] && bypassFadeFrames;
+		anyStopping |= fading[s];
+		anyResuming |= resuming[s];
+	}
+	std::vector<bool> notFading(slots.size(), false);
+	renderPlan* newPlan = buildPlan(restoring, fading);
+	renderPlan* last = newPlan;
+	if(anyStopping)
+	{
+		last->after = buildPlan(restoring, notFading);
+		last = last->after;
+	}
+	// the restores wait for the first plan that does not run their slot
+	last->restores = restores;
+	renderPlan* stopped = last;
+	if(anyResuming)
+	{
+		last->after = buildPlan(bypassed, resuming);
+		last = last->after;
+	}
+	if(anyFading || !restores.empty())
+		last->after = buildPlan(bypassed, notFading);
+	for(renderPlan* p = newPlan; p; p = p->after)
+		p->generation = ++planGeneration;
+	for(auto& restore : restores)
+	{
+		if(!restore->generation)
+			restore->generation = stopped->generation;
+	}
+
+	// free whatever render() is done with, then hand over the new plan
+	renderPlan* retired;
+	while(retiredPlans.pop(retired))
+		delete retired;
+	freeRetiredSlots(false);
+	freeAppliedControls();
+	delete nextPlan.exchange(newPlan);
+}
+
+Lv2Host::renderPlan* Lv2Host::buildPlan(std::vector<bool> const& bypassed, std::vector<bool> const& fading)
+{
+	renderPlan* newPlan = new renderPlan;
+	unsigned int nSlots = slots.size();
+	newPlan->slots = slots;
+	newPlan->slotGenerations = slotGenerations;
+	newPlan->bypass.resize(nSlots);
+	newPlan->fading = fading;
+	newPlan->fadeLength = bypassFadeFrames;
+	newPlan->inputs.resize(nSlots);
+	newPlan->outputs.resize(nSlots);
+	newPlan->inputMixes.resize(nSlots);
+	for(unsigned int s = 0; s < nSlots; ++s)
+	{
+		newPlan->events.push_back(slotEvents[s].get());
+		newPlan->bypass[s] = bypassed[s];
+		newPlan->fades.push_back(bypassFades[s].get());
+#ifdef LV2HOST_PROFILE
+		newPlan->profiles.push_back(slotProfiles[s].get());
+#endif
+		newPlan->latencies.push_back(slotLatencies[s]);
+		newPlan->workers.push_back(slotWorkers[s]);
+		if(fading[s])
+			newPlan->fadingSlots.push_back(s);
+	}
+	// a single source with unity gain and no delay is read in place,
+	// anything else goes through a mix
+	auto isDirect = [](std::vector<struct map> const& sources) {
+		return 1 == sources.size() && 1 == sources[0].gain && 0 == sources[0].delay;
+	};
+	std::vector<std::vector<std::vector<struct map>>> inputActive(nSlots);
+	for(unsigned int s = 0; s < nSlots; ++s)
+	{
+		for(auto& sources : inputSources[s])
+		{
+			inputActive[s].emplace_back();
+			resolveSources(sources, 1, bypassed, fading, inputActive[s].back(), 0);
+		}
+	}
+	std::vector<std::vector<struct map>> outputActive;
+	for(auto& sources : outputMap)
+	{
+		outputActive.emplace_back();
+		resolveSources(sources, 1, bypassed, fading, outputActive.back(), 0);
+	}
+
+	// Delay compensation: the inputs of a slot all wait for the source
+	// with the most latency, and so do the host outputs. Sources read
+	// from a later slot are one block late anyway, and are not
+	// compensated.
+	std::vector<unsigned int> outputLatencies(nSlots);
+	auto arrival = [&outputLatencies](struct map const& source) {
+		return -1 == source.slot ? 0 : outputLatencies[source.slot];
+	};
+	for(unsigned int s = 0; s < nSlots; ++s)
+	{
+		unsigned int latency = 0;
+		for(auto& sources : inputActive[s])
+			for(auto& source : sources)
+				if(source.slot < (int)s)
+					latency = std::max(latency, arrival(source));
+		for(auto& sources : inputActive[s])
+			for(auto& source : sources)
+				if(source.slot < (int)s)
+					source.delay = latency - arrival(source);
+		outputLatencies[s] = latency + slotLatencies[s];
+	}
+	chainLatency = 0;
+	for(auto& sources : outputActive)
+		for(auto& source : sources)
+			chainLatency = std::max(chainLatency, arrival(source));
+	for(auto& sources : outputActive)
+		for(auto& source : sources)
+			source.delay = chainLatency - arrival(source);
+
+	// who reads each slot output. A bypassed slot does not write its
+	// outputs: its readers read from its sources instead.
+	std::vector<std::vector<std::vector<unsigned int>>> readers(nSlots);
+	std::vector<std::vector<unsigned int>> nHostOutputs(nSlots);
+	std::vector<std::vector<unsigned int>> nDirectHostOutputs(nSlots);
+	for(unsigned int s = 0; s < nSlots; ++s)
+	{
+		readers[s].resize(slots[s]->n_audio_out);
+		nHostOutputs[s].assign(slots[s]->n_audio_out, 0);
+		nDirectHostOutputs[s].assign(slots[s]->n_audio_out, 0);
+	}
+	for(unsigned int s = 0; s < nSlots; ++s)
+		for(auto& sources : inputActive[s])
+			for(auto& source : sources)
+				if(-1 != source.slot)
+					readers[source.slot][source.channel].push_back(s);
+	for(auto& sources : outputActive)
+	{
+		for(auto& source : sources)
+		{
+			if(-1 == source.slot)
+				continue;
+			++nHostOutputs[source.slot][source.channel];
+			if(isDirect(sources))
+				++nDirectHostOutputs[source.slot][source.channel];
+		}
+	}
+
+	// Give a buffer to each slot output that is read by a slot or mixed
+	// into a host output, and to each input fed by a mix. The
+	// lifetime of a buffer goes from the slot writing it to the last slot
+	// reading it, and buffers whose lifetimes do not overlap share the
+	// same memory. Buffers copied to the host outputs live until the end
+	// of the block, and buffers read by an earlier slot (or the slot
+	// itself) have to keep their content until the next block, so they
+	// are never shared. A mix buffer is written right before its slot
+	// runs and only lives as long as that. When the slots run in parallel,
+	// a buffer is only handed to a slot that runs after all of its
+	// previous users anyway, so that sharing it does not serialise
+	// independent branches of the graph.
+	std::vector<std::vector<unsigned int>> successors(nSlots);
+	std::vector<std::vector<float*>> outputBuffers(nSlots);
+	std::vector<std::vector<float*>> mixBuffers(nSlots);
+	std::vector<unsigned int> freeBuffers;
+	// for each buffer in use, the last slot using it
+	std::vector<unsigned int> lastUse;
+	// for each buffer, the slots that used it last
+	std::vector<std::vector<unsigned int>> users;
+	const unsigned int kForever = -1;
+	// the slots each slot waits for, directly or not
+	std::vector<std::vector<bool>> ancestors(nSlots, std::vector<bool>(nSlots, false));
+	std::vector<std::vector<unsigned int>> predecessors(nSlots);
+	for(unsigned int s = 0; s < nSlots; ++s)
+		for(auto& sources : inputActive[s])
+			for(auto& source : sources)
+				if(-1 != source.slot && source.slot != (int)s)
+					predecessors[std::max<unsigned int>(s, source.slot)].push_back(std::min<unsigned int>(s, source.slot));
+	auto addAncestor = [&](unsigned int s, unsigned int a) {
+		ancestors[s][a] = true;
+		for(unsigned int n = 0; n < nSlots; ++n)
+			if(ancestors[a][n])
+				ancestors[s][n] = true;
+	};
+	bool parallel = scheduler.getNumWorkers() > 0;
+	unsigned int nLogical = 0;
+	auto acquire = [&](unsigned int s, unsigned int last, std::vector<unsigned int> const& bufferUsers) {
+		++nLogical;
+		unsigned int b;
+		// the most recently released buffer that can be reused
+		auto reusable = freeBuffers.end();
+		for(auto it = freeBuffers.rbegin(); it != freeBuffers.rend(); ++it)
+		{
+			bool ordered = true;
+			for(auto u : users[*it])
+				ordered &= !parallel || u == s || ancestors[s][u];
+			if(ordered)
+			{
+				reusable = std::next(it).base();
+				break;
+			}
+		}
+		if(freeBuffers.end() != reusable)
+		{
+			b = *reusable;
+			freeBuffers.erase(reusable);
+			// the slots that used this buffer before have to be done
+			// with it before this one writes into it
+			for(auto u : users[b])
+			{
+				if(u != s)
+				{
+					successors[u].push_back(s);
+					addAncestor(s, u);
+				}
+			}
+		} else {
+			b = lastUse.size();
+			lastUse.push_back(kForever);
+			users.emplace_back();
+		}
+		lastUse[b] = last;
+		users[b] = bufferUsers;
+		users[b].push_back(s);
+		if(buffers.size() <= b)
+			buffers.push_back((float*)allocate(maxBlockSize * sizeof(float)));
+		return buffers[b];
+	};
+	for(unsigned int s = 0; s < nSlots; ++s)
+	{
+		outputBuffers[s].assign(slots[s]->n_audio_out, nullptr);
+		mixBuffers[s].assign(slots[s]->n_audio_in, nullptr);
+		for(auto p : predecessors[s])
+			addAncestor(s, p);
+		if(bypassed[s] && !fading[s])
+			continue;
+		// release the buffers nobody reads any more
+		for(unsigned int b = 0; b < lastUse.size(); ++b)
+		{
+			if(lastUse[b] < s)
+			{
+				freeBuffers.push_back(b);
+				lastUse[b] = kForever;
+			}
+		}
+		for(unsigned int ch = 0; ch < slots[s]->n_audio_out; ++ch)
+		{
+			auto& chReaders = readers[s][ch];
+			// outputs nobody reads are written to a scratch buffer
+			// of their copy, and those only copied to a host output
+			// are connected to it directly
+			if(chReaders.empty() && !nHostOutputs[s][ch])
+				continue;
+			if(chReaders.empty() && 1 == nHostOutputs[s][ch] && 1 == nDirectHostOutputs[s][ch])
+				continue;
+			unsigned int last = s;
+			for(auto r : chReaders)
+				last = r > s ? std::max(last, r) : kForever;
+			if(nHostOutputs[s][ch])
+				last = kForever;
+			outputBuffers[s][ch] = acquire(s, last, chReaders);
+		}
+		for(unsigned int ch = 0; ch < slots[s]->n_audio_in; ++ch)
+		{
+			auto& sources = inputActive[s][ch];
+			if(sources.size() && !isDirect(sources))
+				mixBuffers[s][ch] = acquire(s, s, std::vector<unsigned int>());
+		}
+	}
+	lastBufferStats.nSlotOutputs = 0;
+	for(auto slot : slots)
+		lastBufferStats.nSlotOutputs += slot->n_audio_out;
+	lastBufferStats.nBuffers = nLogical;
+	lastBufferStats.nPooledBuffers = lastUse.size();
+	lastBufferStats.nAllocatedBuffers = buffers.size();
+	lastBufferStats.workingSetBytes = lastUse.size() * maxBlockSize * sizeof(float);
+
+	// destinationSlot is -1 for a host output
+	auto makeMix = [&](std::vector<struct map> const& sources, float* destination, int destinationSlot, unsigned int destinationChannel) {
+		struct mix mix;
+		mix.destination = destination;
+		mix.hostChannel = destinationChannel;
+		for(auto& source : sources)
+		{
+			struct mixSource mixSource;
+			mixSource.buffer = nullptr;
+			mixSource.hostChannel = 0;
+			mixSource.gain = source.gain;
+			mixSource.delay = nullptr;
+			mixSource.delayFrames = source.delay;
+			if(source.delay)
+				mixSource.delay = getDelayLine(destinationSlot, destinationChannel, source);
+			if(-1 == source.slot)
+				mixSource.hostChannel = source.channel;
+			else
+				mixSource.buffer = outputBuffers[source.slot][source.channel];
+			mix.sources.push_back(mixSource);
+		}
+		return mix;
+	};
+	unsigned int nScratch = 0;
+	for(unsigned int s = 0; s < nSlots; ++s)
+	{
+		auto slot = slots[s];
+		for(unsigned int ch = 0; ch < slot->n_audio_in; ++ch)
+		{
+			auto& sources = inputActive[s][ch];
+			float* buffer = dummyInput;
+			for(auto& source : sources)
+			{
+				// if two slots share a buffer, the one that comes
+				// first in the chain has to complete before the other
+				// one starts. When a slot reads from a later one, it
+				// gets what was written in the previous block, so it
+				// still has to run before the buffer is overwritten.
+				if(-1 != source.slot && source.slot != (int)s)
+					successors[std::min<unsigned int>(s, source.slot)].push_back(std::max<unsigned int>(s, source.slot));
+			}
+			if(mixBuffers[s][ch])
+			{
+				buffer = mixBuffers[s][ch];
+				newPlan->inputMixes[s].push_back(makeMix(sources, buffer, s, ch));
+			} else if(sources.size() && -1 == sources[0].slot) {
+				// render() does not touch the ports of a slot that
+				// does not run: it may be restoring a state
+				if(!bypassed[s] || fading[s])
+				{
+					struct hostPort hostInput;
+					hostInput.slot = s;
+					hostInput.channel = ch;
+					hostInput.port = LV2Apply_getAudioPortIndex(slot, ch, true);
+					hostInput.hostChannel = sources[0].channel;
+					newPlan->hostInputs.push_back(hostInput);
+					buffer = nullptr;
+				}
+			} else if(sources.size()) {
+				buffer = outputBuffers[sources[0].slot][sources[0].channel];
+			}
+			newPlan->inputs[s].push_back(buffer);
+		}
+		// the outputs nobody reads are written to a scratch buffer of
+		// the copy they belong to, which can run in parallel with the
+		// others
+		unsigned int outputsPerCopy = std::max(1u, slot->n_audio_out / slot->n_copies);
+		newPlan->unusedOutputs.emplace_back(slot->n_audio_out, false);
+		for(unsigned int ch = 0; ch < slot->n_audio_out; ++ch)
+		{
+			float* buffer = outputBuffers[s][ch];
+			if(!buffer)
+			{
+				unsigned int n = nScratch + ch / outputsPerCopy;
+				if(scratchOutputs.size() <= n)
+					scratchOutputs.push_back((float*)allocate(maxBlockSize * sizeof(float)));
+				buffer = scratchOutputs[n];
+				newPlan->unusedOutputs[s][ch] = true;
+			}
+			newPlan->outputs[s].push_back(buffer);
+		}
+		nScratch += slot->n_copies;
+	}
+	// Each atom input reads the output it is connected to, or the events
+	// sent to it. The atom inputs of a bypassed slot are passed through to
+	// its outputs, in the same way as its audio.
+	for(unsigned int s = 0; s < nSlots; ++s)
+	{
+		newPlan->atoms.push_back(slotAtoms[s].get());
+		newPlan->atomInputs.emplace_back();
+		for(unsigned int ch = 0; ch < slots[s]->n_atom_in; ++ch)
+		{
+			unsigned int owner = s;
+			unsigned int channel = ch;
+			bool isOutput = false;
+			// stop at loops of bypassed slots
+			for(unsigned int depth = 0; depth < nSlots; ++depth)
+			{
+				auto& source = atomSources[owner][channel];
+				if(-1 == source.slot)
+					break;
+				auto sourceSlot = slots[source.slot];
+				owner = source.slot;
+				if(!bypassed[owner] || fading[owner] || !sourceSlot->n_atom_in)
+				{
+					isOutput = true;
+					channel = source.channel;
+					break;
+				}
+				channel = std::min<unsigned int>(source.channel, sourceSlot->n_atom_in - 1);
+			}
+			auto& ports = isOutput ? slotAtoms[owner]->outputs : slotAtoms[owner]->inputs;
+			newPlan->atomInputs[s].push_back(ports[channel]->buffer);
+			// the slot owning the buffer fills it, so it is ordered
+			// like a slot sharing an audio buffer
+			if(owner != s)
+				successors[std::min(s, owner)].push_back(std::max(s, owner));
+		}
+	}
+	for(auto& nodeSuccessors : successors)
+	{
+		std::sort(nodeSuccessors.begin(), nodeSuccessors.end());
+		nodeSuccessors.erase(std::unique(nodeSuccessors.begin(), nodeSuccessors.end()), nodeSuccessors.end());
+	}
+	// the copies of a multi-instance slot run in parallel as nodes of
+	// their own, between a node running the inputs and the first copy
+	// and one finishing the slot
+	bool anySplit = false;
+	for(unsigned int s = 0; s < nSlots; ++s)
+		anySplit |= parallelCopies[s] && slots[s]->n_copies > 1;
+	if(anySplit && scheduler.getNumWorkers())
+	{
+		std::vector<unsigned int> firstNode(nSlots);
+		std::vector<unsigned int> lastNode(nSlots);
+		for(unsigned int s = 0; s < nSlots; ++s)
+		{
+			firstNode[s] = newPlan->nodes.size();
+			unsigned int nCopies = slots[s]->n_copies;
+			if(!parallelCopies[s] || nCopies < 2)
+			{
+				newPlan->nodes.push_back({s, 0, kSlotNode});
+			} else {
+				newPlan->nodes.push_back({s, 0, kFirstNode});
+				for(unsigned int k = 1; k < nCopies; ++k)
+					newPlan->nodes.push_back({s, k, kCopyNode});
+				newPlan->nodes.push_back({s, 0, kLastNode});
+			}
+			lastNode[s] = newPlan->nodes.size() - 1;
+		}
+		std::vector<std::vector<unsigned int>> nodeSuccessors(newPlan->nodes.size());
+		for(unsigned int s = 0; s < nSlots; ++s)
+		{
+			for(auto successor : successors[s])
+				nodeSuccessors[lastNode[s]].push_back(firstNode[successor]);
+			for(unsigned int n = firstNode[s] + 1; n <= lastNode[s]; ++n)
+			{
+				nodeSuccessors[firstNode[s]].push_back(n);
+				if(n < lastNode[s])
+					nodeSuccessors[n].push_back(lastNode[s]);
+			}
+		}
+		newPlan->serialCopies.assign(nSlots, false);
+		newPlan->graph.setup(nodeSuccessors, scheduler.getNumThreads());
+	} else {
+		newPlan->graph.setup(successors, scheduler.getNumThreads());
+	}
+#ifdef LV2HOST_PROFILE
+	newPlan->starts.resize(nSlots);
+#endif
+
+	for(unsigned int n = 0; n < outputMap.size(); ++n)
+	{
+		// outputs nobody is connected to are left alone
+		if(outputMap[n].empty())
+			continue;
+		auto& sources = outputActive[n];
+		if(sources.empty())
+		{
+			// nothing valid to read from: silence
+			struct outputCopy copy;
+			copy.hostChannel = n;
+			copy.source = dummyInput;
+			newPlan->outputCopies.push_back(copy);
+		} else if(!isDirect(sources)) {
+			newPlan->outputMixes.push_back(makeMix(sources, nullptr, -1, n));
+		} else if(-1 == sources[0].slot) {
+			struct passThrough passThrough;
+			passThrough.hostChannel = n;
+			passThrough.inputChannel = sources[0].channel;
+			newPlan->passThroughs.push_back(passThrough);
+		} else {
+			auto& source = sources[0];
+			float* buffer = outputBuffers[source.slot][source.channel];
+			if(!buffer)
+			{
+				struct hostPort hostOutput;
+				hostOutput.slot = source.slot;
+				hostOutput.channel = source.channel;
+				hostOutput.port = LV2Apply_getAudioPortIndex(slots[source.slot], source.channel, false);
+				hostOutput.hostChannel = n;
+				newPlan->hostOutputs.push_back(hostOutput);
+				newPlan->outputs[source.slot][source.channel] = nullptr;
+				newPlan->unusedOutputs[source.slot][source.channel] = false;
+				continue;
+			}
+			struct outputCopy copy;
+			copy.hostChannel = n;
+			copy.source = buffer;
+			newPlan->outputCopies.push_back(copy);
+		}
+	}
+
+	newPlan->slotMeters.resize(nSlots);
+	for(auto& meter : meters)
+	{
+		if(!meter->enabled)
+			continue;
+		struct meterTap tap;
+		tap.meter = &meter->rtMeter;
+		tap.channel = meter->channel;
+		tap.copySource = nullptr;
+		tap.passThroughInput = -1;
+		if(-1 == meter->slot)
+		{
+			newPlan->inputMeters.push_back(tap);
+		} else if(nSlots == (unsigned int)meter->slot) {
+			for(auto& copy : newPlan->outputCopies)
+				if(copy.hostChannel == tap.channel)
+					tap.copySource = copy.source;
+			for(auto& passThrough : newPlan->passThroughs)
+				if(passThrough.hostChannel == tap.channel)
+					tap.passThroughInput = passThrough.inputChannel;
+			newPlan->outputMeters.push_back(tap);
+		} else if(meter->slot < (int)nSlots && tap.channel < slots[meter->slot]->n_audio_out) {
+			// replace() may have left the slot with fewer outputs
+			newPlan->slotMeters[meter->slot].push_back(tap);
+		}
+	}
+
+	return newPlan;
+}
+
+// Get a delay line long enough for the delay of `source`, reusing the one
+// the same connection had in the previous plans if possible.
+struct Lv2Host::delayLine* Lv2Host::getDelayLine(int destinationSlot, unsigned int destinationChannel, struct map const& source)
 {
-	for(auto slot : slots)
+	unsigned int size = source.delay + maxBlockSize;
+	// the most recent ones are at the back
+	for(auto it = delayLines.rbegin(); it != delayLines.rend(); ++it)
 	{
-		LV2Apply_cleanup(slot);
+		auto& line = **it;
+		if(line.destinationSlot == destinationSlot && line.destinationChannel == destinationChannel
+			&& line.sourceSlot == source.slot && line.sourceChannel == source.channel)
+		{
+			if(line.size >= size)
+				return &line;
+			// too short: replace it. The old one may still be in use
+			// by render(), so it is freed once the plan being built is
+			// installed.
+			struct retiredDelayLine retired;
+			retired.line = std::move(*std::next(it).base());
+			retired.generation = planGeneration + 1;
+			retiredDelayLines.push_back(std::move(retired));
+			delayLines.erase(std::next(it).base());
+			break;
+		}
 	}
-	LV2Apply_cleanupWorld(world);
+	struct delayLine* line = new struct delayLine;
+	line->buffer = (float*)allocate(size * sizeof(float));
+	line->size = size;
+	line->writePosition = 0;
+	line->destinationSlot = destinationSlot;
+	line->destinationChannel = destinationChannel;
+	line->sourceSlot = source.slot;
+	line->sourceChannel = source.channel;
+	delayLines.emplace_back(line);
+	return line;
 }
 
-int Lv2Host::add(std::string const& pluginUri)
+struct Lv2Host::bufferStats Lv2Host::getBufferStats()
 {
-	auto slot = LV2Apply_instantiatePlugin(world, pluginUri.c_str(), sampleRate, featureList.data());
-	if(!slot)
-		return -1;
-	slots.push_back(slot);
-	LV2Apply_printPorts(world, slot->plugin);
-	// verbose
-	unsigned int inAudio, outAudio, inCtl, outCtl;
-	LV2Apply_getPortCount(slot, &inAudio, &outAudio, &inCtl, &outCtl);
-	printf("Ports: in audio %u, out audio %u, in ctl %u, out ctl %u\n", inAudio, outAudio, inCtl, outCtl);
+	return lastBufferStats;
+}
 
-	auto idx = slots.size() - 1;
+// called by render(): connect all the ports of all the slots once, so
+// that the following blocks only need to connect the host's buffers.
+void Lv2Host::installPlan(renderPlan* newPlan)
+{
+	for(unsigned int s = 0; s < newPlan->slots.size(); ++s)
+	{
+		// a slot that does not run is connected by the plan that runs it
+		// again
+		if(newPlan->bypass[s] && !newPlan->fading[s])
+			continue;
+		auto slot = newPlan->slots[s];
+		std::copy(newPlan->inputs[s].begin(), newPlan->inputs[s].end(), slot->in_bufs);
+		std::copy(newPlan->outputs[s].begin(), newPlan->outputs[s].end(), slot->out_bufs);
+		std::copy(newPlan->atomInputs[s].begin(), newPlan->atomInputs[s].end(), slot->atom_in_bufs);
+		LV2Apply_connectPorts(slot);
+	}
+	// if there is no room, leak it rather than freeing it here
+	if(plan)
+		retiredPlans.push(plan);
+	plan = newPlan;
+	installedGeneration.store(plan->generation);
+}
 
-	if(idx == 0)
+void Lv2Host::setMinSubBlockSize(unsigned int frames)
+{
+	minSubBlockSize = std::max(1u, frames);
+}
+
+void Lv2Host::runSlot(void* arg, unsigned int node)
+{
+	Lv2Host* that = (Lv2Host*)arg;
+	renderPlan* plan = that->plan;
+	unsigned int slotNumber = node;
+	enum nodeKind kind = kSlotNode;
+	if(!plan->nodes.empty())
+	{
+		slotNumber = plan->nodes[node].slot;
+		kind = plan->nodes[node].kind;
+	}
+	bool run = !plan->bypass[slotNumber] || plan->fading[slotNumber];
+	switch(kind)
+	{
+		case kSlotNode:
+#ifdef LV2HOST_PROFILE
+			plan->starts[slotNumber] = RtProfile::now();
+			processSlot(that, slotNumber, false);
+			if(run)
+				plan->profiles[slotNumber]->record(RtProfile::now() - plan->starts[slotNumber], that->deadlineNs);
+#else
+			processSlot(that, slotNumber, false);
+#endif
+			break;
+		case kFirstNode:
+#ifdef LV2HOST_PROFILE
+			plan->starts[slotNumber] = RtProfile::now();
+#endif
+			processSlot(that, slotNumber, true);
+			break;
+		case kCopyNode:
+			if(run && !plan->serialCopies[slotNumber])
+				LV2Apply_runCopy(plan->slots[slotNumber], plan->nodes[node].copy, that->renderFrames);
+			break;
+		case kLastNode:
+			finishSlot(that, slotNumber, run);
+#ifdef LV2HOST_PROFILE
+			if(run)
+				plan->profiles[slotNumber]->record(RtProfile::now() - plan->starts[slotNumber], that->deadlineNs);
+#endif
+			break;
+	}
+}
+
+// Run a slot. With `firstCopyOnly`, its other copies and finishSlot() are
+// left to their own nodes, unless the slot has to run in sub-blocks, in
+// which case all the copies run here.
+void Lv2Host::processSlot(Lv2Host* that, unsigned int slotNumber, bool firstCopyOnly)
+{
+	auto slot = that->plan->slots[slotNumber];
+	auto& events = *that->plan->events[slotNumber];
+	// a slot still crossfading runs even if it is bypassed
+	bool run = !that->plan->bypass[slotNumber] || that->plan->fading[slotNumber];
+	unsigned int nFrames = that->renderFrames;
+	if(run)
+	{
+		for(auto& mix : that->plan->inputMixes[slotNumber])
+			runMix(mix, mix.destination, that->renderInputs, nFrames);
+	}
+	// when the slot runs in sub-blocks, the plugin writes its events into
+	// the scratch buffers, which are then joined into its outputs
+	auto& atoms = *that->plan->atoms[slotNumber];
+	bool split = !events.empty() && (atoms.inputs.size() || atoms.outputs.size());
+	for(auto& port : atoms.inputs)
+		receiveEvents(that, *port, nFrames);
+	for(auto& port : atoms.outputs)
+	{
+		if(run && !split)
+			atomSequencePrepareOutput(port->buffer, port->capacity, that->atomChunkUrid);
+		else
+			atomSequenceClear(port->buffer, that->atomSequenceUrid);
+	}
+	if(events.empty())
 	{
-#ifdef ALLOCATE_INPUTS
-		// allocate arrays for inputs of the first slot
-		for(unsigned int n = 0; n < std::min(slots[idx]->n_audio_in, nAudioInputs); ++n);
+		if(run && firstCopyOnly)
+			LV2Apply_runCopy(slot, 0, nFrames);
+		else if(run)
+			LV2Apply_run(slot, nFrames);
+		if(firstCopyOnly)
+			that->plan->serialCopies[slotNumber] = false;
+		else
+			finishSlot(that, slotNumber, run);
+		return;
+	}
+	if(firstCopyOnly)
+		that->plan->serialCopies[slotNumber] = true;
+	// sort by frame, keeping the order in which they were queued for
+	// changes happening on the same frame
+	for(unsigned int n = 1; n < events.size(); ++n)
+	{
+		struct controlEvent event = events[n];
+		unsigned int k = n;
+		for(; k > 0 && events[k - 1].frame > event.frame; --k)
+			events[k] = events[k - 1];
+		events[k] = event;
+	}
+	unsigned int quantum = that->minSubBlockSize;
+	unsigned int n = 0;
+	unsigned int start = 0;
+	while(start < nFrames)
+	{
+		for(; n < events.size() && events[n].frame / quantum * quantum <= start; ++n)
+			that->applyControl(events[n]);
+		unsigned int end = nFrames;
+		if(n < events.size())
+			end = std::min(nFrames, events[n].frame / quantum * quantum);
+		if(run)
 		{
-			buffers.push_back();
-			buffers.last().resize(maxBlockSize);
-			slots[idx]->out_bufs[n] = buffers.last().data();
+			if(start)
+				LV2Apply_connectAudioPorts(slot, start);
+			if(split)
+				splitEvents(that, slotNumber, start, end);
+			LV2Apply_run(slot, end - start);
+			if(split)
+				joinEvents(that, slotNumber, start);
 		}
-#endif /* ALLOCATE_INPUTS */
-		for(unsigned int n = 0; n < inputMap.size(); ++n)
+		start = end;
+	}
+	if(run)
+	{
+		LV2Apply_connectAudioPorts(slot, 0);
+		if(split)
 		{
-			// automap inputs of first plugin to audio inputs
-			if(n < inAudio) {
-				inputMap[n].slot = 0;
-				inputMap[n].channel = n;
-			}
-			// and, for good measure, give them a dummyInput
-			// buffer, in case they are not connected above, or
-			// they are re-routed before the first call to render()
-			slots[0]->in_bufs[n] = dummyInput.data();
+			for(unsigned int n = 0; n < atoms.inputs.size(); ++n)
+				LV2Apply_connectPort(slot, atoms.inputs[n]->port, slot->atom_in_bufs[n]);
+			for(auto& port : atoms.outputs)
+				LV2Apply_connectPort(slot, port->port, port->buffer);
 		}
-	} else {
-		// connect the outputs of the previous slot to the input of the
-		// current one.
-		// Somehow handle the case where the channel count differs
-		// (currently: drop extra channels, or duplicate)
-		// TODO: should mix instead of dropping when prevN > currN
-		unsigned int prevNOut = slots[idx-1]->n_audio_out;
-		unsigned int currNIn = slots[idx]->n_audio_in;
-		for(unsigned int n = 0; n < std::max(currNIn, prevNOut); ++n)
+	}
+	if(!firstCopyOnly)
+		finishSlot(that, slotNumber, run);
+	// keep what's left for the next blocks
+	unsigned int kept = 0;
+	for(; n < events.size(); ++n)
+	{
+		events[kept] = events[n];
+		events[kept].frame -= nFrames;
+		++kept;
+	}
+	events.resize(kept);
+}
+
+// called by runSlot() once the slot is done with the block
+void Lv2Host::finishSlot(Lv2Host* that, unsigned int slotNumber, bool run)
+{
+	if(run)
+	{
+		for(auto worker : that->plan->workers[slotNumber])
+			worker->endRun();
+	}
+	crossfade(that, slotNumber);
+	if(!run)
+		return;
+	auto slot = that->plan->slots[slotNumber];
+	for(auto& tap : that->plan->slotMeters[slotNumber])
+		tap.meter->process(slot->out_bufs[tap.channel], that->renderFrames);
+	// publish the output events for readEvent()
+	for(auto& port : that->plan->atoms[slotNumber]->outputs)
+	{
+		auto seq = port->buffer;
+		// a plugin that does not write its output leaves it as a chunk
+		if(seq->atom.type != that->atomSequenceUrid)
 		{
-			unsigned int prevN;
-			unsigned int currN;
-			prevN = std::min(prevNOut - 1, n);
-			currN = std::min(currNIn - 1, n);
-			slots[idx]->in_bufs[currN] = slots[idx-1]->out_bufs[prevN];
+			atomSequenceClear(seq, that->atomSequenceUrid);
+			continue;
 		}
+		LV2_ATOM_SEQUENCE_FOREACH(seq, event)
+			port->queue.write(event, sizeof(*event) + event->body.size);
 	}
-	// map the outputs of the last plugin to the outputs of the host
-	for(unsigned int n = 0; n < std::min(outputMap.size(), outAudio); ++n)
+}
+
+// Fill the sequence of an atom input with the events due in this block,
+// and keep the later ones for the following blocks.
+void Lv2Host::receiveEvents(Lv2Host* that, struct atomPort& port, unsigned int nFrames)
+{
+	// the scratch buffer is not in use yet: read the queue into it
+	auto received = (LV2_Atom_Event*)port.scratch;
+	uint32_t size;
+	while((size = port.queue.read(received, port.capacity)))
 	{
-		outputMap[n].slot = idx;
-		outputMap[n].channel = n;
+		if(RtRingBuffer::kDropped == size)
+			continue;
+		atomSequenceInsert(port.pending, port.capacity, received->time.frames,
+			received->body.type, received->body.size, received + 1);
 	}
-
-	// allocate arrays for outputs
-	for(unsigned int n = 0; n < slot->n_audio_out; ++n)
+	atomSequenceClear(port.buffer, that->atomSequenceUrid);
+	// pending events are in time order: those due in this block come
+	// first, the others are moved to the front
+	auto pending = port.pending;
+	LV2_Atom_Event* kept = lv2_atom_sequence_begin(&pending->body);
+	uint32_t keptSize = sizeof(LV2_Atom_Sequence_Body);
+	LV2_Atom_Event* event = lv2_atom_sequence_begin(&pending->body);
+	while(!lv2_atom_sequence_is_end(&pending->body, pending->atom.size, event))
 	{
-		buffers.emplace_back(std::vector<float>(maxBlockSize));
-		buffers.back().shrink_to_fit();
-		slot->out_bufs[n] = buffers.back().data();
+		LV2_Atom_Event* next = lv2_atom_sequence_next(event);
+		if(event->time.frames < nFrames)
+		{
+			atomSequenceAppend(port.buffer, port.capacity, event->time.frames,
+				event->body.type, event->body.size, event + 1);
+		} else {
+			uint32_t eventSize = (char*)next - (char*)event;
+			memmove(kept, event, eventSize);
+			kept->time.frames -= nFrames;
+			kept = (LV2_Atom_Event*)((char*)kept + eventSize);
+			keptSize += eventSize;
+		}
+		event = next;
 	}
+	pending->atom.size = keptSize;
+}
 
-	LV2Apply_connectPorts(slot);
-	tmpModifiedSlots.reserve(slots.size());
-	return slots.size() - 1;
+// Connect the atom ports of a slot to sequences holding only what falls
+// between `start` and `end` in the block.
+void Lv2Host::splitEvents(Lv2Host* that, unsigned int slotNumber, unsigned int start, unsigned int end)
+{
+	auto slot = that->plan->slots[slotNumber];
+	auto& atoms = *that->plan->atoms[slotNumber];
+	for(unsigned int n = 0; n < atoms.inputs.size(); ++n)
+	{
+		auto& port = *atoms.inputs[n];
+		auto seq = (LV2_Atom_Sequence*)slot->atom_in_bufs[n];
+		atomSequenceClear(port.scratch, that->atomSequenceUrid);
+		LV2_ATOM_SEQUENCE_FOREACH(seq, event)
+		{
+			if(event->time.frames >= start && event->time.frames < end)
+				atomSequenceAppend(port.scratch, port.capacity, event->time.frames - start,
+					event->body.type, event->body.size, event + 1);
+		}
+		LV2Apply_connectPort(slot, port.port, port.scratch);
+	}
+	for(auto& port : atoms.outputs)
+	{
+		atomSequencePrepareOutput(port->scratch, port->capacity, that->atomChunkUrid);
+		LV2Apply_connectPort(slot, port->port, port->scratch);
+	}
 }
 
-#if 0
-bool Lv2Host::connect(unsigned int source, unsigned int dest)
+// Append what the plugin wrote during the sub-block starting at `start`
+// to its outputs.
+void Lv2Host::joinEvents(Lv2Host* that, unsigned int slotNumber, unsigned int start)
 {
-	unsigned int inCtl, outCtl;
-	unsigned int sourceAudioIn, sourceAudioOut;
-	unsigned int destAudioIn, destAudioOut;
-	LV2Apply_getPortCount(slots[source], &sourceAudioIn, &sourceAudioOut, &inCtl, &outCtl);
-	LV2Apply_getPortCount(slots[dest], &destAudioIn, &destAudioOut, &inCtl, &outCtl);
-	LV2Apply_connectPorts(slots[source]);
+	for(auto& port : that->plan->atoms[slotNumber]->outputs)
+	{
+		auto seq = port->scratch;
+		if(seq->atom.type != that->atomSequenceUrid)
+			continue;
+		LV2_ATOM_SEQUENCE_FOREACH(seq, event)
+			atomSequenceAppend(port->buffer, port->capacity, event->time.frames + start,
+				event->body.type, event->body.size, event + 1);
+	}
 }
-#endif
-bool Lv2Host::connect(int sourceSlotNumber, unsigned int sourceChannel, unsigned int destinationSlotNumber, unsigned int destinationChannel)
+
+// Mix the outputs of a slot that is crossfading with its inputs, and keep
+// track of where the crossfade is.
+void Lv2Host::crossfade(Lv2Host* that, unsigned int slotNumber)
 {
-	bool done = false;
-	if(-1 == sourceSlotNumber) {
-		inputMap[sourceChannel].slot = destinationSlotNumber;
-		inputMap[sourceChannel].channel = destinationChannel;
-		done = true;
+	renderPlan* plan = that->plan;
+	unsigned int& position = *plan->fades[slotNumber];
+	unsigned int length = plan->fadeLength;
+	unsigned int target = plan->bypass[slotNumber] ? length : 0;
+	if(!plan->fading[slotNumber] || !length)
+	{
+		position = target;
+		return;
 	}
-	if (slots.size() == destinationSlotNumber) {
-		outputMap[destinationChannel].slot = sourceSlotNumber;
-		outputMap[destinationChannel].channel = sourceChannel;
-		done = true;
+	auto slot = plan->slots[slotNumber];
+	unsigned int nFrames = that->renderFrames;
+	position = std::min(position, length);
+	unsigned int nRamp = std::min(nFrames, target > position ? target - position : position - target);
+	float gain = position / (float)length;
+	float step = (target > position ? 1.f : -1.f) / length;
+	for(unsigned int ch = 0; ch < slot->n_audio_out; ++ch)
+	{
+		if(plan->unusedOutputs[slotNumber][ch])
+			continue;
+		float* output = slot->out_bufs[ch];
+		const float* input = that->dummyInput;
+		if(slot->n_audio_in)
+			input = slot->in_bufs[std::min(ch, slot->n_audio_in - 1)];
+		mixCrossfade(output, input, gain, step, nRamp);
+		if(target)
+			memcpy(output + nRamp, input + nRamp, sizeof(output[0]) * (nFrames - nRamp));
 	}
-	try {
-		if(!done)
+	position = target > position ? position + nRamp : position - nRamp;
+}
+
+void Lv2Host::runMix(struct mix const& mix, float* destination, const float** inputs, unsigned int nFrames)
+{
+	for(unsigned int n = 0; n < mix.sources.size(); ++n)
+	{
+		auto& source = mix.sources[n];
+		const float* buffer = source.buffer ? source.buffer : inputs[source.hostChannel];
+		void (*kernel)(float*, const float*, float, unsigned int) = n ? mixAccumulate : mixScale;
+		if(!source.delay)
 		{
-			auto& sourceSlot = slots[sourceSlotNumber];
-			auto& destinationSlot = slots[destinationSlotNumber];
-			destinationSlot->in_bufs[destinationChannel] = sourceSlot->out_bufs[sourceChannel];
-			LV2Apply_connectPorts(sourceSlot);
-			LV2Apply_connectPorts(destinationSlot);
+			kernel(destination, buffer, source.gain, nFrames);
+			continue;
 		}
-	} catch (std::exception e) {
-		return false;
+		// push the block into the delay line, then read back what was
+		// pushed delayFrames frames earlier
+		auto& line = *source.delay;
+		unsigned int first = std::min(nFrames, line.size - line.writePosition);
+		memcpy(line.buffer + line.writePosition, buffer, sizeof(buffer[0]) * first);
+		memcpy(line.buffer, buffer + first, sizeof(buffer[0]) * (nFrames - first));
+		unsigned int readPosition = (line.writePosition + line.size - source.delayFrames) % line.size;
+		line.writePosition = (line.writePosition + nFrames) % line.size;
+		first = std::min(nFrames, line.size - readPosition);
+		kernel(destination, line.buffer + readPosition, source.gain, first);
+		kernel(destination + first, line.buffer, source.gain, nFrames - first);
 	}
-	return true;
 }
 
-bool Lv2Host::disconnect(unsigned int destinationSlotNumber, unsigned int destinationChannel)
+void Lv2Host::render(unsigned int nFrames, const float** inputs, float** outputs)
 {
-	try {
-		if(-1 == destinationSlotNumber) {
-			inputMap[destinationChannel].slot = kMapNotConnected;
-		} else if(slots.size() == destinationSlotNumber) {
-			outputMap[destinationChannel].slot = kMapNotConnected;
-		} else {
-			auto& destinationSlot = slots[destinationSlotNumber];
-			destinationSlot->in_bufs[destinationChannel] = dummyInput.data();
-			LV2Apply_connectPorts(destinationSlot);
+	if(internalBlockSize)
+	{
+		renderInternalBlocks(nFrames, inputs, outputs);
+		return;
+	}
+	if(nFrames <= maxBlockSize)
+	{
+		renderBlock(nFrames, inputs, outputs);
+		return;
+	}
+	// the buffers are only this big
+	for(unsigned int done = 0; done < nFrames; )
+	{
+		unsigned int n = std::min(maxBlockSize, nFrames - done);
+		for(unsigned int ch = 0; ch < nAudioInputs; ++ch)
+			partInputs[ch] = inputs[ch] + done;
+		for(unsigned int ch = 0; ch < nAudioOutputs; ++ch)
+			partOutputs[ch] = outputs[ch] + done;
+		renderBlock(n, partInputs.data(), partOutputs.data());
+		done += n;
+	}
+}
+
+// Collect the input into the input FIFOs and play out the output FIFOs,
+// running the chain each time a whole internal block has come in. What
+// comes in at frame n of an internal block goes out at frame n of the
+// next one, internalBlockSize frames later.
+void Lv2Host::renderInternalBlocks(unsigned int nFrames, const float** inputs, float** outputs)
+{
+	for(unsigned int done = 0; done < nFrames; )
+	{
+		unsigned int n = std::min(internalBlockSize - fifoFrames, nFrames - done);
+		for(unsigned int ch = 0; ch < nAudioInputs; ++ch)
+			memcpy(inputFifos[ch] + fifoFrames, inputs[ch] + done, n * sizeof(float));
+		for(unsigned int ch = 0; ch < nAudioOutputs; ++ch)
+			memcpy(outputs[ch] + done, outputFifos[ch] + fifoFrames, n * sizeof(float));
+		fifoFrames += n;
+		done += n;
+		if(fifoFrames == internalBlockSize)
+		{
+			renderBlock(internalBlockSize, (const float**)inputFifos.data(), outputFifos.data());
+			fifoFrames = 0;
 		}
-	} catch (std::exception e) {
-		return false;
 	}
-	return true;
 }
 
-void Lv2Host::bypass(unsigned int slotNumber, bool bypassed)
+void Lv2Host::renderInterleaved(unsigned int nFrames, const void* input, void* output, enum sampleFormat format)
 {
-	slots[slotNumber]->bypass = bypassed;
+	// in parts that fit in the conversion buffers
+	for(unsigned int done = 0; done < nFrames; )
+	{
+		unsigned int n = std::min(maxBlockSize, nFrames - done);
+		size_t inOffset = (size_t)done * nAudioInputs;
+		size_t outOffset = (size_t)done * nAudioOutputs;
+		switch(format)
+		{
+			case kSampleFloat:
+				deinterleaveFloat(formatInputs.data(), (const float*)input + inOffset, nAudioInputs, n);
+				break;
+			case kSampleInt16:
+				deinterleaveInt16(formatInputs.data(), (const int16_t*)input + inOffset, nAudioInputs, n);
+				break;
+			case kSampleInt32:
+				deinterleaveInt32(formatInputs.data(), (const int32_t*)input + inOffset, 2147483648.f, nAudioInputs, n);
+				break;
+			case kSampleInt24In32:
+				deinterleaveInt32(formatInputs.data(), (const int32_t*)input + inOffset, 8388608.f, nAudioInputs, n);
+				break;
+		}
+		for(auto buffer : formatOutputs)
+			memset(buffer, 0, n * sizeof(buffer[0]));
+		// the copies can be skipped unless they go through the FIFOs
+		copiesFused = !internalBlockSize;
+		render(n, (const float**)formatInputs.data(), formatOutputs.data());
+		copiesFused = false;
+		for(unsigned int ch = 0; ch < nAudioOutputs; ++ch)
+			formatSources[ch] = formatOutputs[ch];
+		if(plan && !internalBlockSize)
+		{
+			for(auto& passThrough : plan->passThroughs)
+				formatSources[passThrough.hostChannel] = formatInputs[passThrough.inputChannel];
+			for(auto& copy : plan->outputCopies)
+				formatSources[copy.hostChannel] = copy.source;
+		}
+		switch(format)
+		{
+			case kSampleFloat:
+				interleaveFloat((float*)output + outOffset, formatSources.data(), nAudioOutputs, n);
+				break;
+			case kSampleInt16:
+				interleaveInt16((int16_t*)output + outOffset, formatSources.data(), nAudioOutputs, n);
+				break;
+			case kSampleInt32:
+				interleaveInt32((int32_t*)output + outOffset, formatSources.data(), 2147483648.f, nAudioOutputs, n);
+				break;
+			case kSampleInt24In32:
+				interleaveInt32((int32_t*)output + outOffset, formatSources.data(), 8388608.f, nAudioOutputs, n);
+				break;
+		}
+		done += n;
+	}
 }
 
-void Lv2Host::render(unsigned int nFrames, const float** inputs, float** outputs)
+void Lv2Host::renderBlock(unsigned int nFrames, const float** inputs, float** outputs)
 {
-	if(slots.size() > 0)
+#ifdef LV2HOST_PROFILE
+	uint64_t blockStart = RtProfile::now();
+	deadlineNs = profileDeadline.load(std::memory_order_relaxed) * nFrames / sampleRate * 1e9;
+#endif
+	renderPlan* newPlan = nextPlan.exchange(nullptr);
+	if(!newPlan && plan && plan->after)
 	{
-		tmpModifiedSlots.resize(0);
-		for(unsigned int n = 0; n < nAudioInputs; ++n)
+		// switch to the plan without crossfades once they are over, and
+		// resume the slots that were restoring a state
+		bool done = true;
+		for(auto s : plan->fadingSlots)
+			done &= *plan->fades[s] == (plan->bypass[s] ? plan->fadeLength : 0);
+		for(auto& restore : plan->restores)
+			done &= restore->done.load(std::memory_order_acquire);
+		if(done)
 		{
-			int slot = inputMap[n].slot;
-			int channel = inputMap[n].channel;
-			if(kMapNotConnected == slot)
-				continue;
-			if(slots.size() == slot)// pass-through, handled below
-				continue;
-			slots[slot]->in_bufs[channel] = (float*)inputs[n];
-			tmpModifiedSlots.push_back(slot);
+			newPlan = plan->after;
+			plan->after = nullptr;
 		}
-		for(unsigned int n = 0; n < nAudioOutputs; ++n)
+	}
+	if(newPlan)
+		installPlan(newPlan);
+	if(!plan)
+		return;
+#ifdef LV2HOST_PROFILE
+	if(profileResetRequested.exchange(false))
+	{
+		blockProfile.clear();
+		for(auto profile : plan->profiles)
+			profile->clear();
+	}
+#endif
+	// a whole preset is applied at once
+	std::vector<struct controlEvent>* staged = stagedControls.exchange(nullptr);
+	if(staged)
+	{
+		for(auto& event : *staged)
 		{
-			int slot = outputMap[n].slot;
-			int channel = outputMap[n].channel;
-			if(kMapNotConnected == slot)
-				continue;
-			if(-1 == slot) {// pass-through, handled here
-				memcpy(outputs[n], inputs[channel],
-					sizeof(outputs[n][0]) * nFrames);
+			if(!isCurrentEvent(event))
 				continue;
-			}
-			slots[slot]->out_bufs[channel] = outputs[n];
-			tmpModifiedSlots.push_back(slot);
+			auto slot = plan->slots[event.slot];
+			if(event.port < slot->n_ports * slot->n_copies && slot->ports[event.port].type == TYPE_CONTROL && slot->ports[event.port].is_input)
+				applyControl(event);
+		}
+		// stageControls() empties the queue each time: it cannot be full
+		appliedControls.push(staged);
+	}
+	struct controlEvent event;
+	while(controlQueue.pop(event))
+	{
+		// the slot may have been replaced since the change was queued
+		if(!isCurrentEvent(event))
+			continue;
+		auto slot = plan->slots[event.slot];
+		if(event.port >= slot->n_ports * slot->n_copies || slot->ports[event.port].type != TYPE_CONTROL || !slot->ports[event.port].is_input)
+			continue;
+		// timestamped changes are applied by runSlot(), unless there
+		// is no room left for them
+		auto& events = *plan->events[event.slot];
+		if(event.frame && events.size() < events.capacity())
+			events.push_back(event);
+		else
+			applyControl(event);
+	}
+	// only reconnect the ports whose host buffer has changed since the
+	// previous block
+	for(auto& hostInput : plan->hostInputs)
+	{
+		auto slot = plan->slots[hostInput.slot];
+		float* buffer = (float*)inputs[hostInput.hostChannel];
+		if(slot->in_bufs[hostInput.channel] != buffer)
+		{
+			slot->in_bufs[hostInput.channel] = buffer;
+			LV2Apply_connectPort(slot, hostInput.port, buffer);
+		}
+	}
+	for(auto& hostOutput : plan->hostOutputs)
+	{
+		auto slot = plan->slots[hostOutput.slot];
+		float* buffer = outputs[hostOutput.hostChannel];
+		if(slot->out_bufs[hostOutput.channel] != buffer)
+		{
+			slot->out_bufs[hostOutput.channel] = buffer;
+			LV2Apply_connectPort(slot, hostOutput.port, buffer);
+		}
+	}
+	for(auto& tap : plan->inputMeters)
+		tap.meter->process(inputs[tap.channel], nFrames);
+	if(!copiesFused)
+	{
+		for(auto& passThrough : plan->passThroughs)
+		{
+			memcpy(outputs[passThrough.hostChannel], inputs[passThrough.inputChannel],
+				sizeof(outputs[0][0]) * nFrames);
+		}
+	}
+	renderFrames = nFrames;
+	renderInputs = inputs;
+	if(scheduler.getNumWorkers())
+	{
+		scheduler.process(plan->graph, runSlot, this);
+	} else {
+		for(unsigned int n = 0; n < plan->graph.size(); ++n)
+			runSlot(this, n);
+	}
+	if(!copiesFused)
+	{
+		for(auto& copy : plan->outputCopies)
+		{
+			memcpy(outputs[copy.hostChannel], copy.source,
+				sizeof(outputs[0][0]) * nFrames);
 		}
-		auto last = std::unique(tmpModifiedSlots.begin(), tmpModifiedSlots.end());
-		tmpModifiedSlots.resize(last - tmpModifiedSlots.begin());
-		for(auto n : tmpModifiedSlots)
+	}
+	for(auto& mix : plan->outputMixes)
+		runMix(mix, outputs[mix.hostChannel], inputs, nFrames);
+	for(auto& tap : plan->outputMeters)
+	{
+		const float* buffer = outputs[tap.channel];
+		if(copiesFused && tap.copySource)
+			buffer = tap.copySource;
+		else if(copiesFused && tap.passThroughInput >= 0)
+			buffer = inputs[tap.passThroughInput];
+		tap.meter->process(buffer, nFrames);
+	}
+	for(unsigned int n = 0; n < plan->slots.size(); ++n)
+	{
+		auto slot = plan->slots[n];
+		if(slot->latency_port >= 0 && LV2Apply_getLatency(slot) != plan->latencies[n])
+			latencyChanged = true;
+	}
+	renderedFrames.fetch_add(nFrames);
+#ifdef LV2HOST_PROFILE
+	blockProfile.record(RtProfile::now() - blockStart, deadlineNs);
+#endif
+}
+
+bool Lv2Host::getSlotProfile(unsigned int slotN, struct RtProfile::snapshot& snapshot)
+{
+#ifdef LV2HOST_PROFILE
+	if(slotN >= slotProfiles.size())
+		return false;
+	slotProfiles[slotN]->getSnapshot(snapshot);
+	return true;
+#else
+	(void)slotN;
+	(void)snapshot;
+	return false;
+#endif
+}
+
+bool Lv2Host::getBlockProfile(struct RtProfile::snapshot& snapshot)
+{
+#ifdef LV2HOST_PROFILE
+	blockProfile.getSnapshot(snapshot);
+	return true;
+#else
+	(void)snapshot;
+	return false;
+#endif
+}
+
+void Lv2Host::setProfileDeadline(float fraction)
+{
+	profileDeadline = fraction;
+}
+
+void Lv2Host::resetProfile()
+{
+	profileResetRequested = true;
+}
+
+bool Lv2Host::setMeter(int slotNumber, unsigned int channel, bool enabled)
+{
+	unsigned int nChannels;
+	if(-1 == slotNumber)
+		nChannels = nAudioInputs;
+	else if(slotNumber == count())
+		nChannels = nAudioOutputs;
+	else if(slotNumber >= 0 && slotNumber < count())
+		nChannels = slots[slotNumber]->n_audio_out;
+	else
+		return false;
+	if(channel >= nChannels)
+		return false;
+	struct meter* meter = nullptr;
+	for(auto& m : meters)
+		if(m->slot == slotNumber && m->channel == channel)
+			meter = m.get();
+	if(!meter)
+	{
+		if(!enabled)
+			return true;
+		meter = new struct meter;
+		meter->slot = slotNumber;
+		meter->channel = channel;
+		meter->enabled = false;
+		meter->rtMeter.setWindow(meterWindow ? meterWindow : sampleRate * kDefaultMeterWindow);
+		meters.emplace_back(meter);
+	}
+	if(meter->enabled == enabled)
+		return true;
+	meter->enabled = enabled;
+	updatePlan();
+	return true;
+}
+
+bool Lv2Host::getMeter(int slotNumber, unsigned int channel, struct RtMeter::snapshot& snapshot)
+{
+	for(auto& meter : meters)
+	{
+		if(meter->slot == slotNumber && meter->channel == channel)
 		{
-			LV2Apply_connectPorts(slots[n]);
+			meter->rtMeter.getSnapshot(snapshot);
+			return true;
 		}
-		for(auto& slot : slots)
+	}
+	return false;
+}
+
+void Lv2Host::setMeterWindow(unsigned int frames)
+{
+	meterWindow = frames;
+}
+
+void Lv2Host::reset()
+{
+	for(auto slot : slots)
+	{
+		for(unsigned int k = 0; k < slot->n_copies; ++k)
 		{
-			if(!slot->bypass)
-				lilv_instance_run(slot->instance, nFrames);
+			lilv_instance_deactivate(slot->instances[k]);
+			lilv_instance_activate(slot->instances[k]);
 		}
 	}
+	for(auto buffer : buffers)
+		memset(buffer, 0, maxBlockSize * sizeof(buffer[0]));
+	for(auto& line : delayLines)
+	{
+		memset(line->buffer, 0, line->size * sizeof(line->buffer[0]));
+		line->writePosition = 0;
+	}
+	for(auto& atoms : slotAtoms)
+		for(auto& port : atoms->inputs)
+			atomSequenceClear(port->pending, atomSequenceUrid);
+	for(auto fifo : inputFifos)
+		memset(fifo, 0, internalBlockSize * sizeof(fifo[0]));
+	for(auto fifo : outputFifos)
+		memset(fifo, 0, internalBlockSize * sizeof(fifo[0]));
+	fifoFrames = 0;
 }
 
-int Lv2Host::setPort(unsigned int slotN, unsigned int portN, float value)
+int Lv2Host::setPort(unsigned int slotN, unsigned int portN, float value, unsigned int frame)
 {
 	if(slots.size() <= slotN)
 	{
@@ -240,7 +2394,7 @@ int Lv2Host::setPort(unsigned int slotN, unsigned int portN, float value)
 		return -2;
 	}
 	auto slot = slots[slotN];
-	if(slot->n_ports <= portN)
+	if(slot->n_ports * slot->n_copies <= portN)
 	{
 		return -3;
 	}
@@ -253,6 +2407,48 @@ int Lv2Host::setPort(unsigned int slotN, unsigned int portN, float value)
 	{
 		return -5;
 	}
+	struct controlEvent event;
+	event.slot = slotN;
+	event.port = portN;
+	event.value = value;
+	event.frame = frame;
+	event.generation = slotGenerations[slotN];
+	if(!controlQueue.push(event))
+	{
+		return -6;
+	}
+	return 0;
+}
+
+// Whether a control event is meant for the plugin that the plan runs in
+// its slot. The event may also be meant for a plan published after this
+// block started, which is then installed right away.
+bool Lv2Host::isCurrentEvent(struct controlEvent const& event)
+{
+	for(unsigned int n = 0; n < 2; ++n)
+	{
+		if(event.slot < plan->slots.size())
+		{
+			int age = plan->slotGenerations[event.slot] - event.generation;
+			if(!age)
+				return true;
+			// meant for a plugin replace() has retired
+			if(age > 0)
+				return false;
+		}
+		renderPlan* newPlan = nextPlan.exchange(nullptr);
+		if(!newPlan)
+			return false;
+		installPlan(newPlan);
+	}
+	return false;
+}
+
+void Lv2Host::applyControl(struct controlEvent const& event)
+{
+	auto slot = plan->slots[event.slot];
+	auto port = &slot->ports[event.port];
+	float value = event.value;
 	if(value > port->maxValue)
 	{
 		value = port->maxValue;
@@ -260,8 +2456,14 @@ int Lv2Host::setPort(unsigned int slotN, unsigned int portN, float value)
 	{
 		value = port->minValue;
 	}
-	port->value = value;
-	return 0;
+	// the ports of the first copy stand for those of all the copies
+	if(event.port < slot->n_ports)
+	{
+		for(unsigned int k = 0; k < slot->n_copies; ++k)
+			port[k * slot->n_ports].value = value;
+	} else {
+		port->value = value;
+	}
 }
 
 float Lv2Host::getPortValue(unsigned int slotN, unsigned int portN)
@@ -275,7 +2477,7 @@ float Lv2Host::getPortValue(unsigned int slotN, unsigned int portN)
 		return 0;
 	}
 	auto slot = slots[slotN];
-	if(slot->n_ports <= portN)
+	if(slot->n_ports * slot->n_copies <= portN)
 	{
 		return 0;
 	}
@@ -287,22 +2489,98 @@ float Lv2Host::getPortValue(unsigned int slotN, unsigned int portN)
 	return port->value;
 }
 
+int Lv2Host::countEventPorts(unsigned int slotN, bool input)
+{
+	auto slot = slots[slotN];
+	return input ? slot->n_atom_in : slot->n_atom_out;
+}
+
+LV2_URID Lv2Host::mapUri(const char* uri)
+{
+	return context->mapUri(uri);
+}
+
+int Lv2Host::sendEvent(unsigned int slotN, unsigned int portN, unsigned int frame, uint32_t type, uint32_t size, const void* body)
+{
+	if(slotAtoms.size() <= slotN)
+	{
+		return -1;
+	}
+	auto& inputs = slotAtoms[slotN]->inputs;
+	if(inputs.size() <= portN)
+	{
+		return -3;
+	}
+	auto& port = *inputs[portN];
+	if(sizeof(LV2_Atom_Sequence) + sizeof(LV2_Atom_Event) + lv2_atom_pad_size(size) > port.capacity)
+	{
+		return -7;
+	}
+	LV2_Atom_Event event;
+	event.time.frames = frame;
+	event.body.size = size;
+	event.body.type = type;
+	if(!port.queue.write(&event, sizeof(event), body, size))
+	{
+		return -6;
+	}
+	return 0;
+}
+
+int Lv2Host::sendMidi(unsigned int slotN, unsigned int portN, unsigned int frame, const uint8_t* data, uint32_t size)
+{
+	return sendEvent(slotN, portN, frame, midiEventUrid, size, data);
+}
+
+uint32_t Lv2Host::readEvent(unsigned int slotN, unsigned int portN, LV2_Atom_Event* event, uint32_t maxSize)
+{
+	if(slotAtoms.size() <= slotN || slotAtoms[slotN]->outputs.size() <= portN)
+		return 0;
+	// skip the events that do not fit
+	uint32_t size;
+	do {
+		size = slotAtoms[slotN]->outputs[portN]->queue.read(event, maxSize);
+	} while(RtRingBuffer::kDropped == size);
+	return size;
+}
+
 int Lv2Host::countPorts(unsigned int slotN)
 {
 	auto slot = slots[slotN];
 	return slot->n_ports;
 }
 
+int Lv2Host::countCopies(unsigned int slotN)
+{
+	if(slots.size() <= slotN)
+		return 0;
+	return slots[slotN]->n_copies;
+}
+
 struct portDesc Lv2Host::getPortDesc(unsigned int slotNumber, unsigned int portNumber)
 {
 	portDesc newPortDesc;
+	memset(&newPortDesc, 0, sizeof(newPortDesc));
+	newPortDesc.type = kNotControl;
+	// all the copies of a multi-instance slot have the same ports
 	auto slot = slots[slotNumber];
+	const LV2Apply_PortInfo* info = nullptr;
+	if(portNumber < slot->n_ports * slot->n_copies)
+		info = LV2Apply_getPortInfo(slot, portNumber % slot->n_ports);
+	if(!info)
+		return newPortDesc;
 
-	newPortDesc.name =  LV2Apply_getPortName(slot, portNumber);
-	newPortDesc.type = LV2Apply_getControlPortType(slot,  world, portNumber);
-	LV2Apply_getPortRanges(slot, portNumber, &newPortDesc.min, &newPortDesc.max, &newPortDesc.defaultVal);
-	newPortDesc.isLogarithmic = LV2Apply_isLogarithmic(slot, world, portNumber);
-	newPortDesc.hasStrictBounds= LV2Apply_hasStrictBounds(slot, world, portNumber);
+	newPortDesc.name = info->name;
+	newPortDesc.type = info->control_type;
+	newPortDesc.min = info->min;
+	newPortDesc.max = info->max;
+	newPortDesc.defaultVal = info->default_value;
+	newPortDesc.isLogarithmic = info->is_logarithmic;
+	newPortDesc.hasStrictBounds = info->has_strict_bounds;
+	newPortDesc.symbol = info->symbol;
+	newPortDesc.designation = info->designation;
+	newPortDesc.nScalePoints = info->n_scale_points;
+	newPortDesc.scalePoints = info->scale_points;
 
 	return newPortDesc;
 }
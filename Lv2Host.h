@@ -1,10 +1,18 @@
 #include <vector>
 #include <string>
+#include <memory>
+#include <atomic>
 #include "lilv_interface.h"
-extern "C"
-{
-#include "symap.h"
-}
+#include "DagScheduler.h"
+#include "RtQueue.h"
+#include "RtArena.h"
+#include "Lv2Worker.h"
+#include "RtRingBuffer.h"
+#include "RtProfile.h"
+#include "RtMeter.h"
+#include "PluginCatalogue.h"
+#include "Lv2HostContext.h"
+#include "lv2/lv2plug.in/ns/ext/atom/atom.h"
 
 struct portDesc
 {
@@ -15,6 +23,11 @@ struct portDesc
 	float defaultVal;
 	bool isLogarithmic;
 	bool hasStrictBounds;
+	const char* symbol;
+	/// the URI of the lv2:designation of the port, or NULL
+	const char* designation;
+	unsigned int nScalePoints;
+	const LV2Apply_ScalePoint* scalePoints;
 };
 /// an  effect chain
 class Lv2Host
@@ -24,18 +37,238 @@ public:
 	Lv2Host(float sampleRate, unsigned int maxBlockSize, unsigned int nAudioInputs, unsigned int nAudioOutputs);
 	~Lv2Host() { cleanup();};
 	bool setup(float sampleRate, unsigned int maxBlockSize, unsigned int nAudioInputs, unsigned int nAudioOutputs);
+	/**
+	 * Set how the memory holding the audio buffers and the port tables
+	 * of the slots is reserved. This has to be called before setup().
+	 * When the arena is full, further allocations come from the heap.
+	 *
+	 * @param size the size of the arena, in bytes
+	 * @param hugePages back the arena with huge pages, if available
+	 * @param lockMemory lock the arena in RAM
+	 */
+	void setArenaOptions(size_t size, bool hugePages, bool lockMemory);
+	/**
+	 * Set whether the plugins are found through a PluginCatalogue. This
+	 * has to be called before setup(). By default, it is used: setup()
+	 * only loads the catalogue and add() loads the bundles of the plugin
+	 * it adds. Otherwise, setup() loads all the bundles on LV2_PATH.
+	 *
+	 * @param path where the index of the catalogue is kept. If empty,
+	 * it is in the default location, see PluginCatalogue::setup().
+	 */
+	void setCatalogueOptions(bool enabled, std::string const& path = "");
+	/**
+	 * Use a context shared with other hosts, instead of creating one in
+	 * setup(). This has to be called before setup(), with a context that
+	 * has been set up. The catalogue options of this host are then
+	 * ignored.
+	 */
+	void setContext(std::shared_ptr<Lv2HostContext> const& context);
+	/**
+	 * Run the plugins on blocks of a fixed size, whatever the size of the
+	 * blocks passed to render(). This has to be called before setup().
+	 *
+	 * The audio goes through a FIFO between the two, which delays it by
+	 * `frames`; getLatency() includes this delay. Plugins that work on
+	 * fixed-size frames, such as those doing FFTs, can be much cheaper to
+	 * run this way when the audio device uses small blocks.
+	 *
+	 * @param frames the size of the blocks the plugins see. 0, the
+	 * default, passes the blocks of render() through.
+	 */
+	void setInternalBlockSize(unsigned int frames);
+	unsigned int getInternalBlockSize() { return internalBlockSize; };
+	std::shared_ptr<Lv2HostContext> const& getContext() { return context; };
+	/// how long loading the plugins has taken, see PluginCatalogue::stats
+	struct PluginCatalogue::stats getCatalogueStats();
 	int count() { return slots.size();};
 	/// add the next plugin in the effect chain
 	int add(std::string const& pluginUri);
+	/**
+	 * Add several plugins at the end of the effect chain, in order, as
+	 * if add() was called for each of them. The plugins are looked up and
+	 * their libraries opened one at a time, as lilv is not thread-safe,
+	 * and are then instantiated and activated concurrently on a pool of
+	 * threads.
+	 *
+	 * @param nThreads the number of threads instantiating the plugins,
+	 * or 0 for one per CPU
+	 * @return the slot of each plugin, or -1 for those that could not
+	 * be added
+	 */
+	std::vector<int> addChain(std::vector<std::string> const& pluginUris, unsigned int nThreads = 0);
+	/**
+	 * Add a multi-instance slot: `nCopies` instances of the same plugin
+	 * behind a single slot, e.g. to run a mono plugin on each channel.
+	 * The audio and event channels of the slot are those of each copy,
+	 * one copy after the other, and are connected like those of any
+	 * slot. A change to a control port made with setPort() applies to
+	 * all the copies.
+	 *
+	 * @param parallel run the copies on the threads started by
+	 * setParallel(), rather than one after the other
+	 * @param nThreads the number of threads instantiating the copies,
+	 * or 0 for one per CPU
+	 * @return the slot, or -1 on failure
+	 */
+	int addMulti(std::string const& pluginUri, unsigned int nCopies, bool parallel = false, unsigned int nThreads = 0);
+	/// the number of instances of the plugin of a slot, see addMulti()
+	int countCopies(unsigned int slotN);
+	/**
+	 * Replace the plugin of a slot, while render() keeps running on
+	 * another thread. The new plugin is instantiated and activated on the
+	 * calling thread, takes the control values of the ports of the old
+	 * one that have the same symbol, and keeps the connections of the
+	 * slot. render() swaps it in at the start of a block, and the old
+	 * plugin is freed by a later call on this thread, once render() is
+	 * done with it.
+	 *
+	 * The port tables and the event buffers of the new plugin come from
+	 * the arena. Those of the old one are given back to it, but they are
+	 * only reused for a plugin that needs the same sizes: swapping between
+	 * different plugins over and over fills the arena. Past that point,
+	 * the memory is taken from the heap instead, which is logged, and
+	 * getArenaStats() counts the failed allocations.
+	 *
+	 * @return false if the slot does not exist or the plugin could not
+	 * be instantiated, in which case the slot is left as it was
+	 */
+	bool replace(unsigned int slotNumber, std::string const& pluginUri);
+	struct preset {
+		std::string uri;
+		std::string label;
+	};
+	/// list the presets of the plugin of a slot
+	std::vector<struct preset> getPresets(unsigned int slotN);
+	/**
+	 * Load a preset into a slot while audio is running.
+	 *
+	 * The preset is read on the calling thread, which should not be the
+	 * audio thread, and its control values all take effect at the start
+	 * of the same block. A plugin that keeps a state of its own, beyond
+	 * its control values, can only restore it while it is not running:
+	 * the slot crossfades into bypass, as with bypass(), while the worker
+	 * thread restores the state into its instances, then fades back in.
+	 * Nothing is instantiated or allocated from the arena.
+	 *
+	 * Not safe to call concurrently with add() or replace().
+	 */
+	bool loadPreset(unsigned int slotN, std::string const& presetUri);
+	/// the same as loadPreset(), for a state saved with saveState()
+	bool loadState(unsigned int slotN, std::string const& path);
+	/**
+	 * Save the control values of a slot and the state of its plugin, if
+	 * it has one, into state.ttl in `directory`, along with any file the
+	 * plugin saves. This can be called while audio is running. Only the
+	 * first copy of a multi-instance slot is saved.
+	 */
+	bool saveState(unsigned int slotN, std::string const& directory);
 	const char* getPluginName(unsigned int slotN);
-	/// set the value of a control port
-	int setPort(unsigned int slotN, unsigned int port, float value);
+	/**
+	 * Set the value of a control port. This can be called from any thread:
+	 * the change is queued and applied at the start of the next call to
+	 * render(), where it is clamped to the port's range.
+	 *
+	 * @param frame the frame within the next block at which the change
+	 * should take effect. When this is not 0, the slot is run in
+	 * sub-blocks split at the frames where its controls change, see
+	 * setMinSubBlockSize(). Frames past the end of the block are
+	 * carried over to the following blocks.
+	 * @param port the index of the port, below countPorts(). On a
+	 * multi-instance slot, this changes the port of all the copies,
+	 * while port k * countPorts() + n only changes port n of copy k.
+	 * @return 0 on success, a negative value if the slot or port are
+	 * invalid or the queue is full
+	 */
+	int setPort(unsigned int slotN, unsigned int port, float value, unsigned int frame = 0);
+	/**
+	 * Get the value of a control port. For input ports, this reflects
+	 * the changes made with setPort() only after they have been applied
+	 * by render(). Ports are numbered as in setPort(), the first copy
+	 * standing for all of them.
+	 */
 	float getPortValue(unsigned int slotN, unsigned int portN);
+	/**
+	 * Set the granularity of timestamped control changes. Their frames
+	 * are rounded down to a multiple of this, so that a slot is never
+	 * run for fewer than this many frames at a time, however dense the
+	 * changes.
+	 */
+	void setMinSubBlockSize(unsigned int frames);
+	/// the number of ports of the plugin of a slot, that is of each copy
 	int countPorts(unsigned int slotN);
+	/**
+	 * Get the description of a port. This is looked up in a table built
+	 * when the plugin is added, and does not allocate. The strings it
+	 * points to live as long as the slot.
+	 */
 	struct portDesc getPortDesc(unsigned int slotNumber, unsigned int portNumber);
+	/// the number of atom sequence inputs or outputs of a slot
+	int countEventPorts(unsigned int slotN, bool input);
+	/**
+	 * Map a URI to the URID the plugins of this host know it by, e.g.: to
+	 * get the type of an event. This is thread-safe, and shared by
+	 * the hosts sharing a context.
+	 */
+	LV2_URID mapUri(const char* uri);
+	/**
+	 * Send an event to an atom input of a slot. This does not allocate,
+	 * and can be called from one thread at a time for each input, e.g.:
+	 * the audio thread before it calls render().
+	 *
+	 * Events sent to an input that is connected to another slot with
+	 * connectEvents() are discarded.
+	 *
+	 * @param port the index of the input among the atom inputs of the
+	 * slot
+	 * @param frame the frame within the next block at which the event
+	 * is delivered. Frames past the end of the block are carried over
+	 * to the following blocks.
+	 * @param type the URID of the type of the event, see mapUri()
+	 * @return 0 on success, a negative value if the slot or port are
+	 * invalid, the queue is full or the event is larger than the
+	 * buffer of the port
+	 */
+	int sendEvent(unsigned int slotN, unsigned int port, unsigned int frame, uint32_t type, uint32_t size, const void* body);
+	/// send a MIDI message to an atom input of a slot, see sendEvent()
+	int sendMidi(unsigned int slotN, unsigned int port, unsigned int frame, const uint8_t* data, uint32_t size);
+	/**
+	 * Get the next event written by a slot to one of its atom outputs.
+	 * This does not allocate, and can be called from one thread at a
+	 * time for each output. Events are dropped when they are not read
+	 * fast enough.
+	 *
+	 * @param port the index of the output among the atom outputs of the
+	 * slot
+	 * @param event where to write the event, including its header. Its
+	 * frame is relative to the start of the block it was written in.
+	 * @param maxSize the size of `event`. An event that does not fit is
+	 * dropped, and the next one is read instead.
+	 * @return the size of the event including its header, or 0 if there
+	 * is none
+	 */
+	uint32_t readEvent(unsigned int slotN, unsigned int port, LV2_Atom_Event* event, uint32_t maxSize);
+	/**
+	 * Connect an atom output of a slot to an atom input of another one,
+	 * replacing the current source of the input. The input reads straight
+	 * from the output's buffer.
+	 *
+	 * By default, the MIDI inputs of each slot are connected to the MIDI
+	 * outputs of the previous slot, and all other atom inputs get the
+	 * events sent to them with sendEvent().
+	 *
+	 * @param sourceSlotNumber the source slot. If this is -1, the input
+	 * gets the events sent to it with sendEvent().
+	 * @param sourcePort the index of the output among the atom outputs
+	 * of the source slot
+	 * @param destinationPort the index of the input among the atom
+	 * inputs of the destination slot
+	 */
+	bool connectEvents(int sourceSlotNumber, unsigned int sourcePort, unsigned int destinationSlotNumber, unsigned int destinationPort);
 
 	/**
-	 * Create a new audio connection between two slots.
+	 * Create a new audio connection between two slots, replacing the
+	 * current sources of the destination channel.
 	 * Note that the sourcePort and inputPort are indexed between 0 and
 	 * the number of output or input audio ports, respectively.
 	 *
@@ -47,46 +280,563 @@ public:
 	 * buffers passed to Lv2Host::render()
 	 * @param destinationChannel the audio channel of the destination that you want to
 	 * connect to
+	 * @param gain the gain applied to the source. A connection with unity
+	 * gain from a single source is free: the destination reads straight
+	 * from the source's buffer.
 	 */
-	bool connect(int sourceSlotNumber, unsigned int sourceChannel, unsigned int destinationSlotNumber, unsigned int destinationChannel);
+	bool connect(int sourceSlotNumber, unsigned int sourceChannel, unsigned int destinationSlotNumber, unsigned int destinationChannel, float gain = 1);
 	/**
-	 * Disconnect an audio connection between two slots.
-	 * Note that the destinationChannel is indexed between 0 and
-	 * the number of inputs audio ports.
+	 * Add a source to the destination channel, which gets the sum of all
+	 * its sources. If the source is already connected to it, only its
+	 * gain is changed.
 	 *
 	 * The parameter description is the same as for connect().
 	 */
+	bool mix(int sourceSlotNumber, unsigned int sourceChannel, unsigned int destinationSlotNumber, unsigned int destinationChannel, float gain = 1);
 	bool disconnect(unsigned int destinationSlotNumber, unsigned int destinationChannel);
 	/**
-	 * bypass a slot. You have to manually create connections across the
-	 * slot for the signal to go through when it is bypassed.
+	 * bypass a slot. The inputs of a bypassed slot are routed to its
+	 * outputs (each input to the output with the same index, the last
+	 * input to any further outputs) and the plugin is not run.
+	 *
+	 * When the state changes, the outputs crossfade between the plugin
+	 * and its inputs over the number of frames set with
+	 * setBypassFade(). Once that is over, whatever reads the outputs of
+	 * the bypassed slot reads straight from its sources.
 	 */
 	void bypass(unsigned int slotNumber, bool bypassed);
+	/**
+	 * Set the length of the crossfade when a slot is bypassed or
+	 * un-bypassed. 0 switches at the start of the next block.
+	 */
+	void setBypassFade(unsigned int frames);
+	/**
+	 * Get the latency of the whole chain, in frames.
+	 *
+	 * The latency reported by each plugin is compensated for: whenever
+	 * the sources of a slot input or host output have gone through
+	 * different amounts of latency, the earlier ones are delayed to line
+	 * up with the latest. All the host outputs are aligned in the same
+	 * way, and this is the latency they all have.
+	 */
+	unsigned int getLatency() { return chainLatency + internalBlockSize; };
+	/**
+	 * Plugins can change their latency while running. Call this every
+	 * now and then, from the thread that makes the other changes to the
+	 * chain, to update the compensation when that happens.
+	 *
+	 * @return true if the latency of any slot has changed
+	 */
+	bool checkLatency();
+	/**
+	 * Run slots that do not depend on each other in parallel.
+	 *
+	 * Dependencies are derived from the audio connections: two slots
+	 * sharing a buffer always run in the order they have in the chain.
+	 * The thread calling render() takes part in the processing.
+	 * Not safe to call concurrently with render().
+	 *
+	 * @param nWorkers the number of worker threads to use in addition to
+	 * the thread calling render(). 0 goes back to serial processing.
+	 * @param priority the SCHED_FIFO priority of the worker threads
+	 */
+	bool setParallel(unsigned int nWorkers, int priority = 90);
+	struct bufferStats {
+		/// audio outputs of all slots
+		unsigned int nSlotOutputs;
+		/// slot outputs that need a buffer (i.e.: those not written
+		/// straight into the buffers passed to render())
+		unsigned int nBuffers;
+		/// buffers those are packed into. This is the peak number of
+		/// buffers live at the same time during a block
+		unsigned int nPooledBuffers;
+		/// buffers allocated so far, including those not currently in use
+		unsigned int nAllocatedBuffers;
+		/// size of the pooled buffers, in bytes
+		size_t workingSetBytes;
+	};
+	/**
+	 * Get statistics about the intermediate audio buffers for the
+	 * current topology.
+	 */
+	struct bufferStats getBufferStats();
+	/**
+	 * Get statistics about the memory arena. `nFailed` counts the
+	 * allocations that did not fit and came from the heap instead.
+	 */
+	struct RtArena::stats getArenaStats() { return arena.getStats(); };
+	/**
+	 * Get how long a slot has taken to run in each block, including
+	 * mixing its inputs. Blocks where the slot is bypassed are not
+	 * counted. Can be called from any thread, but not concurrently with
+	 * add().
+	 *
+	 * Profiling is only built in when LV2HOST_PROFILE is defined;
+	 * otherwise it costs nothing and this returns false.
+	 *
+	 * @param snapshot the statistics. Its overruns are the blocks where
+	 * the slot alone took longer than the deadline.
+	 */
+	bool getSlotProfile(unsigned int slotN, struct RtProfile::snapshot& snapshot);
+	/**
+	 * Get how long each call to render() has taken. Can be called from
+	 * any thread.
+	 *
+	 * @param snapshot the statistics. Its overruns are the blocks that
+	 * missed the deadline, see setProfileDeadline().
+	 * @return false if profiling is not built in, see getSlotProfile()
+	 */
+	bool getBlockProfile(struct RtProfile::snapshot& snapshot);
+	/**
+	 * Set the deadline of each block, as a fraction of the time it
+	 * lasts at the sample rate. The default is 1.
+	 */
+	void setProfileDeadline(float fraction);
+	/**
+	 * Clear the statistics. They are cleared by the next call to
+	 * render(). Can be called from any thread.
+	 */
+	void resetProfile();
+	/**
+	 * Meter the peak level, the RMS level and the clipping of a signal.
+	 * Meters are off until they are enabled, and cost nothing then.
+	 *
+	 * The outputs of a slot are measured right after it runs, and not
+	 * at all while it is bypassed.
+	 *
+	 * @param slotNumber the slot whose output to measure, -1 for the
+	 * host inputs or count() for the host outputs, as with connect()
+	 * @param channel the channel of the slot or host
+	 */
+	bool setMeter(int slotNumber, unsigned int channel, bool enabled);
+	/**
+	 * Get the levels of the last window measured by a meter. This never
+	 * holds up render(), and can be called from any thread, but not
+	 * concurrently with setMeter().
+	 *
+	 * @return false if the meter has never been enabled
+	 */
+	bool getMeter(int slotNumber, unsigned int channel, struct RtMeter::snapshot& snapshot);
+	/**
+	 * Set over how many frames the meters measure their levels. The
+	 * default is 50 ms. Call this before enabling any meter: those
+	 * enabled before keep their window.
+	 */
+	void setMeterWindow(unsigned int frames);
 	/** process the effect chain
+	 * @param nFrames the size of the block. Blocks longer than the
+	 * maxBlockSize passed to setup() are processed in several parts.
 	 * @param inputs array of pointers to audio input channels (as set by setup())
 	 * @param outputs array of pointers to audio output channels (as set by setup())
 	 */
 	void render(unsigned int nFrames, float const** inputs, float** outputs);
+	enum sampleFormat {
+		kSampleFloat, ///< 32-bit float
+		kSampleInt16, ///< 16-bit signed integer
+		kSampleInt32, ///< 32-bit signed integer
+		kSampleInt24In32, ///< 24-bit signed integer in the low bits of 32
+	};
+	/**
+	 * Process the effect chain on interleaved buffers, as audio devices
+	 * commonly provide them.
+	 *
+	 * The inputs are converted into float buffers that the first slots
+	 * read from, and the outputs are converted back from the buffers of
+	 * the slots that write them. Host outputs that copy a host input or a
+	 * slot output are converted straight from it. Outputs nothing is
+	 * connected to are set to 0.
+	 *
+	 * @param input nFrames frames of as many channels as the audio inputs
+	 * passed to setup()
+	 * @param output nFrames frames of as many channels as the audio
+	 * outputs passed to setup()
+	 * @param format the format of the samples in both buffers
+	 */
+	void renderInterleaved(unsigned int nFrames, const void* input, void* output, enum sampleFormat format);
+	/**
+	 * Bring the chain back to the state it had before processing any
+	 * audio, keeping its topology and control values: the plugins are
+	 * deactivated and activated again, and the buffers, delay lines and
+	 * pending events are cleared. Not safe to call concurrently with
+	 * render().
+	 */
+	void reset();
 	void cleanup();
 
 private:
 	struct map {
 		int slot;
 		int channel;
+		float gain;
+		// delay compensation, in frames. This is only set in the plan.
+		unsigned int delay;
+	};
+	struct controlEvent {
+		unsigned int slot;
+		unsigned int port;
+		float value;
+		unsigned int frame;
+		// the generation of the plugin of the slot it is meant for
+		unsigned int generation;
+	};
+	struct hostPort {
+		unsigned int slot;
+		unsigned int channel;
+		uint32_t port;
+		unsigned int hostChannel;
+	};
+	struct passThrough {
+		unsigned int hostChannel;
+		unsigned int inputChannel;
+	};
+	struct outputCopy {
+		unsigned int hostChannel;
+		const float* source;
+	};
+	// the control values of a state being restored into a slot
+	struct stateValues {
+		Lv2Host* host;
+		LV2Apply* slot;
+		unsigned int slotNumber;
+		// stage them for render() rather than setting the ports of a
+		// slot that is not running yet
+		bool staged;
+		std::vector<struct controlEvent> events;
+	};
+	// a state restored into the instances of a slot by the worker thread
+	struct stateRestore {
+		Lv2Host* host;
+		unsigned int slotNumber;
+		LV2Apply* slot;
+		LilvState* state;
+		std::vector<std::vector<const LV2_Feature*>> features;
+		// the first plan that does not run the slot
+		unsigned int generation = 0;
+		std::atomic<bool> done{false};
+		~stateRestore() { lilv_state_free(state); };
+	};
+	struct meter {
+		int slot;
+		unsigned int channel;
+		bool enabled;
+		RtMeter rtMeter;
+	};
+	struct meterTap {
+		RtMeter* meter;
+		unsigned int channel;
+		// for host outputs renderInterleaved() converts straight from
+		// their source: the slot output or the host input to measure
+		// instead
+		const float* copySource;
+		int passThroughInput;
+	};
+	// a ring buffer holding the past of a source, for delay compensation
+	struct delayLine {
+		float* buffer;
+		unsigned int size;
+		unsigned int writePosition;
+		// the connection this is used by: destinationSlot is -1 for the
+		// host outputs
+		int destinationSlot;
+		unsigned int destinationChannel;
+		int sourceSlot;
+		int sourceChannel;
+	};
+	// an atom sequence port of a slot and its buffers
+	struct atomPort {
+		uint32_t port;
+		// the size of each buffer, in bytes
+		uint32_t capacity;
+		// inputs: the events sent to the port for this block. Outputs:
+		// what the plugin writes.
+		LV2_Atom_Sequence* buffer;
+		// inputs: the events sent to the port for the following blocks
+		LV2_Atom_Sequence* pending;
+		// what the plugin is connected to when the slot runs in
+		// sub-blocks
+		LV2_Atom_Sequence* scratch;
+		// inputs: the events from sendEvent(). Outputs: the events for
+		// readEvent().
+		RtRingBuffer queue;
+	};
+	struct atomPorts {
+		std::vector<std::unique_ptr<struct atomPort>> inputs;
+		std::vector<std::unique_ptr<struct atomPort>> outputs;
+	};
+	struct mixSource {
+		// NULL for the host input at hostChannel
+		const float* buffer;
+		unsigned int hostChannel;
+		float gain;
+		struct delayLine* delay;
+		unsigned int delayFrames;
+	};
+	// an audio input (or host output) fed by more than one source, or
+	// with a gain
+	struct mix {
+		float* destination;
+		unsigned int hostChannel;
+		std::vector<struct mixSource> sources;
+	};
+	/**
+	 * Everything render() needs to know about the topology. A new plan is
+	 * built on the calling thread whenever the topology changes, and
+	 * render() swaps it in at the start of the next block.
+	 */
+	enum nodeKind {
+		kSlotNode, // runs a whole slot
+		kFirstNode, // runs the inputs and the first copy of a slot
+		kCopyNode, // runs one of the other copies
+		kLastNode, // runs finishSlot()
+	};
+	struct node {
+		unsigned int slot;
+		unsigned int copy;
+		enum nodeKind kind;
+	};
+	struct renderPlan {
+		std::vector<LV2Apply*> slots;
+		std::vector<unsigned int> slotGenerations;
+		std::vector<std::vector<struct controlEvent>*> events;
+		std::vector<bool> bypass;
+		// slots crossfading after bypass() changed their state. They
+		// run even if bypassed, and their outputs are mixed with their
+		// inputs.
+		std::vector<bool> fading;
+		std::vector<unsigned int> fadingSlots;
+		std::vector<unsigned int*> fades;
+		unsigned int fadeLength;
+		// the latency of each slot when the plan was built
+		std::vector<unsigned int> latencies;
+		// the workers of the copies of each slot
+		std::vector<std::vector<Lv2Worker::Instance*>> workers;
+		// only filled when built with LV2HOST_PROFILE
+		std::vector<RtProfile*> profiles;
+		// buffers connected to the audio ports of each slot when the plan
+		// is installed; NULL for those that render() connects to the
+		// buffers passed to it.
+		std::vector<std::vector<float*>> inputs;
+		std::vector<std::vector<float*>> outputs;
+		// the outputs connected to a scratch buffer, which nobody reads
+		std::vector<std::vector<bool>> unusedOutputs;
+		std::vector<struct atomPorts*> atoms;
+		// the sequences connected to the atom inputs of each slot
+		std::vector<std::vector<LV2_Atom_Sequence*>> atomInputs;
+		std::vector<struct hostPort> hostInputs;
+		std::vector<struct hostPort> hostOutputs;
+		std::vector<struct passThrough> passThroughs;
+		std::vector<struct outputCopy> outputCopies;
+		// the mixes feeding the inputs of each slot, computed right
+		// before the slot runs
+		std::vector<std::vector<struct mix>> inputMixes;
+		std::vector<struct mix> outputMixes;
+		// the meters that are enabled
+		std::vector<std::vector<struct meterTap>> slotMeters;
+		std::vector<struct meterTap> inputMeters;
+		std::vector<struct meterTap> outputMeters;
+		DagScheduler::Graph graph;
+		// the nodes of graph when the copies of some slots run in
+		// parallel; empty when each node is a whole slot
+		std::vector<struct node> nodes;
+		// set by the first node of a slot when its copies had to run
+		// there, in sub-blocks, and the copy nodes have nothing to do
+		std::vector<char> serialCopies;
+		// when each slot started the current block, only filled when
+		// built with LV2HOST_PROFILE
+		std::vector<uint64_t> starts;
+		// plans are numbered in the order they are built
+		unsigned int generation = 0;
+		// the restores the slots bypassed for them are waiting for
+		std::vector<std::shared_ptr<struct stateRestore>> restores;
+		// the plan to switch to once all the crossfades and the restores
+		// are over
+		renderPlan* after = nullptr;
+		~renderPlan() { delete after; };
+	};
+	// a plugin being added by addChain()
+	struct pendingSlot {
+		std::string uri;
+		unsigned int nCopies = 1;
+		bool parallel = false;
+		LV2Apply* slot = nullptr;
+		// the worker and the features of each copy
+		std::vector<Lv2Worker::Instance*> workers;
+		std::vector<std::vector<const LV2_Feature*>> features;
+		// whether each copy has been instantiated and activated
+		std::vector<char> ready;
+	};
+	struct instantiateJob;
+	// a slot replaced by replace(), waiting for render() to be done with
+	// it
+	struct retiredSlot {
+		LV2Apply* slot;
+		std::vector<Lv2Worker::Instance*> workers;
+		std::unique_ptr<struct atomPorts> atoms;
+		std::unique_ptr<std::vector<struct controlEvent>> events;
+		// the first plan that does not use it
+		unsigned int generation;
+	};
+	// a delay line replaced by a longer one
+	struct retiredDelayLine {
+		std::unique_ptr<struct delayLine> line;
+		unsigned int generation;
 	};
+	bool prepareSlot(struct pendingSlot& pending);
+	bool instantiateCopy(struct pendingSlot& pending, unsigned int copy);
+	bool finishInstantiation(struct pendingSlot& pending);
+	static void* instantiateSlots(void* arg);
+	std::vector<int> addSlots(std::vector<struct pendingSlot>& pending, unsigned int nThreads);
+	struct atomPorts* setupSlot(LV2Apply* slot, std::vector<Lv2Worker::Instance*> const& workers);
+	void releaseAtoms(struct atomPorts& atoms);
+	void insertSlot(LV2Apply* slot, std::vector<Lv2Worker::Instance*> const& workers, bool parallel);
+	void freeRetiredSlots(bool all);
+	void applyControl(struct controlEvent const& event);
+	bool isCurrentEvent(struct controlEvent const& event);
+	bool restoreState(unsigned int slotNumber, LilvState* state);
+	static bool restoreJob(void* arg);
+	void cancelRestores(unsigned int slotNumber);
+	void stageControls(std::vector<struct controlEvent> const& events);
+	void freeAppliedControls();
+	static void setStateValue(const char* symbol, void* arg, const void* value, uint32_t size, uint32_t type);
+	static const void* getStateValue(const char* symbol, void* arg, uint32_t* size, uint32_t* type);
+	bool isSlotOutput(struct map const& source);
+	bool setSource(struct map const& source, unsigned int destinationSlotNumber, unsigned int destinationChannel, bool replace);
+	void resolveSources(std::vector<struct map> const& sources, float gain, std::vector<bool> const& bypassed, std::vector<bool> const& fading, std::vector<struct map>& active, unsigned int depth);
+	bool isFading(unsigned int slotNumber);
+	renderPlan* buildPlan(std::vector<bool> const& bypassed, std::vector<bool> const& fading);
+	static void finishSlot(Lv2Host* that, unsigned int slotNumber, bool run);
+	static void crossfade(Lv2Host* that, unsigned int slotNumber);
+	struct delayLine* getDelayLine(int destinationSlot, unsigned int destinationChannel, struct map const& source);
+	static void receiveEvents(Lv2Host* that, struct atomPort& port, unsigned int nFrames);
+	static void splitEvents(Lv2Host* that, unsigned int slotNumber, unsigned int start, unsigned int end);
+	static void joinEvents(Lv2Host* that, unsigned int slotNumber, unsigned int start);
+	static void runMix(struct mix const& mix, float* destination, const float** inputs, unsigned int nFrames);
+	void updatePlan();
+	void installPlan(renderPlan* newPlan);
+	void renderBlock(unsigned int nFrames, float const** inputs, float** outputs);
+	void renderInternalBlocks(unsigned int nFrames, float const** inputs, float** outputs);
+	static void runSlot(void* arg, unsigned int node);
+	static void processSlot(Lv2Host* that, unsigned int slotNumber, bool firstCopyOnly);
+	void* allocate(size_t size);
+	void release(void* ptr);
+	static void* allocate(void* arg, size_t size);
+	static void release(void* arg, void* ptr);
+	// the topology, as seen by the control thread
 	std::vector<LV2Apply*> slots;
-	std::vector<struct map> inputMap;
-	std::vector<struct map> outputMap;
-	std::vector<int> tmpModifiedSlots;
-	LilvWorld* world;
-	Symap* symap;
-	LV2_URID_Map map;
-	LV2_URID_Unmap unmap;
-	LV2_Feature mapFeature;
-	LV2_Feature unmapFeature;
-	std::vector<const LV2_Feature*> featureList;
-	std::vector<std::vector<float>> buffers;
-	std::vector<float> dummyInput;
+	// the sources of each audio input of each slot, and of each host
+	// output. Those with more than one source get their sum.
+	std::vector<std::vector<std::vector<struct map>>> inputSources;
+	std::vector<std::vector<struct map>> outputMap;
+	// the source of each atom input of each slot
+	std::vector<std::vector<struct map>> atomSources;
+	std::vector<std::unique_ptr<struct atomPorts>> slotAtoms;
+	LV2_URID atomSequenceUrid;
+	LV2_URID atomFloatUrid;
+	LV2_URID atomDoubleUrid;
+	LV2_URID atomIntUrid;
+	LV2_URID atomLongUrid;
+	LV2_URID atomBoolUrid;
+	LV2_URID atomChunkUrid;
+	LV2_URID midiEventUrid;
+	// the world, the URID map and the features shared by the plugins
+	std::shared_ptr<Lv2HostContext> context;
+	bool catalogueEnabled = true;
+	std::string cataloguePath;
+	Lv2Worker worker;
+	std::vector<std::vector<Lv2Worker::Instance*>> slotWorkers;
+	// whether the copies of each multi-instance slot run in parallel
+	std::vector<bool> parallelCopies;
+	// audio buffers and the port tables of the slots live here, next to
+	// each other
+	RtArena arena;
+	size_t arenaSize = 0;
+	bool arenaHugePages = false;
+	bool arenaLockMemory = false;
+	// the buffer pool. It only grows, so that render() can keep using the
+	// buffers of the previous plan until it swaps in the new one.
+	std::vector<float*> buffers;
+	struct bufferStats lastBufferStats;
+	float* dummyInput = nullptr;
+	// where the outputs nobody reads are written, one buffer per copy of
+	// each slot in the plan, so that slots running in parallel do not
+	// write to the same memory. It only grows, like the buffer pool.
+	std::vector<float*> scratchOutputs;
+	// the buffers the latency probe of setupSlot() runs on, which are
+	// not used by render()
+	float* probeInput = nullptr;
+	float* probeOutput = nullptr;
+	// the part of the blocks passed to render() that renderBlock()
+	// processes at a time
+	std::vector<const float*> partInputs;
+	std::vector<float*> partOutputs;
+	// the channels of renderInterleaved() in float, and what each output
+	// is converted from
+	std::vector<float*> formatInputs;
+	std::vector<float*> formatOutputs;
+	std::vector<const float*> formatSources;
+	// set while renderInterleaved() converts the host outputs that copy
+	// another buffer straight from it
+	bool copiesFused = false;
+	// with an internal block size, the FIFOs of each host channel and how
+	// many frames of the current internal block they hold
+	unsigned int internalBlockSize = 0;
+	std::vector<float*> inputFifos;
+	std::vector<float*> outputFifos;
+	unsigned int fifoFrames = 0;
+	DagScheduler scheduler;
+	RtQueue<struct controlEvent> controlQueue;
+	// control values that render() applies all at once at the start of a
+	// block, and gives back to be freed once it has
+	std::atomic<std::vector<struct controlEvent>*> stagedControls{nullptr};
+	RtQueue<std::vector<struct controlEvent>*> appliedControls;
+	std::vector<std::unique_ptr<std::vector<struct controlEvent>>> slotEvents;
+	// the generation of the first plan with the current plugin of each
+	// slot, which tells the control events for the plugins replace()
+	// retired apart
+	std::vector<unsigned int> slotGenerations;
+	// how many frames into the crossfade towards bypass each slot is,
+	// from 0 (running) to the fade length (bypassed). Owned by render().
+	std::vector<std::unique_ptr<unsigned int>> bypassFades;
+	// when bypass() last changed the state of each slot, in rendered frames
+	std::vector<unsigned int> bypassChangeFrames;
+	std::vector<bool> bypassChanged;
+	// written by render(), and only when built with LV2HOST_PROFILE
+	std::vector<std::unique_ptr<RtProfile>> slotProfiles;
+	RtProfile blockProfile;
+	// meters are never freed before cleanup(), as render() may be using
+	// them: disabling one only leaves it out of the next plans
+	std::vector<std::unique_ptr<struct meter>> meters;
+	unsigned int meterWindow = 0;
+	std::atomic<float> profileDeadline{1};
+	std::atomic<bool> profileResetRequested{false};
+	// the deadline of the current block
+	uint64_t deadlineNs = 0;
+	unsigned int bypassFadeFrames;
+	std::atomic<unsigned int> renderedFrames{0};
+	std::vector<unsigned int> slotLatencies;
+	unsigned int chainLatency = 0;
+	// set by render() when a slot reports a latency other than the one
+	// the plan was built for
+	std::atomic<bool> latencyChanged{false};
+	// delay lines are kept across plans, so that they keep their content
+	// when the topology changes
+	std::vector<std::unique_ptr<struct delayLine>> delayLines;
+	std::vector<struct retiredDelayLine> retiredDelayLines;
+	// the plan in use by render()
+	renderPlan* plan = nullptr;
+	std::atomic<renderPlan*> nextPlan{nullptr};
+	// plans replaced by render(), waiting to be freed
+	RtQueue<renderPlan*> retiredPlans;
+	std::vector<struct retiredSlot> retiredSlots;
+	// the states being restored. Their slots are bypassed until they are
+	// done.
+	std::vector<std::shared_ptr<struct stateRestore>> restores;
+	unsigned int planGeneration = 0;
+	// the generation of the plan render() last installed
+	std::atomic<unsigned int> installedGeneration{0};
+	unsigned int minSubBlockSize;
+	unsigned int renderFrames;
+	const float** renderInputs;
 	float sampleRate;
 	unsigned int maxBlockSize;
 	unsigned int nAudioInputs;
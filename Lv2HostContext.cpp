@@ -0,0 +1,65 @@
+#include "Lv2HostContext.h"
+#include "lilv_interface.h"
+
+Lv2HostContext::Lv2HostContext()
+{
+	pthread_mutex_init(&mutex, NULL);
+}
+
+Lv2HostContext::~Lv2HostContext()
+{
+	cleanup();
+	pthread_mutex_destroy(&mutex);
+}
+
+bool Lv2HostContext::setup(bool catalogueEnabled, std::string const& cataloguePath)
+{
+	this->catalogueEnabled = catalogueEnabled;
+	if(catalogueEnabled)
+	{
+		world = LV2Apply_initializeEmptyWorld();
+		if(!world || !catalogue.setup(world, cataloguePath))
+			return false;
+	} else {
+		world = LV2Apply_initializeWorld();
+	}
+	if(!world)
+		return false;
+	symap = symap_new();
+	if(!symap)
+		return false;
+	map.handle = symap;
+	map.map = (LV2_URID (*)(LV2_URID_Map_Handle, const char *))symap_map;
+	mapFeature.URI = LV2_URID__map;
+	mapFeature.data = &map;
+	unmap.handle = symap;
+	unmap.unmap = (const char *(*)(LV2_URID_Unmap_Handle, LV2_URID))symap_unmap;
+	unmapFeature.URI = LV2_URID__unmap;
+	unmapFeature.data = &unmap;
+	featureList.clear();
+	featureList.push_back(&mapFeature);
+	featureList.push_back(&unmapFeature);
+	featureList.push_back(NULL);
+	return true;
+}
+
+void Lv2HostContext::cleanup()
+{
+	featureList.clear();
+	catalogue.cleanup();
+	if(world)
+		LV2Apply_cleanupWorld(world);
+	world = nullptr;
+	symap_free(symap);
+	symap = nullptr;
+}
+
+LV2_URID Lv2HostContext::mapUri(const char* uri)
+{
+	return symap_map(symap, uri);
+}
+
+const char* Lv2HostContext::unmapUri(LV2_URID urid)
+{
+	return symap_unmap(symap, urid);
+}
@@ -0,0 +1,70 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <pthread.h>
+#include <lilv-0/lilv/lilv.h>
+#include "PluginCatalogue.h"
+#include "lv2/lv2plug.in/ns/ext/urid/urid.h"
+extern "C"
+{
+#include "symap.h"
+}
+
+/**
+ * What all the plugins of one or more Lv2Host have in common: the
+ * LilvWorld they are found in, the catalogue of the installed plugins and
+ * the URID map, with the features that give the plugins access to it.
+ *
+ * Hosts share a context through a std::shared_ptr, see
+ * Lv2Host::setContext(), so that the plugin data is parsed once and kept
+ * in memory once, however many hosts there are. It is freed with the last
+ * host using it.
+ */
+class Lv2HostContext
+{
+public:
+	Lv2HostContext();
+	~Lv2HostContext();
+	/**
+	 * Create the world and the URID map.
+	 *
+	 * @param catalogueEnabled find the plugins through a PluginCatalogue,
+	 * loading only the bundles of the plugins in use. Otherwise, all the
+	 * bundles on LV2_PATH are loaded here.
+	 * @param cataloguePath where the index of the catalogue is kept, see
+	 * PluginCatalogue::setup()
+	 */
+	bool setup(bool catalogueEnabled = true, std::string const& cataloguePath = "");
+	void cleanup();
+	/**
+	 * The world is not thread-safe: hold this lock while using it, or
+	 * anything that may use it, such as instantiating a plugin through
+	 * lilv or freeing it, when several hosts may be doing so from
+	 * different threads.
+	 */
+	void lock() { pthread_mutex_lock(&mutex); };
+	void unlock() { pthread_mutex_unlock(&mutex); };
+	LilvWorld* getWorld() { return world; };
+	LV2_URID_Map* getMap() { return &map; };
+	LV2_URID_Unmap* getUnmap() { return &unmap; };
+	/// NULL if the catalogue is not used
+	PluginCatalogue* getCatalogue() { return catalogueEnabled ? &catalogue : nullptr; };
+	/// the features given to every plugin, terminated by NULL
+	std::vector<const LV2_Feature*> const& getFeatures() { return featureList; };
+	/// Map a URI to a URID. This is thread-safe.
+	LV2_URID mapUri(const char* uri);
+	/// Map a URID back to its URI. This is thread-safe.
+	const char* unmapUri(LV2_URID urid);
+
+private:
+	pthread_mutex_t mutex;
+	LilvWorld* world = nullptr;
+	PluginCatalogue catalogue;
+	bool catalogueEnabled = false;
+	Symap* symap = nullptr;
+	LV2_URID_Map map;
+	LV2_URID_Unmap unmap;
+	LV2_Feature mapFeature;
+	LV2_Feature unmapFeature;
+	std::vector<const LV2_Feature*> featureList;
+};
@@ -0,0 +1,210 @@
+#include "Lv2Worker.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+// how often the jobs that are not done yet are tried again
+static const long kJobRetryNs = 5000000;
+
+Lv2Worker::Lv2Worker() :
+	running(false),
+	bufferSize(0)
+{
+	pthread_mutex_init(&mutex, NULL);
+	sem_init(&sem, 0, 0);
+}
+
+Lv2Worker::~Lv2Worker()
+{
+	cleanup();
+	sem_destroy(&sem);
+	pthread_mutex_destroy(&mutex);
+}
+
+bool Lv2Worker::setup(unsigned int bufferSize)
+{
+	cleanup();
+	this->bufferSize = bufferSize;
+	request.resize(bufferSize);
+	running = true;
+	int ret = pthread_create(&thread, NULL, loop, this);
+	if(ret)
+	{
+		fprintf(stderr, "Unable to create the worker thread: %s\n", strerror(ret));
+		running = false;
+		return false;
+	}
+	return true;
+}
+
+void Lv2Worker::cleanup()
+{
+	if(running)
+	{
+		running = false;
+		sem_post(&sem);
+		pthread_join(thread, NULL);
+	}
+	instances.clear();
+	jobs.clear();
+}
+
+Lv2Worker::Instance* Lv2Worker::addInstance()
+{
+	Instance* instance = new Instance;
+	instance->worker = this;
+	instance->schedule.handle = instance;
+	instance->schedule.schedule_work = Instance::scheduleWork;
+	instance->feature.URI = LV2_WORKER__schedule;
+	instance->feature.data = &instance->schedule;
+	// room for a message of bufferSize bytes and its header
+	instance->requests.setup(bufferSize + RtRingBuffer::kHeaderSize);
+	instance->responses.setup(bufferSize + RtRingBuffer::kHeaderSize);
+	instance->response.resize(bufferSize);
+	pthread_mutex_lock(&mutex);
+	instances.emplace_back(instance);
+	pthread_mutex_unlock(&mutex);
+	return instance;
+}
+
+void Lv2Worker::removeInstance(Instance* instance)
+{
+	pthread_mutex_lock(&mutex);
+	for(auto it = instances.begin(); it != instances.end(); ++it)
+	{
+		if(it->get() == instance)
+		{
+			instances.erase(it);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&mutex);
+}
+
+void Lv2Worker::addJob(bool (*job)(void* arg), void* arg)
+{
+	pthread_mutex_lock(&mutex);
+	jobs.push_back({job, arg});
+	pthread_mutex_unlock(&mutex);
+	sem_post(&sem);
+}
+
+void Lv2Worker::removeJobs(void* arg)
+{
+	pthread_mutex_lock(&mutex);
+	for(auto it = jobs.begin(); it != jobs.end();)
+	{
+		if(it->arg == arg)
+			it = jobs.erase(it);
+		else
+			++it;
+	}
+	pthread_mutex_unlock(&mutex);
+}
+
+void* Lv2Worker::loop(void* arg)
+{
+	Lv2Worker* that = (Lv2Worker*)arg;
+	bool retry = false;
+	while(1)
+	{
+		if(retry)
+		{
+			struct timespec ts;
+			clock_gettime(CLOCK_REALTIME, &ts);
+			ts.tv_nsec += kJobRetryNs;
+			if(ts.tv_nsec >= 1000000000)
+			{
+				ts.tv_nsec -= 1000000000;
+				++ts.tv_sec;
+			}
+			sem_timedwait(&that->sem, &ts);
+		} else {
+			sem_wait(&that->sem);
+		}
+		if(!that->running)
+			break;
+		pthread_mutex_lock(&that->mutex);
+		for(auto& instance : that->instances)
+		{
+			if(!instance->iface)
+				continue;
+			uint32_t size;
+			while((size = instance->requests.read(that->request.data(), that->request.size())))
+			{
+				if(RtRingBuffer::kDropped != size)
+				{
+					instance->iface->work(instance->handle, Instance::respond, instance.get(), size, that->request.data());
+				} else {
+					++that->droppedRequests;
+					fprintf(stderr, "Lv2Worker: dropped a request larger than %u bytes\n", that->bufferSize);
+				}
+			}
+		}
+		unsigned int dropped = that->droppedResponses.load();
+		if(dropped != that->loggedResponses)
+		{
+			fprintf(stderr, "Lv2Worker: dropped %u responses larger than %u bytes\n", dropped - that->loggedResponses, that->bufferSize);
+			that->loggedResponses = dropped;
+		}
+		for(auto it = that->jobs.begin(); it != that->jobs.end();)
+		{
+			if(it->run(it->arg))
+				it = that->jobs.erase(it);
+			else
+				++it;
+		}
+		retry = !that->jobs.empty();
+		pthread_mutex_unlock(&that->mutex);
+	}
+	return NULL;
+}
+
+void Lv2Worker::Instance::setup(LilvInstance* instance)
+{
+	pthread_mutex_lock(&worker->mutex);
+	handle = lilv_instance_get_handle(instance);
+	iface = (const LV2_Worker_Interface*)lilv_instance_get_extension_data(instance, LV2_WORKER__interface);
+	pthread_mutex_unlock(&worker->mutex);
+}
+
+void Lv2Worker::Instance::endRun()
+{
+	if(!iface)
+		return;
+	uint32_t size;
+	while((size = responses.read(response.data(), response.size())))
+	{
+		if(RtRingBuffer::kDropped == size)
+		{
+			// let the worker thread report it
+			worker->droppedResponses.fetch_add(1, std::memory_order_relaxed);
+			sem_post(&worker->sem);
+		} else if(iface->work_response) {
+			iface->work_response(handle, size, response.data());
+		}
+	}
+	if(iface->end_run)
+		iface->end_run(handle);
+}
+
+// called by the plugin from run()
+LV2_Worker_Status Lv2Worker::Instance::scheduleWork(LV2_Worker_Schedule_Handle handle, uint32_t size, const void* data)
+{
+	Instance* that = (Instance*)handle;
+	// the ring may have room for more than the other side can read
+	if(size > that->worker->bufferSize || !that->requests.write(data, size))
+		return LV2_WORKER_ERR_NO_SPACE;
+	sem_post(&that->worker->sem);
+	return LV2_WORKER_SUCCESS;
+}
+
+// called by the plugin from work(), on the worker thread
+LV2_Worker_Status Lv2Worker::Instance::respond(LV2_Worker_Respond_Handle handle, uint32_t size, const void* data)
+{
+	Instance* that = (Instance*)handle;
+	// the ring may have room for more than the other side can read
+	if(size > that->worker->bufferSize || !that->responses.write(data, size))
+		return LV2_WORKER_ERR_NO_SPACE;
+	return LV2_WORKER_SUCCESS;
+}
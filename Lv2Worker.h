@@ -0,0 +1,104 @@
+#pragma once
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <pthread.h>
+#include <semaphore.h>
+#include <lilv-0/lilv/lilv.h>
+#include "lv2/lv2plug.in/ns/ext/worker/worker.h"
+#include "RtRingBuffer.h"
+
+/**
+ * The host side of the LV2 worker extension. Plugins schedule work from
+ * run(), which is done on a non-real-time thread. The responses are
+ * delivered back to the plugin by Instance::endRun(), from the audio
+ * thread.
+ */
+class Lv2Worker
+{
+public:
+	/// the worker of a plugin instance
+	class Instance
+	{
+	public:
+		/// the feature to pass to the plugin when instantiating it
+		const LV2_Feature* getFeature() { return &feature; };
+		/**
+		 * Call this once the plugin has been instantiated. If it does not
+		 * have the worker interface, this instance is never used.
+		 */
+		void setup(LilvInstance* instance);
+		/**
+		 * Deliver the responses to the plugin, then tell it that the
+		 * run is over. Call this from the audio thread after each
+		 * run().
+		 */
+		void endRun();
+	private:
+		friend class Lv2Worker;
+		static LV2_Worker_Status scheduleWork(LV2_Worker_Schedule_Handle handle, uint32_t size, const void* data);
+		static LV2_Worker_Status respond(LV2_Worker_Respond_Handle handle, uint32_t size, const void* data);
+		Lv2Worker* worker;
+		LV2_Worker_Schedule schedule;
+		LV2_Feature feature;
+		const LV2_Worker_Interface* iface = nullptr;
+		LV2_Handle handle = nullptr;
+		RtRingBuffer requests;
+		RtRingBuffer responses;
+		// where endRun() reads the responses into
+		std::vector<char> response;
+	};
+	Lv2Worker();
+	~Lv2Worker();
+	/**
+	 * Start the worker thread.
+	 *
+	 * @param bufferSize the size in bytes of the buffers holding the
+	 * requests and the responses of each instance. This is also the
+	 * largest message a plugin can send.
+	 */
+	bool setup(unsigned int bufferSize);
+	/// stop the worker thread and free all the instances
+	void cleanup();
+	/// create the worker for a new plugin instance
+	Instance* addInstance();
+	/**
+	 * Free the worker of an instance. The audio thread must be done
+	 * with it.
+	 */
+	void removeInstance(Instance* instance);
+	/**
+	 * Call `job(arg)` on the worker thread. A job that returns false is
+	 * not done yet, and is called again a few milliseconds later. Jobs
+	 * never run concurrently with the work() of the instances.
+	 */
+	void addJob(bool (*job)(void* arg), void* arg);
+	/// forget the jobs for `arg`. Once this returns, none of them is running.
+	void removeJobs(void* arg);
+	/**
+	 * The number of requests and responses dropped because they were
+	 * larger than the buffers. The worker thread also logs them.
+	 */
+	unsigned int getDropped() { return droppedRequests.load() + droppedResponses.load(); };
+
+private:
+	struct job {
+		bool (*run)(void* arg);
+		void* arg;
+	};
+	static void* loop(void* arg);
+	std::vector<std::unique_ptr<Instance>> instances;
+	std::vector<struct job> jobs;
+	// the worker thread holds this while it goes through the instances
+	pthread_mutex_t mutex;
+	sem_t sem;
+	pthread_t thread;
+	std::atomic<bool> running;
+	unsigned int bufferSize;
+	// where the worker thread reads the requests into
+	std::vector<char> request;
+	std::atomic<unsigned int> droppedRequests{0};
+	// counted by the audio thread, logged by the worker thread
+	std::atomic<unsigned int> droppedResponses{0};
+	unsigned int loggedResponses = 0;
+};
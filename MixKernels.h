@@ -0,0 +1,54 @@
+#pragma once
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
+/**
+ * Kernels used to sum audio connections, vectorised with NEON or SSE when
+ * available. The buffers do not need to be aligned, but they must not
+ * overlap.
+ */
+
+/// dst[n] = gain * src[n]
+static inline void mixScale(float* dst, const float* src, float gain, unsigned int nFrames)
+{
+	unsigned int n = 0;
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+	for(; n + 4 <= nFrames; n += 4)
+		vst1q_f32(dst + n, vmulq_n_f32(vld1q_f32(src + n), gain));
+#elif defined(__SSE__)
+	__m128 g = _mm_set1_ps(gain);
+	for(; n + 4 <= nFrames; n += 4)
+		_mm_storeu_ps(dst + n, _mm_mul_ps(_mm_loadu_ps(src + n), g));
+#endif
+	for(; n < nFrames; ++n)
+		dst[n] = gain * src[n];
+}
+
+/// dst[n] += gain * src[n]
+static inline void mixAccumulate(float* dst, const float* src, float gain, unsigned int nFrames)
+{
+	unsigned int n = 0;
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+	for(; n + 4 <= nFrames; n += 4)
+		vst1q_f32(dst + n, vmlaq_n_f32(vld1q_f32(dst + n), vld1q_f32(src + n), gain));
+#elif defined(__SSE__)
+	__m128 g = _mm_set1_ps(gain);
+	for(; n + 4 <= nFrames; n += 4)
+		_mm_storeu_ps(dst + n, _mm_add_ps(_mm_loadu_ps(dst + n), _mm_mul_ps(_mm_loadu_ps(src + n), g)));
+#endif
+	for(; n < nFrames; ++n)
+		dst[n] += gain * src[n];
+}
+
+/// dst[n] += gain * (src[n] - dst[n]), with gain changing by step at each frame
+static inline void mixCrossfade(float* dst, const float* src, float gain, float step, unsigned int nFrames)
+{
+	for(unsigned int n = 0; n < nFrames; ++n)
+	{
+		dst[n] += gain * (src[n] - dst[n]);
+		gain += step;
+	}
+}
@@ -0,0 +1,543 @@
+#include "OfflineRenderer.h"
+#include "Lv2Host.h"
+#include "RtQueue.h"
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <semaphore.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static const unsigned int kDefaultBlockSize = 4096;
+// blocks each writer thread can be behind the worker
+static const unsigned int kWriteBlocks = 4;
+static const unsigned int kWavHeaderSize = 44;
+
+// a memory-mapped WAV file
+struct wavInput {
+	void* map;
+	size_t mapSize;
+	const uint8_t* data;
+	uint64_t nFrames;
+	unsigned int nChannels;
+	unsigned int sampleRate;
+	unsigned int bytesPerSample;
+	bool isFloat;
+};
+
+static uint32_t readLe32(const uint8_t* p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint16_t readLe16(const uint8_t* p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static void writeLe32(uint8_t* p, uint32_t value)
+{
+	for(unsigned int n = 0; n < 4; ++n)
+		p[n] = value >> (8 * n);
+}
+
+static void writeLe16(uint8_t* p, uint16_t value)
+{
+	p[0] = value;
+	p[1] = value >> 8;
+}
+
+static void closeWav(struct wavInput& wav)
+{
+	if(wav.map)
+		munmap(wav.map, wav.mapSize);
+	wav.map = nullptr;
+}
+
+static bool openWav(const char* path, struct wavInput& wav)
+{
+	memset(&wav, 0, sizeof(wav));
+	int fd = open(path, O_RDONLY);
+	if(fd < 0)
+	{
+		fprintf(stderr, "Unable to open %s: %s\n", path, strerror(errno));
+		return false;
+	}
+	struct stat st;
+	if(fstat(fd, &st) || st.st_size < 12)
+	{
+		fprintf(stderr, "%s is not a WAV file\n", path);
+		close(fd);
+		return false;
+	}
+	wav.mapSize = st.st_size;
+	wav.map = mmap(NULL, wav.mapSize, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(MAP_FAILED == wav.map)
+	{
+		fprintf(stderr, "Unable to map %s: %s\n", path, strerror(errno));
+		wav.map = nullptr;
+		return false;
+	}
+	madvise(wav.map, wav.mapSize, MADV_SEQUENTIAL);
+	const uint8_t* p = (const uint8_t*)wav.map;
+	const uint8_t* end = p + wav.mapSize;
+	if(memcmp(p, "RIFF", 4) || memcmp(p + 8, "WAVE", 4))
+	{
+		fprintf(stderr, "%s is not a WAV file\n", path);
+		closeWav(wav);
+		return false;
+	}
+	bool hasFormat = false;
+	unsigned int bits = 0;
+	for(p += 12; p + 8 <= end; )
+	{
+		uint32_t size = readLe32(p + 4);
+		const uint8_t* body = p + 8;
+		if(!memcmp(p, "fmt ", 4) && size >= 16 && body + 16 <= end)
+		{
+			uint16_t format = readLe16(body);
+			// WAVE_FORMAT_EXTENSIBLE: the format is in the sub-format GUID
+			if(0xfffe == format && size >= 26 && body + 26 <= end)
+				format = readLe16(body + 24);
+			wav.nChannels = readLe16(body + 2);
+			wav.sampleRate = readLe32(body + 4);
+			bits = readLe16(body + 14);
+			wav.isFloat = 3 == format;
+			hasFormat = (1 == format && (16 == bits || 24 == bits || 32 == bits))
+				|| (3 == format && 32 == bits);
+		} else if(!memcmp(p, "data", 4)) {
+			wav.data = body;
+			// the size may be bogus for files that were not closed properly
+			uint64_t available = end - body;
+			wav.nFrames = std::min<uint64_t>(size, available);
+			break;
+		}
+		p = body + size + (size & 1);
+	}
+	if(!hasFormat || !wav.data || !wav.nChannels)
+	{
+		fprintf(stderr, "%s: unsupported WAV format\n", path);
+		closeWav(wav);
+		return false;
+	}
+	wav.bytesPerSample = bits / 8;
+	wav.nFrames /= wav.bytesPerSample * wav.nChannels;
+	return true;
+}
+
+// Deinterleave and convert `nFrames` frames from `start`, with silence
+// past the end of the file.
+static void readWav(struct wavInput const& wav, uint64_t start, unsigned int nFrames, std::vector<std::vector<float>>& channels)
+{
+	unsigned int nRead = start < wav.nFrames ? std::min<uint64_t>(nFrames, wav.nFrames - start) : 0;
+	unsigned int nChannels = wav.nChannels;
+	unsigned int bytes = wav.bytesPerSample;
+	const uint8_t* src = wav.data + start * nChannels * bytes;
+	for(unsigned int n = 0; n < nRead; ++n)
+	{
+		for(unsigned int ch = 0; ch < nChannels; ++ch)
+		{
+			float value;
+			if(wav.isFloat)
+				memcpy(&value, src, sizeof(value));
+			else if(2 == bytes)
+				value = (int16_t)readLe16(src) / 32768.f;
+			else if(3 == bytes)
+				value = (int32_t)((src[0] << 8) | (src[1] << 16) | ((uint32_t)src[2] << 24)) / 2147483648.f;
+			else
+				value = (int32_t)readLe32(src) / 2147483648.f;
+			channels[ch][n] = value;
+			src += bytes;
+		}
+	}
+	for(auto& channel : channels)
+		std::fill(channel.begin() + nRead, channel.begin() + nFrames, 0.f);
+}
+
+static void makeWavHeader(uint8_t* header, unsigned int nChannels, unsigned int sampleRate, unsigned int bits, uint64_t nFrames)
+{
+	unsigned int bytes = bits / 8;
+	uint64_t dataSize = nFrames * nChannels * bytes;
+	if(dataSize > UINT32_MAX - kWavHeaderSize)
+	{
+		fprintf(stderr, "Output larger than 4GiB: the header is truncated\n");
+		dataSize = (UINT32_MAX - kWavHeaderSize) / (nChannels * bytes) * (nChannels * bytes);
+	}
+	memcpy(header, "RIFF", 4);
+	writeLe32(header + 4, kWavHeaderSize - 8 + dataSize);
+	memcpy(header + 8, "WAVEfmt ", 8);
+	writeLe32(header + 16, 16);
+	writeLe16(header + 20, 32 == bits ? 3 : 1);
+	writeLe16(header + 22, nChannels);
+	writeLe32(header + 24, sampleRate);
+	writeLe32(header + 28, sampleRate * nChannels * bytes);
+	writeLe16(header + 32, nChannels * bytes);
+	writeLe16(header + 34, bits);
+	memcpy(header + 36, "data", 4);
+	writeLe32(header + 40, dataSize);
+}
+
+// Interleave and convert `nFrames` frames from `start` in each channel
+static void writeBlock(uint8_t* dst, std::vector<std::vector<float>> const& channels, unsigned int start, unsigned int nFrames, unsigned int bits)
+{
+	for(unsigned int n = start; n < start + nFrames; ++n)
+	{
+		for(auto& channel : channels)
+		{
+			float value = channel[n];
+			if(32 == bits)
+			{
+				memcpy(dst, &value, sizeof(value));
+				dst += 4;
+				continue;
+			}
+			value = std::min(1.f, std::max(-1.f, value));
+			if(16 == bits)
+			{
+				writeLe16(dst, (int16_t)lrintf(value * 32767.f));
+				dst += 2;
+			} else {
+				int32_t sample = lrintf(value * 8388607.f);
+				dst[0] = sample;
+				dst[1] = sample >> 8;
+				dst[2] = sample >> 16;
+				dst += 3;
+			}
+		}
+	}
+}
+
+// Writes the blocks filled by a worker to a file, on a thread of its own
+class fileWriter
+{
+public:
+	struct block {
+		std::vector<uint8_t> data;
+		size_t size;
+	};
+	fileWriter() :
+		file(nullptr),
+		failed(false)
+	{
+		sem_init(&full, 0, 0);
+		sem_init(&empty, 0, 0);
+		fullBlocks.setup(kWriteBlocks + 1);
+		emptyBlocks.setup(kWriteBlocks);
+	};
+	~fileWriter()
+	{
+		sem_destroy(&full);
+		sem_destroy(&empty);
+	};
+	bool start(FILE* file, size_t blockBytes)
+	{
+		this->file = file;
+		failed = false;
+		blocks.clear();
+		for(unsigned int n = 0; n < kWriteBlocks; ++n)
+		{
+			blocks.emplace_back(new struct block);
+			blocks.back()->data.resize(blockBytes);
+			emptyBlocks.push(blocks.back().get());
+			sem_post(&empty);
+		}
+		int ret = pthread_create(&thread, NULL, loop, this);
+		if(ret)
+		{
+			fprintf(stderr, "Unable to create the writer thread: %s\n", strerror(ret));
+			drain();
+			return false;
+		}
+		return true;
+	};
+	/// wait for an empty block
+	struct block* getBlock()
+	{
+		struct block* block;
+		sem_wait(&empty);
+		emptyBlocks.pop(block);
+		return block;
+	};
+	void write(struct block* block)
+	{
+		fullBlocks.push(block);
+		sem_post(&full);
+	};
+	/// write what's left and stop the thread
+	bool finish()
+	{
+		write(nullptr);
+		pthread_join(thread, NULL);
+		drain();
+		return !failed;
+	};
+
+private:
+	// take back all the empty blocks
+	void drain()
+	{
+		struct block* block;
+		while(sem_trywait(&empty) == 0)
+			emptyBlocks.pop(block);
+	};
+	static void* loop(void* arg)
+	{
+		fileWriter* that = (fileWriter*)arg;
+		while(1)
+		{
+			struct block* block;
+			sem_wait(&that->full);
+			that->fullBlocks.pop(block);
+			if(!block)
+				break;
+			if(!that->failed && fwrite(block->data.data(), 1, block->size, that->file) != block->size)
+			{
+				fprintf(stderr, "Error while writing: %s\n", strerror(errno));
+				that->failed = true;
+			}
+			that->emptyBlocks.push(block);
+			sem_post(&that->empty);
+		}
+		return NULL;
+	};
+	FILE* file;
+	pthread_t thread;
+	sem_t full;
+	sem_t empty;
+	RtQueue<struct block*> fullBlocks;
+	RtQueue<struct block*> emptyBlocks;
+	std::vector<std::unique_ptr<struct block>> blocks;
+	std::atomic<bool> failed;
+};
+
+struct OfflineRenderer::worker {
+	OfflineRenderer* that;
+	pthread_t thread;
+	// the chain is kept across files with the same format
+	std::unique_ptr<Lv2Host> host;
+	unsigned int sampleRate;
+	unsigned int nInputs;
+	unsigned int nOutputs;
+	std::vector<std::vector<float>> inputs;
+	std::vector<std::vector<float>> outputs;
+	// what is passed to render(): the buffers above
+	std::vector<const float*> inputPointers;
+	std::vector<float*> outputPointers;
+	fileWriter writer;
+};
+
+OfflineRenderer::OfflineRenderer() :
+	jobs(nullptr),
+	nextJob(0),
+	nFailed(0),
+	nFrames(0)
+{
+	getDefaultSettings(settings);
+	memset(&lastStats, 0, sizeof(lastStats));
+	pthread_mutex_init(&hostMutex, NULL);
+}
+
+OfflineRenderer::~OfflineRenderer()
+{
+	pthread_mutex_destroy(&hostMutex);
+}
+
+void OfflineRenderer::getDefaultSettings(struct settings& settings)
+{
+	settings.chain.clear();
+	settings.blockSize = kDefaultBlockSize;
+	settings.nThreads = 0;
+	settings.nOutputs = 0;
+	settings.outputBits = 32;
+	settings.compensateLatency = true;
+	settings.configure = nullptr;
+	settings.configureArg = nullptr;
+}
+
+bool OfflineRenderer::setup(struct settings const& settings)
+{
+	if(!settings.blockSize || (16 != settings.outputBits && 24 != settings.outputBits && 32 != settings.outputBits))
+		return false;
+	this->settings = settings;
+	if(!context)
+	{
+		context.reset(new Lv2HostContext);
+		if(!context->setup())
+		{
+			context.reset();
+			return false;
+		}
+	}
+	return true;
+}
+
+bool OfflineRenderer::process(std::vector<struct job> const& jobs)
+{
+	struct timespec begin, end;
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	this->jobs = &jobs;
+	nextJob = 0;
+	nFailed = 0;
+	nFrames = 0;
+	unsigned int nThreads = settings.nThreads;
+	if(!nThreads)
+		nThreads = std::max(1L, sysconf(_SC_NPROCESSORS_ONLN));
+	nThreads = std::min<unsigned int>(nThreads, jobs.size());
+	std::vector<std::unique_ptr<struct worker>> workers;
+	for(unsigned int n = 0; n < nThreads; ++n)
+	{
+		struct worker* worker = new struct worker;
+		worker->that = this;
+		worker->sampleRate = 0;
+		worker->nInputs = 0;
+		worker->nOutputs = 0;
+		int ret = pthread_create(&worker->thread, NULL, workerLoop, worker);
+		if(ret)
+		{
+			fprintf(stderr, "Unable to create worker thread %u: %s\n", n, strerror(ret));
+			delete worker;
+			break;
+		}
+		workers.emplace_back(worker);
+	}
+	// if no thread could be started, do it all here
+	if(workers.empty())
+	{
+		struct worker worker;
+		worker.that = this;
+		worker.sampleRate = worker.nInputs = worker.nOutputs = 0;
+		workerLoop(&worker);
+	}
+	for(auto& worker : workers)
+		pthread_join(worker->thread, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	lastStats.nFiles = jobs.size();
+	lastStats.nFailed = nFailed;
+	lastStats.nFrames = nFrames;
+	lastStats.seconds = (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) / 1e9;
+	return 0 == nFailed;
+}
+
+void* OfflineRenderer::workerLoop(void* arg)
+{
+	struct worker* worker = (struct worker*)arg;
+	OfflineRenderer* that = worker->that;
+	unsigned int n;
+	while((n = that->nextJob.fetch_add(1)) < that->jobs->size())
+	{
+		if(!that->renderFile(*worker, (*that->jobs)[n]))
+			++that->nFailed;
+	}
+	return NULL;
+}
+
+bool OfflineRenderer::renderFile(struct worker& worker, struct job const& job)
+{
+	struct wavInput wav;
+	if(!openWav(job.input.c_str(), wav))
+		return false;
+	unsigned int blockSize = settings.blockSize;
+	unsigned int nOutputs = settings.nOutputs ? settings.nOutputs : wav.nChannels;
+	if(worker.host && worker.sampleRate == wav.sampleRate && worker.nInputs == wav.nChannels && worker.nOutputs == nOutputs)
+	{
+		worker.host->reset();
+	} else {
+		worker.sampleRate = wav.sampleRate;
+		worker.nInputs = wav.nChannels;
+		worker.nOutputs = nOutputs;
+		worker.inputs.assign(wav.nChannels, std::vector<float>(blockSize));
+		worker.outputs.assign(nOutputs, std::vector<float>(blockSize));
+		worker.inputPointers.resize(wav.nChannels);
+		worker.outputPointers.resize(nOutputs);
+		for(unsigned int ch = 0; ch < wav.nChannels; ++ch)
+			worker.inputPointers[ch] = worker.inputs[ch].data();
+		for(unsigned int ch = 0; ch < nOutputs; ++ch)
+			worker.outputPointers[ch] = worker.outputs[ch].data();
+		bool ok = true;
+		pthread_mutex_lock(&hostMutex);
+		worker.host.reset(new Lv2Host);
+		if(context)
+			worker.host->setContext(context);
+		ok = worker.host->setup(wav.sampleRate, blockSize, wav.nChannels, nOutputs);
+		if(ok)
+		{
+			std::vector<int> slots = worker.host->addChain(settings.chain);
+			ok = std::find(slots.begin(), slots.end(), -1) == slots.end();
+		}
+		if(ok && settings.configure)
+			settings.configure(*worker.host, settings.configureArg);
+		pthread_mutex_unlock(&hostMutex);
+		if(!ok)
+		{
+			fprintf(stderr, "Unable to create the chain for %s\n", job.input.c_str());
+			worker.host.reset();
+			closeWav(wav);
+			return false;
+		}
+	}
+	FILE* file = fopen(job.output.c_str(), "wb");
+	if(!file)
+	{
+		fprintf(stderr, "Unable to open %s: %s\n", job.output.c_str(), strerror(errno));
+		closeWav(wav);
+		return false;
+	}
+	uint8_t header[kWavHeaderSize];
+	unsigned int bits = settings.outputBits;
+	makeWavHeader(header, nOutputs, wav.sampleRate, bits, 0);
+	fwrite(header, 1, sizeof(header), file);
+	size_t frameBytes = nOutputs * bits / 8;
+	if(!worker.writer.start(file, blockSize * frameBytes))
+	{
+		fclose(file);
+		closeWav(wav);
+		return false;
+	}
+
+	Lv2Host& host = *worker.host;
+	uint64_t nTotal = wav.nFrames;
+	unsigned int skip = 0;
+	for(uint64_t position = 0; position < nTotal; )
+	{
+		unsigned int nFrames = std::min<uint64_t>(blockSize, nTotal - position);
+		readWav(wav, position, nFrames, worker.inputs);
+		// outputs nothing is connected to are not written by render()
+		for(auto& output : worker.outputs)
+			std::fill(output.begin(), output.begin() + nFrames, 0.f);
+		host.render(nFrames, worker.inputPointers.data(), worker.outputPointers.data());
+		// plugins only report their latency once they have run
+		if(!position && settings.compensateLatency)
+		{
+			host.checkLatency();
+			unsigned int latency = host.getLatency();
+			nTotal += latency;
+			skip = latency;
+		}
+		position += nFrames;
+		unsigned int first = std::min(skip, nFrames);
+		skip -= first;
+		if(first == nFrames)
+			continue;
+		auto block = worker.writer.getBlock();
+		writeBlock(block->data.data(), worker.outputs, first, nFrames - first, bits);
+		block->size = (nFrames - first) * frameBytes;
+		worker.writer.write(block);
+	}
+	bool ok = worker.writer.finish();
+	makeWavHeader(header, nOutputs, wav.sampleRate, bits, wav.nFrames);
+	if(fseek(file, 0, SEEK_SET) || fwrite(header, 1, sizeof(header), file) != sizeof(header))
+		ok = false;
+	if(fclose(file))
+		ok = false;
+	nFrames += wav.nFrames;
+	closeWav(wav);
+	if(!ok)
+		fprintf(stderr, "Error while writing %s\n", job.output.c_str());
+	return ok;
+}
@@ -0,0 +1,85 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <memory>
+#include <atomic>
+#include <stdint.h>
+#include <pthread.h>
+
+class Lv2Host;
+class Lv2HostContext;
+
+/**
+ * Streams audio files through an Lv2Host chain as fast as the CPU allows.
+ *
+ * Files are processed concurrently: each worker thread has a chain of its
+ * own and processes one file at a time. The chains share one
+ * Lv2HostContext, so that the plugin data is only loaded once. Input files are memory-mapped and
+ * the output of each file is written to disk by a separate thread, so
+ * that the workers never wait on the disk.
+ *
+ * Input files are WAV with 16, 24 or 32-bit integer or 32-bit float
+ * samples. Output files are WAV.
+ */
+class OfflineRenderer
+{
+public:
+	struct job {
+		std::string input;
+		std::string output;
+	};
+	struct settings {
+		/// the URIs of the plugins, in chain order
+		std::vector<std::string> chain;
+		/// the number of frames processed by each call to render()
+		unsigned int blockSize;
+		/// the number of files processed concurrently. 0 uses one per CPU
+		unsigned int nThreads;
+		/// the number of output channels. 0 uses the number of input
+		/// channels of each file
+		unsigned int nOutputs;
+		/// the output format: 16 or 24 for integer, 32 for float samples
+		unsigned int outputBits;
+		/// drop the latency of the chain from the start of the output,
+		/// and render as much of the tail instead, so that the output
+		/// lines up with the input
+		bool compensateLatency;
+		/// if set, called on each new chain, e.g. to set its controls
+		void (*configure)(Lv2Host& host, void* arg);
+		void* configureArg;
+	};
+	struct stats {
+		unsigned int nFiles;
+		unsigned int nFailed;
+		/// frames read from the input files
+		uint64_t nFrames;
+		/// wall-clock time spent in process()
+		double seconds;
+	};
+	OfflineRenderer();
+	~OfflineRenderer();
+	/// fill `settings` with the defaults
+	static void getDefaultSettings(struct settings& settings);
+	bool setup(struct settings const& settings);
+	/**
+	 * Render all the jobs, and return when they are done.
+	 *
+	 * @return true if all of them succeeded
+	 */
+	bool process(std::vector<struct job> const& jobs);
+	struct stats getStats() { return lastStats; };
+
+private:
+	struct worker;
+	static void* workerLoop(void* arg);
+	bool renderFile(struct worker& worker, struct job const& job);
+	struct settings settings;
+	std::vector<struct job> const* jobs;
+	std::atomic<unsigned int> nextJob;
+	std::atomic<unsigned int> nFailed;
+	std::atomic<uint64_t> nFrames;
+	std::shared_ptr<Lv2HostContext> context;
+	// the chains are created one at a time
+	pthread_mutex_t hostMutex;
+	struct stats lastStats;
+};
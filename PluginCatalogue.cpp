@@ -0,0 +1,530 @@
+#include "PluginCatalogue.h"
+#include "lv2/lv2plug.in/ns/lv2core/lv2.h"
+#include "lv2/lv2plug.in/ns/ext/atom/atom.h"
+#include "lv2/lv2plug.in/ns/ext/presets/presets.h"
+#include <algorithm>
+#include <map>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static const char kMagic[8] = { 'L', 'V', '2', 'H', 'I', 'D', 'X', 0 };
+// 2: the bundles of a plugin include those of its presets
+static const uint32_t kVersion = 2;
+static const unsigned int kNumPortCounts = 6;
+
+// the layout of the index file. Offsets of strings are into the strings
+// at the end of the file.
+struct PluginCatalogue::header {
+	char magic[8];
+	uint32_t version;
+	uint32_t nBundles;
+	uint32_t nPlugins;
+	uint32_t nBundleRefs;
+	uint32_t stringsSize;
+	uint32_t reserved;
+};
+
+struct PluginCatalogue::bundleRecord {
+	int64_t mtime;
+	uint32_t path;
+	uint32_t reserved;
+};
+
+// sorted by URI
+struct PluginCatalogue::pluginRecord {
+	uint32_t uri;
+	uint32_t requiredFeatures;
+	// the bundles of the plugin, in the bundle references
+	uint32_t firstBundle;
+	uint32_t nBundles;
+	// audio, control and atom inputs and outputs
+	uint16_t ports[kNumPortCounts];
+	uint32_t reserved;
+};
+
+static double now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int64_t getMtime(struct stat const& st)
+{
+	return st.st_mtim.tv_sec * 1000000000ll + st.st_mtim.tv_nsec;
+}
+
+// the canonical path of a directory, with a trailing slash
+static bool getCanonicalDir(const char* path, std::string& dir)
+{
+	char resolved[PATH_MAX];
+	if(!realpath(path, resolved))
+		return false;
+	dir = resolved;
+	if(dir.empty() || dir.back() != '/')
+		dir += '/';
+	return true;
+}
+
+static bool makeDirs(std::string const& path)
+{
+	for(size_t n = path.find('/', 1); n != std::string::npos; n = path.find('/', n + 1))
+	{
+		std::string dir = path.substr(0, n);
+		if(mkdir(dir.c_str(), 0755) && errno != EEXIST)
+			return false;
+	}
+	return true;
+}
+
+std::string PluginCatalogue::getDefaultPath()
+{
+	const char* cache = getenv("XDG_CACHE_HOME");
+	std::string dir;
+	if(cache && cache[0])
+		dir = cache;
+	else if(getenv("HOME"))
+		dir = std::string(getenv("HOME")) + "/.cache";
+	else
+		return "";
+	return dir + "/lv2host/catalogue";
+}
+
+// List the bundles lilv would load: the directories with a manifest in
+// each directory of LV2_PATH. A bundle is modified when any of its files
+// is, or when files are added to or removed from it.
+void PluginCatalogue::scanBundles(std::vector<struct bundle>& bundles)
+{
+	bundles.clear();
+	const char* lv2Path = getenv("LV2_PATH");
+	std::string paths = lv2Path ? lv2Path : "~/.lv2:/usr/local/lib/lv2:/usr/lib/lv2";
+	size_t start = 0;
+	while(start <= paths.size())
+	{
+		size_t end = paths.find(':', start);
+		if(end == std::string::npos)
+			end = paths.size();
+		std::string dir = paths.substr(start, end - start);
+		start = end + 1;
+		if(dir.empty())
+			continue;
+		if('~' == dir[0] && getenv("HOME"))
+			dir = getenv("HOME") + dir.substr(1);
+		DIR* d = opendir(dir.c_str());
+		if(!d)
+			continue;
+		while(struct dirent* entry = readdir(d))
+		{
+			if('.' == entry->d_name[0])
+				continue;
+			std::string bundlePath = dir + "/" + entry->d_name;
+			struct stat st;
+			if(stat((bundlePath + "/manifest.ttl").c_str(), &st))
+				continue;
+			struct bundle bundle;
+			if(!getCanonicalDir(bundlePath.c_str(), bundle.path))
+				continue;
+			if(stat(bundle.path.c_str(), &st))
+				continue;
+			bundle.mtime = getMtime(st);
+			if(DIR* b = opendir(bundle.path.c_str()))
+			{
+				while(struct dirent* file = readdir(b))
+				{
+					if('.' == file->d_name[0])
+						continue;
+					if(!stat((bundle.path + file->d_name).c_str(), &st))
+						bundle.mtime = std::max(bundle.mtime, getMtime(st));
+				}
+				closedir(b);
+			}
+			bundles.push_back(bundle);
+		}
+		closedir(d);
+	}
+	std::sort(bundles.begin(), bundles.end(), [](struct bundle const& a, struct bundle const& b) {
+		return a.path < b.path;
+	});
+	// the same bundle may be reachable from more than one directory
+	bundles.erase(std::unique(bundles.begin(), bundles.end(), [](struct bundle const& a, struct bundle const& b) {
+		return a.path == b.path;
+	}), bundles.end());
+}
+
+bool PluginCatalogue::setup(LilvWorld* world, std::string const& path)
+{
+	cleanup();
+	if(!world)
+		return false;
+	this->world = world;
+	memset(&catalogueStats, 0, sizeof(catalogueStats));
+	double start = now();
+	std::string indexPath = path.empty() ? getDefaultPath() : path;
+	std::vector<struct bundle> bundles;
+	scanBundles(bundles);
+	if(!indexPath.empty() && open(indexPath, bundles))
+	{
+		catalogueStats.fromIndex = true;
+	} else {
+		lilv_world_load_all(world);
+		loadedAll = true;
+		if(!indexPath.empty() && write(indexPath, bundles))
+			open(indexPath, bundles);
+	}
+	if(indexHeader)
+	{
+		catalogueStats.nPlugins = indexHeader->nPlugins;
+		catalogueStats.nBundles = indexHeader->nBundles;
+		loadedBundles.assign(indexHeader->nBundles, false);
+	}
+	catalogueStats.setupSeconds = now() - start;
+	return true;
+}
+
+void PluginCatalogue::cleanup()
+{
+	unmap();
+	loadedBundles.clear();
+	loadedAll = false;
+	world = nullptr;
+}
+
+void PluginCatalogue::unmap()
+{
+	if(mapped)
+		munmap((void*)mapped, mappedSize);
+	mapped = nullptr;
+	mappedSize = 0;
+	indexHeader = nullptr;
+	bundleRecords = nullptr;
+	pluginRecords = nullptr;
+	bundleRefs = nullptr;
+	strings = nullptr;
+}
+
+// Map the index and check that it is well-formed and that it describes
+// `bundles` as they are now.
+bool PluginCatalogue::open(std::string const& path, std::vector<struct bundle> const& bundles)
+{
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if(fd < 0)
+		return false;
+	struct stat st;
+	if(fstat(fd, &st) || (size_t)st.st_size < sizeof(struct header))
+	{
+		close(fd);
+		return false;
+	}
+	void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(MAP_FAILED == map)
+		return false;
+	mapped = (const char*)map;
+	mappedSize = st.st_size;
+	const struct header* h = (const struct header*)mapped;
+	bool valid = !memcmp(h->magic, kMagic, sizeof(kMagic)) && kVersion == h->version
+		&& h->nBundles == bundles.size() && h->stringsSize > 0;
+	size_t size = sizeof(*h) + h->nBundles * sizeof(struct bundleRecord)
+		+ h->nPlugins * sizeof(struct pluginRecord)
+		+ h->nBundleRefs * sizeof(uint32_t) + h->stringsSize;
+	valid = valid && size == mappedSize;
+	if(valid)
+	{
+		bundleRecords = (const struct bundleRecord*)(h + 1);
+		pluginRecords = (const struct pluginRecord*)(bundleRecords + h->nBundles);
+		bundleRefs = (const uint32_t*)(pluginRecords + h->nPlugins);
+		strings = (const char*)(bundleRefs + h->nBundleRefs);
+		valid = '\0' == strings[h->stringsSize - 1];
+	}
+	for(unsigned int n = 0; valid && n < h->nBundles; ++n)
+	{
+		auto& record = bundleRecords[n];
+		valid = record.path < h->stringsSize && record.mtime == bundles[n].mtime
+			&& bundles[n].path == strings + record.path;
+	}
+	for(unsigned int n = 0; valid && n < h->nPlugins; ++n)
+	{
+		auto& record = pluginRecords[n];
+		valid = record.uri < h->stringsSize && record.requiredFeatures < h->stringsSize
+			&& record.firstBundle <= h->nBundleRefs
+			&& record.nBundles <= h->nBundleRefs - record.firstBundle;
+	}
+	for(unsigned int n = 0; valid && n < h->nBundleRefs; ++n)
+		valid = bundleRefs[n] < h->nBundles;
+	if(!valid)
+	{
+		unmap();
+		return false;
+	}
+	indexHeader = h;
+	return true;
+}
+
+// Write an index of all the plugins in the world, which has all of
+// `bundles` loaded.
+bool PluginCatalogue::write(std::string const& path, std::vector<struct bundle> const& bundles)
+{
+	struct entry {
+		std::string uri;
+		std::string requiredFeatures;
+		std::vector<uint32_t> bundles;
+		uint16_t ports[kNumPortCounts];
+	};
+	std::map<std::string, uint32_t> bundleIndices;
+	for(unsigned int n = 0; n < bundles.size(); ++n)
+		bundleIndices[bundles[n].path] = n;
+	LilvNode* lv2_InputPort = lilv_new_uri(world, LV2_CORE__InputPort);
+	LilvNode* lv2_OutputPort = lilv_new_uri(world, LV2_CORE__OutputPort);
+	LilvNode* lv2_AudioPort = lilv_new_uri(world, LV2_CORE__AudioPort);
+	LilvNode* lv2_ControlPort = lilv_new_uri(world, LV2_CORE__ControlPort);
+	LilvNode* atom_AtomPort = lilv_new_uri(world, LV2_ATOM__AtomPort);
+	LilvNode* pset_Preset = lilv_new_uri(world, LV2_PRESETS__Preset);
+	LilvNode* rdfs_seeAlso = lilv_new_uri(world, LILV_NS_RDFS "seeAlso");
+	const LilvNode* portClasses[] = { lv2_AudioPort, lv2_ControlPort, atom_AtomPort };
+	std::vector<struct entry> entries;
+	bool ok = true;
+	const LilvPlugins* plugins = lilv_world_get_all_plugins(world);
+	LILV_FOREACH(plugins, it, plugins)
+	{
+		const LilvPlugin* plugin = lilv_plugins_get(plugins, it);
+		struct entry entry;
+		entry.uri = lilv_node_as_uri(lilv_plugin_get_uri(plugin));
+		for(unsigned int n = 0; n < kNumPortCounts; ++n)
+		{
+			entry.ports[n] = lilv_plugin_get_num_ports_of_class(plugin, portClasses[n / 2],
+				n % 2 ? lv2_OutputPort : lv2_InputPort, NULL);
+		}
+		LilvNodes* features = lilv_plugin_get_required_features(plugin);
+		LILV_FOREACH(nodes, f, features)
+		{
+			entry.requiredFeatures += lilv_node_as_uri(lilv_nodes_get(features, f));
+			entry.requiredFeatures += '\n';
+		}
+		lilv_nodes_free(features);
+		// the bundle of the plugin, and those of all its data files
+		std::vector<std::string> uris(1, lilv_node_as_uri(lilv_plugin_get_bundle_uri(plugin)));
+		const LilvNodes* dataUris = lilv_plugin_get_data_uris(plugin);
+		LILV_FOREACH(nodes, d, dataUris)
+			uris.push_back(lilv_node_as_uri(lilv_nodes_get(dataUris, d)));
+		for(unsigned int n = 0; n < uris.size() && ok; ++n)
+		{
+			char* filePath = lilv_file_uri_parse(uris[n].c_str(), NULL);
+			std::string dir;
+			if(filePath)
+			{
+				std::string name = filePath;
+				// data files are in their bundle, which ends with a slash
+				if(n > 0)
+					name = name.substr(0, name.rfind('/') + 1);
+				ok = getCanonicalDir(name.c_str(), dir);
+				lilv_free(filePath);
+			} else {
+				ok = false;
+			}
+			auto found = bundleIndices.find(dir);
+			if(!ok || found == bundleIndices.end())
+			{
+				fprintf(stderr, "PluginCatalogue: %s is not in a bundle on LV2_PATH, not writing an index\n", uris[n].c_str());
+				ok = false;
+				break;
+			}
+			if(std::find(entry.bundles.begin(), entry.bundles.end(), found->second) == entry.bundles.end())
+				entry.bundles.push_back(found->second);
+		}
+		if(!ok)
+			break;
+		// the bundles of its presets, which point at the plugin with
+		// lv2:appliesTo: either the one of the preset itself, or those
+		// of its rdfs:seeAlso files. Presets outside of LV2_PATH cannot
+		// be loaded by bundle, and are left out.
+		LilvNodes* presets = lilv_plugin_get_related(plugin, pset_Preset);
+		LILV_FOREACH(nodes, p, presets)
+		{
+			const LilvNode* preset = lilv_nodes_get(presets, p);
+			std::vector<std::string> files(1, lilv_node_as_uri(preset));
+			LilvNodes* seeAlso = lilv_world_find_nodes(world, preset, rdfs_seeAlso, NULL);
+			LILV_FOREACH(nodes, f, seeAlso)
+			{
+				const LilvNode* file = lilv_nodes_get(seeAlso, f);
+				if(lilv_node_is_uri(file))
+					files.push_back(lilv_node_as_uri(file));
+			}
+			lilv_nodes_free(seeAlso);
+			for(auto& file : files)
+			{
+				if(file.compare(0, 7, "file://"))
+					continue;
+				char* filePath = lilv_file_uri_parse(file.c_str(), NULL);
+				if(!filePath)
+					continue;
+				std::string name = filePath;
+				lilv_free(filePath);
+				std::string dir;
+				if(!getCanonicalDir(name.substr(0, name.rfind('/') + 1).c_str(), dir))
+					continue;
+				auto found = bundleIndices.find(dir);
+				if(found != bundleIndices.end()
+					&& std::find(entry.bundles.begin(), entry.bundles.end(), found->second) == entry.bundles.end())
+					entry.bundles.push_back(found->second);
+			}
+		}
+		lilv_nodes_free(presets);
+		entries.push_back(entry);
+	}
+	lilv_node_free(rdfs_seeAlso);
+	lilv_node_free(pset_Preset);
+	lilv_node_free(atom_AtomPort);
+	lilv_node_free(lv2_ControlPort);
+	lilv_node_free(lv2_AudioPort);
+	lilv_node_free(lv2_OutputPort);
+	lilv_node_free(lv2_InputPort);
+	if(!ok)
+		return false;
+	std::sort(entries.begin(), entries.end(), [](struct entry const& a, struct entry const& b) {
+		return strcmp(a.uri.c_str(), b.uri.c_str()) < 0;
+	});
+
+	std::string stringData;
+	auto addString = [&stringData](std::string const& str) {
+		uint32_t offset = stringData.size();
+		stringData.append(str.c_str(), str.size() + 1);
+		return offset;
+	};
+	std::vector<struct bundleRecord> bundleData(bundles.size());
+	for(unsigned int n = 0; n < bundles.size(); ++n)
+	{
+		bundleData[n].mtime = bundles[n].mtime;
+		bundleData[n].path = addString(bundles[n].path);
+		bundleData[n].reserved = 0;
+	}
+	std::vector<struct pluginRecord> pluginData(entries.size());
+	std::vector<uint32_t> refData;
+	for(unsigned int n = 0; n < entries.size(); ++n)
+	{
+		auto& record = pluginData[n];
+		record.uri = addString(entries[n].uri);
+		record.requiredFeatures = addString(entries[n].requiredFeatures);
+		record.firstBundle = refData.size();
+		record.nBundles = entries[n].bundles.size();
+		memcpy(record.ports, entries[n].ports, sizeof(record.ports));
+		record.reserved = 0;
+		refData.insert(refData.end(), entries[n].bundles.begin(), entries[n].bundles.end());
+	}
+	struct header h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, kMagic, sizeof(kMagic));
+	h.version = kVersion;
+	h.nBundles = bundleData.size();
+	h.nPlugins = pluginData.size();
+	h.nBundleRefs = refData.size();
+	h.stringsSize = stringData.size();
+
+	// write to a temporary file and move it in place, so that a
+	// concurrent reader never sees a partial index
+	if(!makeDirs(path))
+		return false;
+	std::string tmpPath = path + ".XXXXXX";
+	int fd = mkstemp(&tmpPath[0]);
+	if(fd < 0)
+	{
+		fprintf(stderr, "PluginCatalogue: unable to write %s\n", path.c_str());
+		return false;
+	}
+	FILE* file = fdopen(fd, "wb");
+	ok = file
+		&& 1 == fwrite(&h, sizeof(h), 1, file)
+		&& bundleData.size() == fwrite(bundleData.data(), sizeof(bundleData[0]), bundleData.size(), file)
+		&& pluginData.size() == fwrite(pluginData.data(), sizeof(pluginData[0]), pluginData.size(), file)
+		&& refData.size() == fwrite(refData.data(), sizeof(refData[0]), refData.size(), file)
+		&& 1 == fwrite(stringData.data(), stringData.size(), 1, file);
+	if(file)
+		ok = !fclose(file) && ok;
+	else
+		close(fd);
+	if(!ok || rename(tmpPath.c_str(), path.c_str()))
+	{
+		fprintf(stderr, "PluginCatalogue: unable to write %s\n", path.c_str());
+		unlink(tmpPath.c_str());
+		return false;
+	}
+	return true;
+}
+
+struct PluginCatalogue::plugin PluginCatalogue::getPlugin(uint32_t n)
+{
+	auto& record = pluginRecords[n];
+	struct plugin plugin;
+	plugin.uri = strings + record.uri;
+	plugin.nAudioInputs = record.ports[0];
+	plugin.nAudioOutputs = record.ports[1];
+	plugin.nControlInputs = record.ports[2];
+	plugin.nControlOutputs = record.ports[3];
+	plugin.nAtomInputs = record.ports[4];
+	plugin.nAtomOutputs = record.ports[5];
+	plugin.requiredFeatures = strings + record.requiredFeatures;
+	plugin.nBundles = record.nBundles;
+	plugin.bundles = bundleRefs + record.firstBundle;
+	return plugin;
+}
+
+bool PluginCatalogue::find(const char* uri, struct plugin& plugin)
+{
+	if(!indexHeader)
+		return false;
+	uint32_t begin = 0;
+	uint32_t end = indexHeader->nPlugins;
+	while(begin < end)
+	{
+		uint32_t middle = begin + (end - begin) / 2;
+		int diff = strcmp(uri, strings + pluginRecords[middle].uri);
+		if(0 == diff)
+		{
+			plugin = getPlugin(middle);
+			return true;
+		}
+		if(diff < 0)
+			end = middle;
+		else
+			begin = middle + 1;
+	}
+	return false;
+}
+
+const char* PluginCatalogue::getBundlePath(uint32_t n)
+{
+	if(!indexHeader || n >= indexHeader->nBundles)
+		return nullptr;
+	return strings + bundleRecords[n].path;
+}
+
+bool PluginCatalogue::load(const char* uri)
+{
+	if(loadedAll)
+		return true;
+	struct plugin plugin;
+	if(!find(uri, plugin))
+		return false;
+	double start = now();
+	for(unsigned int n = 0; n < plugin.nBundles; ++n)
+	{
+		uint32_t b = plugin.bundles[n];
+		if(loadedBundles[b])
+			continue;
+		LilvNode* bundleUri = lilv_new_file_uri(world, NULL, getBundlePath(b));
+		lilv_world_load_bundle(world, bundleUri);
+		lilv_node_free(bundleUri);
+		loadedBundles[b] = true;
+		++catalogueStats.nLoadedBundles;
+	}
+	catalogueStats.loadSeconds += now() - start;
+	return true;
+}
@@ -0,0 +1,98 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <stdint.h>
+#include <lilv-0/lilv/lilv.h>
+
+/**
+ * An index of the LV2 plugins installed on LV2_PATH, kept on disk, so
+ * that a LilvWorld only needs to load the bundles of the plugins that are
+ * actually used, instead of parsing every bundle at every start.
+ *
+ * The index maps each plugin URI to the bundles its data and its presets
+ * live in, its port layout and its required features. It is memory-mapped, and
+ * rebuilt whenever a bundle is added, removed or modified since it was
+ * written.
+ */
+class PluginCatalogue
+{
+public:
+	struct plugin {
+		const char* uri;
+		unsigned int nAudioInputs;
+		unsigned int nAudioOutputs;
+		unsigned int nControlInputs;
+		unsigned int nControlOutputs;
+		unsigned int nAtomInputs;
+		unsigned int nAtomOutputs;
+		/// the URIs of the features the plugin requires, one per line
+		const char* requiredFeatures;
+		/// the bundles of the plugin, of its data files and of its presets
+		unsigned int nBundles;
+		const uint32_t* bundles;
+	};
+	struct stats {
+		/// the index was up to date, and the world was not loaded in full
+		bool fromIndex;
+		unsigned int nPlugins;
+		unsigned int nBundles;
+		/// bundles loaded into the world by load()
+		unsigned int nLoadedBundles;
+		/// time taken by setup(): checking the index against the bundles,
+		/// or loading the whole world and rebuilding the index
+		double setupSeconds;
+		/// time spent loading bundles in load()
+		double loadSeconds;
+	};
+	PluginCatalogue() {};
+	~PluginCatalogue() { cleanup(); };
+	/**
+	 * Open the index, or rebuild it if it is missing or out of date. In
+	 * the latter case, all the bundles are loaded into `world`.
+	 *
+	 * @param path where the index is kept. If empty, this is
+	 * lv2host/catalogue in the user's cache directory.
+	 */
+	bool setup(LilvWorld* world, std::string const& path = "");
+	void cleanup();
+	/// find a plugin by URI
+	bool find(const char* uri, struct plugin& plugin);
+	/// the path of the `n`-th bundle of the index
+	const char* getBundlePath(uint32_t n);
+	/**
+	 * Load the bundles needed by a plugin into the world, including those
+	 * of its presets, if they are not loaded yet.
+	 *
+	 * @return false if the plugin is not installed
+	 */
+	bool load(const char* uri);
+	struct stats getStats() { return catalogueStats; };
+	/// the default location of the index
+	static std::string getDefaultPath();
+
+private:
+	struct bundle {
+		std::string path;
+		int64_t mtime;
+	};
+	struct header;
+	struct bundleRecord;
+	struct pluginRecord;
+	static void scanBundles(std::vector<struct bundle>& bundles);
+	bool open(std::string const& path, std::vector<struct bundle> const& bundles);
+	bool write(std::string const& path, std::vector<struct bundle> const& bundles);
+	void unmap();
+	struct plugin getPlugin(uint32_t n);
+	LilvWorld* world = nullptr;
+	const char* mapped = nullptr;
+	size_t mappedSize = 0;
+	const struct header* indexHeader = nullptr;
+	const struct bundleRecord* bundleRecords = nullptr;
+	const struct pluginRecord* pluginRecords = nullptr;
+	const uint32_t* bundleRefs = nullptr;
+	const char* strings = nullptr;
+	std::vector<bool> loadedBundles;
+	// the index could not be used: the world has all the bundles
+	bool loadedAll = false;
+	struct stats catalogueStats;
+};
@@ -0,0 +1,126 @@
+#include "RtArena.h"
+#include <algorithm>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+
+static const size_t kHugePageSize = 2 * 1024 * 1024;
+
+RtArena::RtArena() :
+	memory(nullptr),
+	mappedSize(0)
+{
+	memset(&arenaStats, 0, sizeof(arenaStats));
+}
+
+bool RtArena::setup(size_t size, bool hugePages, bool lock)
+{
+	cleanup();
+	size = (size + kAlignment - 1) / kAlignment * kAlignment;
+	void* ptr = MAP_FAILED;
+#ifdef MAP_HUGETLB
+	if(hugePages)
+	{
+		mappedSize = (size + kHugePageSize - 1) / kHugePageSize * kHugePageSize;
+		ptr = mmap(NULL, mappedSize, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if(MAP_FAILED == ptr)
+			fprintf(stderr, "Unable to allocate the arena on huge pages: %s. Using normal pages\n", strerror(errno));
+		else
+			arenaStats.hugePages = true;
+	}
+#endif /* MAP_HUGETLB */
+	if(MAP_FAILED == ptr)
+	{
+		mappedSize = size;
+		ptr = mmap(NULL, mappedSize, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if(MAP_FAILED == ptr)
+		{
+			fprintf(stderr, "Unable to allocate the arena: %s\n", strerror(errno));
+			mappedSize = 0;
+			return false;
+		}
+#ifdef MADV_HUGEPAGE
+		// transparent huge pages, if the kernel has them
+		if(hugePages)
+			madvise(ptr, mappedSize, MADV_HUGEPAGE);
+#endif /* MADV_HUGEPAGE */
+	}
+	memory = (char*)ptr;
+	if(lock)
+	{
+		if(mlock(memory, mappedSize))
+			fprintf(stderr, "Unable to lock the arena in memory: %s\n", strerror(errno));
+		else
+			arenaStats.locked = true;
+	}
+	arenaStats.capacity = size;
+	return true;
+}
+
+void RtArena::cleanup()
+{
+	if(memory)
+	{
+		if(arenaStats.locked)
+			munlock(memory, mappedSize);
+		munmap(memory, mappedSize);
+	}
+	memory = nullptr;
+	mappedSize = 0;
+	memset(&arenaStats, 0, sizeof(arenaStats));
+	blockSizes.clear();
+	freeBlocks.clear();
+}
+
+void* RtArena::allocate(size_t size)
+{
+	// empty blocks take up room too, so that no two blocks share an
+	// address
+	size = std::max<size_t>(1, size);
+	size = (size + kAlignment - 1) / kAlignment * kAlignment;
+	auto it = freeBlocks.find(size);
+	if(it != freeBlocks.end() && !it->second.empty())
+	{
+		void* ptr = it->second.back();
+		it->second.pop_back();
+		blockSizes[ptr] = size;
+		arenaStats.released -= size;
+		++arenaStats.nReused;
+		++arenaStats.nAllocations;
+		memset(ptr, 0, size);
+		return ptr;
+	}
+	if(!memory || arenaStats.capacity - arenaStats.used < size)
+	{
+		++arenaStats.nFailed;
+		return nullptr;
+	}
+	// anonymous mappings are zero-filled, so new memory does not need
+	// to be cleared
+	void* ptr = memory + arenaStats.used;
+	arenaStats.used += size;
+	++arenaStats.nAllocations;
+	blockSizes[ptr] = size;
+	return ptr;
+}
+
+void RtArena::release(void* ptr)
+{
+	auto it = blockSizes.find(ptr);
+	if(it == blockSizes.end())
+	{
+		fprintf(stderr, "RtArena: %p was not allocated, or was already released\n", ptr);
+		return;
+	}
+	freeBlocks[it->second].push_back(ptr);
+	arenaStats.released += it->second;
+	blockSizes.erase(it);
+}
+
+bool RtArena::contains(const void* ptr)
+{
+	return memory && (const char*)ptr >= memory && (const char*)ptr < memory + mappedSize;
+}
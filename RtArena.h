@@ -0,0 +1,68 @@
+#pragma once
+#include <stddef.h>
+#include <map>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * A block of memory reserved up front, from which aligned allocations are
+ * carved out sequentially. A block given back with release() is only
+ * handed out again for an allocation of the same size, rounded up to the
+ * alignment, so that what is replaced again and again (port tables, event
+ * buffers, ...) does not use up the arena, while anything else does.
+ *
+ * allocate() and release() are not thread-safe.
+ */
+class RtArena
+{
+public:
+	/// alignment of all allocations: a cache line, and enough for any SIMD type
+	static const size_t kAlignment = 64;
+	struct stats {
+		size_t capacity;
+		size_t used;
+		unsigned int nAllocations;
+		/// allocations that did not fit
+		unsigned int nFailed;
+		/// allocations served with a released block
+		unsigned int nReused;
+		/// bytes in released blocks, waiting to be reused
+		size_t released;
+		bool hugePages;
+		bool locked;
+	};
+	RtArena();
+	~RtArena() { cleanup(); };
+	/**
+	 * Reserve the memory, releasing any previous one.
+	 *
+	 * @param size the capacity in bytes
+	 * @param hugePages try to back the arena with huge pages. If these
+	 * are not available, normal pages are used.
+	 * @param lock lock the arena in RAM, so that it cannot be paged out
+	 */
+	bool setup(size_t size, bool hugePages, bool lock);
+	void cleanup();
+	/**
+	 * @return a zeroed, aligned block of `size` bytes, or NULL if there
+	 * is not enough room left. Each block has an address of its own,
+	 * even if `size` is 0.
+	 */
+	void* allocate(size_t size);
+	/**
+	 * Give back a block returned by allocate(), so that it can be reused.
+	 * Pointers that are not in use are ignored.
+	 */
+	void release(void* ptr);
+	/// whether `ptr` was returned by allocate()
+	bool contains(const void* ptr);
+	struct stats getStats() { return arenaStats; };
+
+private:
+	char* memory;
+	size_t mappedSize;
+	struct stats arenaStats;
+	// the size of each block in use, and the released blocks by size
+	std::unordered_map<const void*, size_t> blockSizes;
+	std::map<size_t, std::vector<void*>> freeBlocks;
+};
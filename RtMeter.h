@@ -0,0 +1,189 @@
+#pragma once
+#include <atomic>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
+/**
+ * Peak and RMS level of an audio signal, e.g.: an output of a slot of an
+ * Lv2Host, measured over windows of a fixed number of frames.
+ *
+ * process() is wait-free and does not allocate. Only one thread at a time
+ * may call it. At the end of each window, the levels are published
+ * through a sequence lock: getSnapshot() can be called from any thread at
+ * any time without ever holding up process(), and returns the levels of
+ * one whole window.
+ */
+class RtMeter
+{
+public:
+	struct snapshot {
+		/// the largest absolute sample value in the last window
+		float peak;
+		/// the RMS level of the last window
+		float rms;
+		/// the samples whose absolute value was 1 or more, since the
+		/// meter was created or cleared
+		uint64_t clips;
+		/// the number of windows measured
+		uint64_t count;
+	};
+	RtMeter() { clear(); };
+	/// Set the length of the windows. Not safe to call concurrently with process().
+	void setWindow(unsigned int frames)
+	{
+		windowFrames = frames ? frames : 1;
+	};
+	/// measure a block. Call this from one thread at a time.
+	void process(const float* buffer, unsigned int nFrames)
+	{
+		while(nFrames)
+		{
+			unsigned int n = windowFrames - frames;
+			if(n > nFrames)
+				n = nFrames;
+			float sumSquares;
+			measure(buffer, n, peak, sumSquares, clips);
+			sum += sumSquares;
+			frames += n;
+			buffer += n;
+			nFrames -= n;
+			if(frames == windowFrames)
+				publish();
+		}
+	};
+	/// forget everything measured so far. Same as for process().
+	void clear()
+	{
+		peak = 0;
+		sum = 0;
+		frames = 0;
+		clips = 0;
+		windows = 0;
+		sequence.store(sequence.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		publishedPeak.store(0, std::memory_order_relaxed);
+		publishedRms.store(0, std::memory_order_relaxed);
+		publishedClips.store(0, std::memory_order_relaxed);
+		publishedCount.store(0, std::memory_order_relaxed);
+		sequence.store(sequence.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	};
+	void getSnapshot(struct snapshot& snapshot) const
+	{
+		uint32_t before;
+		uint32_t after;
+		do {
+			// odd while a window is being published
+			before = sequence.load(std::memory_order_acquire);
+			snapshot.peak = publishedPeak.load(std::memory_order_relaxed);
+			snapshot.rms = publishedRms.load(std::memory_order_relaxed);
+			snapshot.clips = publishedClips.load(std::memory_order_relaxed);
+			snapshot.count = publishedCount.load(std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_acquire);
+			after = sequence.load(std::memory_order_relaxed);
+		} while((before & 1) || before != after);
+	};
+
+private:
+	/**
+	 * peak = max(peak, |buffer[n]|), sumSquares = sum of buffer[n]^2,
+	 * clips += the number of |buffer[n]| >= 1. Vectorised with NEON or
+	 * SSE when available.
+	 */
+	static void measure(const float* buffer, unsigned int nFrames, float& peak, float& sumSquares, uint64_t& clips)
+	{
+		unsigned int n = 0;
+		float p = peak;
+		float s = 0;
+		uint64_t c = 0;
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+		if(nFrames >= 4)
+		{
+			float32x4_t vp = vdupq_n_f32(0);
+			float32x4_t vs = vdupq_n_f32(0);
+			uint32x4_t vc = vdupq_n_u32(0);
+			const float32x4_t one = vdupq_n_f32(1);
+			for(; n + 4 <= nFrames; n += 4)
+			{
+				float32x4_t x = vld1q_f32(buffer + n);
+				float32x4_t a = vabsq_f32(x);
+				vp = vmaxq_f32(vp, a);
+				vs = vmlaq_f32(vs, x, x);
+				// the comparison gives all ones, i.e.: -1
+				vc = vsubq_u32(vc, vcgeq_f32(a, one));
+			}
+			float32x2_t p2 = vpmax_f32(vget_low_f32(vp), vget_high_f32(vp));
+			p2 = vpmax_f32(p2, p2);
+			p = fmaxf(p, vget_lane_f32(p2, 0));
+			float32x2_t s2 = vadd_f32(vget_low_f32(vs), vget_high_f32(vs));
+			s = vget_lane_f32(vpadd_f32(s2, s2), 0);
+			uint32x2_t c2 = vadd_u32(vget_low_u32(vc), vget_high_u32(vc));
+			c = vget_lane_u32(vpadd_u32(c2, c2), 0);
+		}
+#elif defined(__SSE__)
+		if(nFrames >= 4)
+		{
+			__m128 vp = _mm_setzero_ps();
+			__m128 vs = _mm_setzero_ps();
+			const __m128 sign = _mm_set1_ps(-0.f);
+			const __m128 one = _mm_set1_ps(1);
+			for(; n + 4 <= nFrames; n += 4)
+			{
+				__m128 x = _mm_loadu_ps(buffer + n);
+				__m128 a = _mm_andnot_ps(sign, x);
+				vp = _mm_max_ps(vp, a);
+				vs = _mm_add_ps(vs, _mm_mul_ps(x, x));
+				c += __builtin_popcount(_mm_movemask_ps(_mm_cmpge_ps(a, one)));
+			}
+			float lanes[4];
+			_mm_storeu_ps(lanes, vp);
+			p = fmaxf(p, fmaxf(fmaxf(lanes[0], lanes[1]), fmaxf(lanes[2], lanes[3])));
+			_mm_storeu_ps(lanes, vs);
+			s = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+		}
+#endif
+		for(; n < nFrames; ++n)
+		{
+			float a = fabsf(buffer[n]);
+			p = fmaxf(p, a);
+			s += buffer[n] * buffer[n];
+			c += a >= 1;
+		}
+		peak = p;
+		sumSquares = s;
+		clips += c;
+	};
+	// called by the writer at the end of each window
+	void publish()
+	{
+		++windows;
+		sequence.store(sequence.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		publishedPeak.store(peak, std::memory_order_relaxed);
+		publishedRms.store(sqrtf(sum / frames), std::memory_order_relaxed);
+		publishedClips.store(clips, std::memory_order_relaxed);
+		publishedCount.store(windows, std::memory_order_relaxed);
+		sequence.store(sequence.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+		peak = 0;
+		sum = 0;
+		frames = 0;
+	};
+	// the window being measured, only used by the writer
+	unsigned int windowFrames = 2048;
+	unsigned int frames;
+	float peak;
+	double sum;
+	uint64_t clips;
+	uint64_t windows;
+	// the last window
+	std::atomic<uint32_t> sequence{0};
+	std::atomic<float> publishedPeak;
+	std::atomic<float> publishedRms;
+	std::atomic<uint64_t> publishedClips;
+	std::atomic<uint64_t> publishedCount;
+};
@@ -0,0 +1,136 @@
+#pragma once
+#include <atomic>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+/**
+ * Timing statistics of something that runs periodically, e.g.: a slot of
+ * an Lv2Host in each block.
+ *
+ * record() is wait-free and does not allocate. Only one thread at a time
+ * may call it. getSnapshot() can be called from any thread at any time:
+ * the values it returns are each up to date, but they may be from
+ * slightly different points in time.
+ *
+ * Durations are kept in a histogram with 8 buckets per power of two, so
+ * that percentiles are accurate to 12.5%.
+ */
+class RtProfile
+{
+public:
+	struct snapshot {
+		/// the number of durations recorded
+		uint64_t count;
+		uint64_t minNs;
+		uint64_t maxNs;
+		double meanNs;
+		uint64_t p50Ns;
+		uint64_t p99Ns;
+		/// the number of durations longer than their deadline
+		uint64_t overruns;
+	};
+	RtProfile() { clear(); };
+	/// a monotonic clock, in ns
+	static uint64_t now()
+	{
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+	};
+	/// record a duration. Call this from one thread at a time.
+	void record(uint64_t ns, uint64_t deadlineNs)
+	{
+		// there is only one writer: plain loads and stores are enough
+		increment(count);
+		sum.store(sum.load(std::memory_order_relaxed) + ns, std::memory_order_relaxed);
+		if(ns < min.load(std::memory_order_relaxed))
+			min.store(ns, std::memory_order_relaxed);
+		if(ns > max.load(std::memory_order_relaxed))
+			max.store(ns, std::memory_order_relaxed);
+		if(ns > deadlineNs)
+			increment(overruns);
+		increment(buckets[getBucket(ns)]);
+	};
+	/// forget everything recorded so far. Same as for record().
+	void clear()
+	{
+		count.store(0, std::memory_order_relaxed);
+		sum.store(0, std::memory_order_relaxed);
+		min.store(UINT64_MAX, std::memory_order_relaxed);
+		max.store(0, std::memory_order_relaxed);
+		overruns.store(0, std::memory_order_relaxed);
+		for(auto& bucket : buckets)
+			bucket.store(0, std::memory_order_relaxed);
+	};
+	void getSnapshot(struct snapshot& snapshot) const
+	{
+		memset(&snapshot, 0, sizeof(snapshot));
+		snapshot.count = count.load(std::memory_order_relaxed);
+		if(!snapshot.count)
+			return;
+		snapshot.minNs = min.load(std::memory_order_relaxed);
+		snapshot.maxNs = max.load(std::memory_order_relaxed);
+		snapshot.meanNs = sum.load(std::memory_order_relaxed) / (double)snapshot.count;
+		snapshot.overruns = overruns.load(std::memory_order_relaxed);
+		// the buckets may have moved on since count was read: go by
+		// their own total
+		uint64_t counts[kNumBuckets];
+		uint64_t total = 0;
+		for(unsigned int n = 0; n < kNumBuckets; ++n)
+		{
+			counts[n] = buckets[n].load(std::memory_order_relaxed);
+			total += counts[n];
+		}
+		snapshot.p50Ns = getPercentile(counts, total, 0.5, snapshot.maxNs);
+		snapshot.p99Ns = getPercentile(counts, total, 0.99, snapshot.maxNs);
+	};
+
+private:
+	static const unsigned int kSubBuckets = 8;
+	static const unsigned int kSubBucketBits = 3;
+	// up to 2^40 ns, i.e.: about 18 minutes
+	static const unsigned int kMaxExponent = 40;
+	static const unsigned int kNumBuckets = (kMaxExponent - kSubBucketBits + 2) * kSubBuckets;
+	static void increment(std::atomic<uint64_t>& counter)
+	{
+		counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	};
+	static unsigned int getBucket(uint64_t ns)
+	{
+		if(ns < kSubBuckets)
+			return ns;
+		unsigned int exponent = 63 - __builtin_clzll(ns);
+		if(exponent > kMaxExponent)
+			return kNumBuckets - 1;
+		unsigned int sub = (ns >> (exponent - kSubBucketBits)) & (kSubBuckets - 1);
+		return (exponent - kSubBucketBits + 1) * kSubBuckets + sub;
+	};
+	// the largest duration that falls in a bucket
+	static uint64_t getBucketEnd(unsigned int bucket)
+	{
+		if(bucket < kSubBuckets)
+			return bucket;
+		unsigned int exponent = bucket / kSubBuckets + kSubBucketBits - 1;
+		uint64_t sub = bucket % kSubBuckets;
+		return ((kSubBuckets + sub + 1) << (exponent - kSubBucketBits)) - 1;
+	};
+	static uint64_t getPercentile(const uint64_t* counts, uint64_t total, double fraction, uint64_t maxNs)
+	{
+		uint64_t threshold = total * fraction;
+		uint64_t seen = 0;
+		for(unsigned int n = 0; n < kNumBuckets; ++n)
+		{
+			seen += counts[n];
+			if(seen > threshold)
+				return getBucketEnd(n) < maxNs ? getBucketEnd(n) : maxNs;
+		}
+		return maxNs;
+	};
+	std::atomic<uint64_t> count;
+	std::atomic<uint64_t> sum;
+	std::atomic<uint64_t> min;
+	std::atomic<uint64_t> max;
+	std::atomic<uint64_t> overruns;
+	std::atomic<uint64_t> buckets[kNumBuckets];
+};
@@ -0,0 +1,99 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <stddef.h>
+
+/**
+ * A bounded lock-free queue of fixed-size items. Any number of threads can
+ * push() and pop() concurrently, and neither allocates: all the memory is
+ * reserved by setup().
+ *
+ * With a single consumer, pop() is wait-free. Producers only retry when
+ * they race against each other for the same cell.
+ */
+template <typename T>
+class RtQueue
+{
+public:
+	RtQueue(unsigned int capacity = 0) { setup(capacity); };
+	/**
+	 * Allocate room for at least `capacity` items (rounded up to a power
+	 * of two) and empty the queue. Not safe to call concurrently with
+	 * push() or pop().
+	 */
+	void setup(unsigned int capacity)
+	{
+		size_t size = 1;
+		while(size < capacity)
+			size <<= 1;
+		cells.reset(new Cell[size]);
+		for(size_t n = 0; n < size; ++n)
+			cells[n].sequence.store(n, std::memory_order_relaxed);
+		mask = size - 1;
+		enqueuePos.store(0, std::memory_order_relaxed);
+		dequeuePos.store(0, std::memory_order_relaxed);
+	};
+	size_t capacity() { return mask + 1; };
+	/// @return false if the queue is full
+	bool push(T const& item)
+	{
+		size_t pos = enqueuePos.load(std::memory_order_relaxed);
+		Cell* cell;
+		while(1)
+		{
+			cell = &cells[pos & mask];
+			size_t seq = cell->sequence.load(std::memory_order_acquire);
+			intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+			if(0 == diff)
+			{
+				if(enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					break;
+			}
+			else if(diff < 0)
+				return false;
+			else
+				pos = enqueuePos.load(std::memory_order_relaxed);
+		}
+		cell->data = item;
+		cell->sequence.store(pos + 1, std::memory_order_release);
+		return true;
+	};
+	/// @return false if the queue is empty
+	bool pop(T& item)
+	{
+		size_t pos = dequeuePos.load(std::memory_order_relaxed);
+		Cell* cell;
+		while(1)
+		{
+			cell = &cells[pos & mask];
+			size_t seq = cell->sequence.load(std::memory_order_acquire);
+			intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+			if(0 == diff)
+			{
+				if(dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					break;
+			}
+			else if(diff < 0)
+				return false;
+			else
+				pos = dequeuePos.load(std::memory_order_relaxed);
+		}
+		item = cell->data;
+		cell->sequence.store(pos + mask + 1, std::memory_order_release);
+		return true;
+	};
+
+private:
+	struct Cell {
+		std::atomic<size_t> sequence;
+		T data;
+	};
+	std::unique_ptr<Cell[]> cells;
+	size_t mask;
+	// keep producers and consumers on separate cache lines
+	char pad0[64];
+	std::atomic<size_t> enqueuePos;
+	char pad1[64];
+	std::atomic<size_t> dequeuePos;
+	char pad2[64];
+};
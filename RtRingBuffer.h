@@ -0,0 +1,108 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * A lock-free ring buffer of variable-size messages, for one producer
+ * thread and one consumer thread. Neither write() nor read() allocates:
+ * all the memory is reserved by setup().
+ */
+class RtRingBuffer
+{
+public:
+	/// the room taken up by the header of each message
+	static const uint32_t kHeaderSize = sizeof(uint32_t);
+	/// returned by read() for a message that was too large, and dropped
+	static const uint32_t kDropped = UINT32_MAX;
+	RtRingBuffer(unsigned int capacity = 0) { setup(capacity); };
+	/**
+	 * Allocate room for at least `capacity` bytes (rounded up to a power
+	 * of two) and empty the buffer. Each message also takes up
+	 * kHeaderSize bytes. Not safe to call concurrently with write() or
+	 * read().
+	 */
+	void setup(unsigned int capacity)
+	{
+		size_t size = 1;
+		while(size < capacity)
+			size <<= 1;
+		buffer.reset(new char[size]);
+		mask = size - 1;
+		writePos.store(0, std::memory_order_relaxed);
+		readPos.store(0, std::memory_order_relaxed);
+	};
+	/// @return false if there is not enough room for the message
+	bool write(const void* data, uint32_t size)
+	{
+		return write(nullptr, 0, data, size);
+	};
+	/**
+	 * Write a message made of `header` followed by `data`, so that the
+	 * caller does not have to put them together first.
+	 *
+	 * @return false if there is not enough room for the message
+	 */
+	bool write(const void* header, uint32_t headerSize, const void* data, uint32_t dataSize)
+	{
+		uint32_t size = headerSize + dataSize;
+		size_t w = writePos.load(std::memory_order_relaxed);
+		size_t r = readPos.load(std::memory_order_acquire);
+		if(mask + 1 - (w - r) < sizeof(size) + size)
+			return false;
+		copyIn(w, &size, sizeof(size));
+		copyIn(w + sizeof(size), header, headerSize);
+		copyIn(w + sizeof(size) + headerSize, data, dataSize);
+		writePos.store(w + sizeof(size) + size, std::memory_order_release);
+		return true;
+	};
+	/**
+	 * Read the next message into `data`.
+	 *
+	 * @param maxSize the size of `data`. A message that does not fit is
+	 * dropped, and the following ones can still be read.
+	 * @return the size of the message, 0 if there is none, or kDropped
+	 * if it did not fit
+	 */
+	uint32_t read(void* data, uint32_t maxSize)
+	{
+		size_t r = readPos.load(std::memory_order_relaxed);
+		size_t w = writePos.load(std::memory_order_acquire);
+		if(w == r)
+			return 0;
+		uint32_t size;
+		copyOut(r, &size, sizeof(size));
+		if(size <= maxSize)
+			copyOut(r + sizeof(size), data, size);
+		readPos.store(r + sizeof(size) + size, std::memory_order_release);
+		return size <= maxSize ? size : kDropped;
+	};
+
+private:
+	void copyIn(size_t pos, const void* data, size_t size)
+	{
+		if(!size)
+			return;
+		size_t start = pos & mask;
+		size_t first = std::min(size, mask + 1 - start);
+		memcpy(&buffer[start], data, first);
+		memcpy(&buffer[0], (const char*)data + first, size - first);
+	};
+	void copyOut(size_t pos, void* data, size_t size)
+	{
+		size_t start = pos & mask;
+		size_t first = std::min(size, mask + 1 - start);
+		memcpy(data, &buffer[start], first);
+		memcpy((char*)data + first, &buffer[0], size - first);
+	};
+	std::unique_ptr<char[]> buffer;
+	size_t mask;
+	// keep the producer and the consumer on separate cache lines
+	char pad0[64];
+	std::atomic<size_t> writePos;
+	char pad1[64];
+	std::atomic<size_t> readPos;
+	char pad2[64];
+};
@@ -0,0 +1,279 @@
+/*
+ * Measure the cost of Lv2Host::render() per frame, using the stand-in
+ * plugins in lv2host-bench.lv2, over a sweep of chain lengths, block sizes
+ * and routing topologies.
+ *
+ * Each configuration is also run without the host, calling the plugins
+ * directly one after the other, so that the overhead of the host can be
+ * told apart from the cost of the plugins.
+ *
+ * Before that, a few checks make sure that the host gives correct results
+ * with these plugins; the benchmark does not run if any of them fails.
+ *
+ * usage: lv2bench [-p lv2Path] [-o results.csv] [-t threads] [-r repetitions]
+ */
+#include "../Lv2Host.h"
+#include "../lilv_interface_private.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static const float kSampleRate = 48000;
+static const unsigned int kChannels = 2;
+// frames rendered by each measurement
+static const unsigned int kFramesPerRun = 1 << 16;
+static const char* kPlugins[] = { "gain", "biquad", "delay", "worker", "heavy" };
+static const unsigned int kChainLengths[] = { 1, 2, 4, 8, 16 };
+static const unsigned int kBlockSizes[] = { 16, 32, 64, 128, 256, 512, 1024 };
+
+enum topology {
+	// each slot feeds the next one
+	kSerial,
+	// all the slots read the host inputs, and their outputs are summed
+	kParallel,
+	// each slot gets the sum of the previous slot and the host inputs
+	kMixed,
+	kNumTopologies
+};
+static const char* kTopologyNames[] = { "serial", "parallel", "mixed" };
+
+static double now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static std::string pluginUri(const char* name)
+{
+	return std::string("http://github.com/giuliomoro/lv2host/bench#") + name;
+}
+
+static void route(Lv2Host& host, enum topology topology)
+{
+	unsigned int nSlots = host.count();
+	for(unsigned int s = 0; s < nSlots; ++s)
+	{
+		for(unsigned int ch = 0; ch < kChannels; ++ch)
+		{
+			if(kParallel == topology)
+			{
+				host.connect(-1, ch, s, ch);
+				if(0 == s)
+					host.connect(s, ch, nSlots, ch, 1.f / nSlots);
+				else
+					host.mix(s, ch, nSlots, ch, 1.f / nSlots);
+			} else if(kMixed == topology && s > 0) {
+				host.mix(-1, ch, s, ch, 0.5f);
+				host.mix(s - 1, ch, s, ch, 0.5f);
+			}
+		}
+	}
+}
+
+// the fastest of `repetitions` runs, in ns per frame
+static double measureHost(std::shared_ptr<Lv2HostContext> const& context, const char* plugin, enum topology topology, unsigned int nSlots, unsigned int blockSize, unsigned int nThreads, unsigned int repetitions)
+{
+	Lv2Host host;
+	host.setContext(context);
+	if(!host.setup(kSampleRate, blockSize, kChannels, kChannels))
+		return -1;
+	for(unsigned int s = 0; s < nSlots; ++s)
+	{
+		if(host.add(pluginUri(plugin)) < 0)
+			return -1;
+	}
+	route(host, topology);
+	if(nThreads > 1)
+		host.setParallel(nThreads - 1);
+	std::vector<std::vector<float>> in(kChannels, std::vector<float>(blockSize));
+	std::vector<std::vector<float>> out(kChannels, std::vector<float>(blockSize));
+	const float* inputs[kChannels];
+	float* outputs[kChannels];
+	for(unsigned int ch = 0; ch < kChannels; ++ch)
+	{
+		for(auto& sample : in[ch])
+			sample = rand() / (float)RAND_MAX - 0.5f;
+		inputs[ch] = in[ch].data();
+		outputs[ch] = out[ch].data();
+	}
+	unsigned int nBlocks = kFramesPerRun / blockSize;
+	// warm up, and let render() install the plan
+	for(unsigned int n = 0; n < nBlocks / 4 + 1; ++n)
+		host.render(blockSize, inputs, outputs);
+	double best = -1;
+	for(unsigned int r = 0; r < repetitions; ++r)
+	{
+		double start = now();
+		for(unsigned int n = 0; n < nBlocks; ++n)
+			host.render(blockSize, inputs, outputs);
+		double elapsed = now() - start;
+		if(best < 0 || elapsed < best)
+			best = elapsed;
+	}
+	return best * 1e9 / (nBlocks * blockSize);
+}
+
+// The host does the work of the plugins on the worker thread, outside of
+// the time of the block, so here their requests are accepted and dropped.
+static LV2_Worker_Status dropWork(LV2_Worker_Schedule_Handle handle, uint32_t size, const void* data)
+{
+	(void)handle;
+	(void)size;
+	(void)data;
+	return LV2_WORKER_SUCCESS;
+}
+
+// the same plugins run one after the other by hand, with no host
+static double measureDirect(LilvWorld* world, const char* plugin, unsigned int nSlots, unsigned int blockSize, unsigned int repetitions)
+{
+	LV2_Worker_Schedule schedule = { NULL, dropWork };
+	LV2_Feature scheduleFeature = { LV2_WORKER__schedule, &schedule };
+	const LV2_Feature* features[] = { &scheduleFeature, NULL };
+	std::vector<LV2Apply*> slots;
+	std::vector<std::vector<float>> buffers(2 * kChannels, std::vector<float>(blockSize));
+	for(auto& buffer : buffers)
+		for(auto& sample : buffer)
+			sample = rand() / (float)RAND_MAX - 0.5f;
+	double best = -1;
+	for(unsigned int s = 0; s < nSlots; ++s)
+	{
+		LV2Apply* slot = LV2Apply_instantiatePlugin(world, pluginUri(plugin).c_str(), kSampleRate, features);
+		if(!slot)
+			goto cleanup;
+		slots.push_back(slot);
+		// ping-pong between two sets of buffers
+		for(unsigned int ch = 0; ch < kChannels; ++ch)
+		{
+			slot->in_bufs[ch] = buffers[(s % 2) * kChannels + ch].data();
+			slot->out_bufs[ch] = buffers[((s + 1) % 2) * kChannels + ch].data();
+		}
+		LV2Apply_connectPorts(slot);
+	}
+	{
+		unsigned int nBlocks = kFramesPerRun / blockSize;
+		for(unsigned int n = 0; n < nBlocks / 4 + 1; ++n)
+			for(auto slot : slots)
+				lilv_instance_run(slot->instance, blockSize);
+		for(unsigned int r = 0; r < repetitions; ++r)
+		{
+			double start = now();
+			for(unsigned int n = 0; n < nBlocks; ++n)
+				for(auto slot : slots)
+					lilv_instance_run(slot->instance, blockSize);
+			double elapsed = now() - start;
+			if(best < 0 || elapsed < best)
+				best = elapsed;
+		}
+		best = best * 1e9 / (nBlocks * blockSize);
+	}
+cleanup:
+	for(auto slot : slots)
+		LV2Apply_free(slot);
+	return best;
+}
+
+// A multi-instance slot of a plugin without atom ports: each copy must
+// get buffers of its own, and pass its input through at unity gain.
+static bool checkMulti(std::shared_ptr<Lv2HostContext> const& context)
+{
+	const unsigned int nCopies = 2;
+	const unsigned int nChannels = kChannels * nCopies;
+	const unsigned int blockSize = 64;
+	Lv2Host host;
+	host.setContext(context);
+	if(!host.setup(kSampleRate, blockSize, nChannels, nChannels))
+		return false;
+	int slot = host.addMulti(pluginUri("gain"), nCopies);
+	if(slot < 0 || host.countCopies(slot) != (int)nCopies)
+		return false;
+	for(unsigned int ch = 0; ch < nChannels; ++ch)
+	{
+		host.connect(-1, ch, slot, ch);
+		host.connect(slot, ch, host.count(), ch);
+	}
+	std::vector<std::vector<float>> in(nChannels, std::vector<float>(blockSize));
+	std::vector<std::vector<float>> out(nChannels, std::vector<float>(blockSize));
+	std::vector<const float*> inputs(nChannels);
+	std::vector<float*> outputs(nChannels);
+	for(unsigned int ch = 0; ch < nChannels; ++ch)
+	{
+		for(unsigned int n = 0; n < blockSize; ++n)
+			in[ch][n] = (ch + 1) * 0.1f + n * 0.001f;
+		inputs[ch] = in[ch].data();
+		outputs[ch] = out[ch].data();
+	}
+	for(unsigned int n = 0; n < 4; ++n)
+		host.render(blockSize, inputs.data(), outputs.data());
+	return in == out;
+}
+
+int main(int argc, char** argv)
+{
+	const char* lv2Path = "bench";
+	const char* outputPath = "lv2bench.csv";
+	unsigned int nThreads = 1;
+	unsigned int repetitions = 5;
+	int c;
+	while((c = getopt(argc, argv, "p:o:t:r:h")) != -1)
+	{
+		switch(c)
+		{
+			case 'p': lv2Path = optarg; break;
+			case 'o': outputPath = optarg; break;
+			case 't': nThreads = atoi(optarg); break;
+			case 'r': repetitions = atoi(optarg); break;
+			default:
+				fprintf(stderr, "usage: %s [-p lv2Path] [-o results.csv] [-t threads] [-r repetitions]\n", argv[0]);
+				return 1;
+		}
+	}
+	// only load the stand-in plugins
+	setenv("LV2_PATH", lv2Path, 1);
+	FILE* output = strcmp(outputPath, "-") ? fopen(outputPath, "w") : stdout;
+	if(!output)
+	{
+		fprintf(stderr, "Unable to open %s\n", outputPath);
+		return 1;
+	}
+	// all the hosts share the same world
+	std::shared_ptr<Lv2HostContext> context(new Lv2HostContext);
+	if(!context->setup(false))
+		return 1;
+	LilvWorld* world = context->getWorld();
+	if(!checkMulti(context))
+	{
+		fprintf(stderr, "addMulti() check failed with %s\n", pluginUri("gain").c_str());
+		return 1;
+	}
+	fprintf(output, "topology,plugin,slots,blockSize,threads,hostNsPerFrame,pluginNsPerFrame,overheadNsPerFrame\n");
+	for(auto plugin : kPlugins)
+	{
+		for(auto nSlots : kChainLengths)
+		{
+			for(auto blockSize : kBlockSizes)
+			{
+				double direct = measureDirect(world, plugin, nSlots, blockSize, repetitions);
+				if(direct < 0)
+				{
+					fprintf(stderr, "Unable to instantiate %s. Is LV2_PATH (%s) right?\n", pluginUri(plugin).c_str(), lv2Path);
+					return 1;
+				}
+				for(unsigned int t = 0; t < kNumTopologies; ++t)
+				{
+					double ns = measureHost(context, plugin, (enum topology)t, nSlots, blockSize, nThreads, repetitions);
+					fprintf(output, "%s,%s,%u,%u,%u,%.3f,%.3f,%.3f\n", kTopologyNames[t], plugin,
+						nSlots, blockSize, nThreads, ns, direct, ns - direct);
+					fflush(output);
+					fprintf(stderr, "%-8s %-6s %2u slots %4u frames: %8.3f ns/frame, overhead %8.3f\n",
+						kTopologyNames[t], plugin, nSlots, blockSize, ns, ns - direct);
+				}
+			}
+		}
+	}
+	if(output != stdout)
+		fclose(output);
+	return 0;
+}
@@ -0,0 +1,276 @@
+/*
+ * Stand-in plugins for benchmarking lv2host. They are meant to have a
+ * known, stable cost, not to sound good.
+ *
+ * All of them are stereo, with the audio ports at indices 0 to 3 and the
+ * controls after them.
+ */
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lv2/lv2plug.in/ns/lv2core/lv2.h"
+#include "lv2/lv2plug.in/ns/ext/worker/worker.h"
+
+#define BENCH_URI "http://github.com/giuliomoro/lv2host/bench#"
+#define N_CHANNELS 2
+#define MAX_DELAY 4096
+#define MAX_STAGES 64
+
+typedef struct {
+	float b0, b1, b2, a1, a2;
+	float z1[N_CHANNELS];
+	float z2[N_CHANNELS];
+} Biquad;
+
+typedef struct {
+	const float* in[N_CHANNELS];
+	float* out[N_CHANNELS];
+	const float* controls[2];
+	float* latency;
+	double sampleRate;
+	// biquad and heavy
+	Biquad biquads[MAX_STAGES];
+	float lastFreq;
+	float lastQ;
+	// delay
+	float* delay[N_CHANNELS];
+	unsigned int writePosition;
+	// worker
+	LV2_Worker_Schedule* schedule;
+	unsigned int blockCount;
+	float response;
+} Bench;
+
+static void biquadSetLowpass(Biquad* bq, double sampleRate, float freq, float q)
+{
+	double w0 = 2 * M_PI * freq / sampleRate;
+	double alpha = sin(w0) / (2 * q);
+	double a0 = 1 + alpha;
+	bq->b0 = (1 - cos(w0)) / 2 / a0;
+	bq->b1 = (1 - cos(w0)) / a0;
+	bq->b2 = bq->b0;
+	bq->a1 = -2 * cos(w0) / a0;
+	bq->a2 = (1 - alpha) / a0;
+}
+
+static void biquadProcess(Biquad* bq, unsigned int ch, const float* in, float* out, uint32_t nFrames)
+{
+	float z1 = bq->z1[ch];
+	float z2 = bq->z2[ch];
+	for (uint32_t n = 0; n < nFrames; ++n) {
+		float x = in[n];
+		float y = bq->b0 * x + z1;
+		z1 = bq->b1 * x - bq->a1 * y + z2;
+		z2 = bq->b2 * x - bq->a2 * y;
+		out[n] = y;
+	}
+	bq->z1[ch] = z1;
+	bq->z2[ch] = z2;
+}
+
+static LV2_Handle
+instantiate(const LV2_Descriptor* descriptor, double rate,
+            const char* bundle_path, const LV2_Feature* const* features)
+{
+	(void)bundle_path;
+	Bench* self = (Bench*)calloc(1, sizeof(Bench));
+	if (!self) {
+		return NULL;
+	}
+	self->sampleRate = rate;
+	for (unsigned int n = 0; n < MAX_STAGES; ++n) {
+		biquadSetLowpass(&self->biquads[n], rate, 1000 + 100 * n, 0.707f);
+	}
+	if (!strcmp(descriptor->URI, BENCH_URI "delay")) {
+		for (unsigned int ch = 0; ch < N_CHANNELS; ++ch) {
+			self->delay[ch] = (float*)calloc(MAX_DELAY, sizeof(float));
+		}
+	}
+	for (unsigned int n = 0; features && features[n]; ++n) {
+		if (!strcmp(features[n]->URI, LV2_WORKER__schedule)) {
+			self->schedule = (LV2_Worker_Schedule*)features[n]->data;
+		}
+	}
+	return (LV2_Handle)self;
+}
+
+static void
+connect_port(LV2_Handle instance, uint32_t port, void* data)
+{
+	Bench* self = (Bench*)instance;
+	if (port < N_CHANNELS) {
+		self->in[port] = (const float*)data;
+	} else if (port < 2 * N_CHANNELS) {
+		self->out[port - N_CHANNELS] = (float*)data;
+	} else if (port < 2 * N_CHANNELS + 2) {
+		self->controls[port - 2 * N_CHANNELS] = (const float*)data;
+	}
+	// the delay reports its latency on its second control
+	if (port == 2 * N_CHANNELS + 1) {
+		self->latency = (float*)data;
+	}
+}
+
+static void
+cleanup(LV2_Handle instance)
+{
+	Bench* self = (Bench*)instance;
+	for (unsigned int ch = 0; ch < N_CHANNELS; ++ch) {
+		free(self->delay[ch]);
+	}
+	free(self);
+}
+
+static void
+run_gain(LV2_Handle instance, uint32_t nFrames)
+{
+	Bench* self = (Bench*)instance;
+	const float gain = *self->controls[0];
+	for (unsigned int ch = 0; ch < N_CHANNELS; ++ch) {
+		for (uint32_t n = 0; n < nFrames; ++n) {
+			self->out[ch][n] = gain * self->in[ch][n];
+		}
+	}
+}
+
+static void
+run_biquad(LV2_Handle instance, uint32_t nFrames)
+{
+	Bench* self = (Bench*)instance;
+	float freq = *self->controls[0];
+	float q = *self->controls[1];
+	if (freq != self->lastFreq || q != self->lastQ) {
+		biquadSetLowpass(&self->biquads[0], self->sampleRate, freq, q);
+		self->lastFreq = freq;
+		self->lastQ = q;
+	}
+	for (unsigned int ch = 0; ch < N_CHANNELS; ++ch) {
+		biquadProcess(&self->biquads[0], ch, self->in[ch], self->out[ch], nFrames);
+	}
+}
+
+static void
+run_delay(LV2_Handle instance, uint32_t nFrames)
+{
+	Bench* self = (Bench*)instance;
+	unsigned int delay = (unsigned int)*self->controls[0];
+	if (delay >= MAX_DELAY) {
+		delay = MAX_DELAY - 1;
+	}
+	unsigned int w = self->writePosition;
+	for (unsigned int ch = 0; ch < N_CHANNELS; ++ch) {
+		float* line = self->delay[ch];
+		w = self->writePosition;
+		for (uint32_t n = 0; n < nFrames; ++n) {
+			line[w] = self->in[ch][n];
+			self->out[ch][n] = line[(w + MAX_DELAY - delay) % MAX_DELAY];
+			w = (w + 1) % MAX_DELAY;
+		}
+	}
+	self->writePosition = w;
+	if (self->latency) {
+		*self->latency = delay;
+	}
+}
+
+static void
+run_worker(LV2_Handle instance, uint32_t nFrames)
+{
+	Bench* self = (Bench*)instance;
+	unsigned int interval = (unsigned int)*self->controls[0];
+	for (unsigned int ch = 0; ch < N_CHANNELS; ++ch) {
+		for (uint32_t n = 0; n < nFrames; ++n) {
+			self->out[ch][n] = self->response * self->in[ch][n];
+		}
+	}
+	if (self->schedule && interval && 0 == ++self->blockCount % interval) {
+		self->schedule->schedule_work(self->schedule->handle, sizeof(nFrames), &nFrames);
+	}
+}
+
+static LV2_Worker_Status
+work(LV2_Handle instance, LV2_Worker_Respond_Function respond,
+     LV2_Worker_Respond_Handle handle, uint32_t size, const void* data)
+{
+	(void)instance;
+	(void)size;
+	(void)data;
+	// some work the audio thread should not do
+	volatile float sink = 0;
+	for (unsigned int n = 0; n < 1000; ++n) {
+		sink = sink + sinf(n * 0.001f);
+	}
+	float response = 1;
+	return respond(handle, sizeof(response), &response);
+}
+
+static LV2_Worker_Status
+work_response(LV2_Handle instance, uint32_t size, const void* data)
+{
+	Bench* self = (Bench*)instance;
+	if (size == sizeof(self->response)) {
+		memcpy(&self->response, data, size);
+	}
+	return LV2_WORKER_SUCCESS;
+}
+
+static void
+activate_worker(LV2_Handle instance)
+{
+	Bench* self = (Bench*)instance;
+	self->response = 1;
+	self->blockCount = 0;
+}
+
+static const void*
+extension_data_worker(const char* uri)
+{
+	static const LV2_Worker_Interface iface = { work, work_response, NULL };
+	if (!strcmp(uri, LV2_WORKER__interface)) {
+		return &iface;
+	}
+	return NULL;
+}
+
+static void
+run_heavy(LV2_Handle instance, uint32_t nFrames)
+{
+	Bench* self = (Bench*)instance;
+	unsigned int stages = (unsigned int)*self->controls[0];
+	if (stages < 1) {
+		stages = 1;
+	} else if (stages > MAX_STAGES) {
+		stages = MAX_STAGES;
+	}
+	for (unsigned int ch = 0; ch < N_CHANNELS; ++ch) {
+		biquadProcess(&self->biquads[0], ch, self->in[ch], self->out[ch], nFrames);
+		for (unsigned int s = 1; s < stages; ++s) {
+			biquadProcess(&self->biquads[s], ch, self->out[ch], self->out[ch], nFrames);
+		}
+	}
+}
+
+static const void*
+extension_data(const char* uri)
+{
+	(void)uri;
+	return NULL;
+}
+
+static const LV2_Descriptor descriptors[] = {
+	{ BENCH_URI "gain", instantiate, connect_port, NULL, run_gain, NULL, cleanup, extension_data },
+	{ BENCH_URI "biquad", instantiate, connect_port, NULL, run_biquad, NULL, cleanup, extension_data },
+	{ BENCH_URI "delay", instantiate, connect_port, NULL, run_delay, NULL, cleanup, extension_data },
+	{ BENCH_URI "worker", instantiate, connect_port, activate_worker, run_worker, NULL, cleanup, extension_data_worker },
+	{ BENCH_URI "heavy", instantiate, connect_port, NULL, run_heavy, NULL, cleanup, extension_data },
+};
+
+LV2_SYMBOL_EXPORT
+const LV2_Descriptor*
+lv2_descriptor(uint32_t index)
+{
+	if (index < sizeof(descriptors) / sizeof(descriptors[0])) {
+		return &descriptors[index];
+	}
+	return NULL;
+}
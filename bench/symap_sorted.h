@@ -0,0 +1,11 @@
+#pragma once
+#include <stdint.h>
+
+/* The original Symap, see symap.h */
+typedef struct SortedSymapImpl SortedSymap;
+
+SortedSymap* sorted_symap_new(void);
+void sorted_symap_free(SortedSymap* map);
+uint32_t sorted_symap_try_map(SortedSymap* map, const char* sym);
+uint32_t sorted_symap_map(SortedSymap* map, const char* sym);
+const char* sorted_symap_unmap(SortedSymap* map, uint32_t id);
@@ -0,0 +1,152 @@
+/*
+ * Compare the concurrent Symap in symap.c with the original sorted-array
+ * implementation: mapping new URIs, mapping URIs already mapped and
+ * unmapping IDs, for increasing numbers of URIs. The concurrent map is
+ * also timed with several threads looking URIs up at the same time.
+ *
+ * Prints CSV: implementation,operation,nUris,threads,nsPerOp
+ *
+ * usage: symapbench [-t threads]
+ */
+#include "../symap.h"
+#include "symap_sorted.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static const unsigned int kSizes[] = { 100, 1000, 10000, 100000 };
+// lookups timed for each size
+static const unsigned int kLookups = 1000000;
+
+static double now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// URIs shaped like those plugins map: long, with long common prefixes
+static char** makeUris(unsigned int n)
+{
+	char** uris = (char**)malloc(n * sizeof(char*));
+	for(unsigned int i = 0; i < n; ++i)
+	{
+		uris[i] = (char*)malloc(96);
+		snprintf(uris[i], 96, "http://example.org/plugins/plugin%u#port%u", i / 16, i % 16);
+	}
+	return uris;
+}
+
+static void freeUris(char** uris, unsigned int n)
+{
+	for(unsigned int i = 0; i < n; ++i)
+		free(uris[i]);
+	free(uris);
+}
+
+static volatile uintptr_t sink;
+
+static void print(const char* implementation, const char* operation, unsigned int nUris, unsigned int nThreads, double seconds, unsigned int nOps)
+{
+	printf("%s,%s,%u,%u,%.2f\n", implementation, operation, nUris, nThreads, seconds * 1e9 / nOps);
+}
+
+static void benchSorted(char** uris, unsigned int n)
+{
+	SortedSymap* map = sorted_symap_new();
+	double start = now();
+	for(unsigned int i = 0; i < n; ++i)
+		sorted_symap_map(map, uris[i]);
+	print("sorted", "insert", n, 1, now() - start, n);
+	start = now();
+	for(unsigned int i = 0; i < kLookups; ++i)
+		sink += sorted_symap_map(map, uris[(i * 7919u) % n]);
+	print("sorted", "lookup", n, 1, now() - start, kLookups);
+	start = now();
+	for(unsigned int i = 0; i < kLookups; ++i)
+		sink += (uintptr_t)sorted_symap_unmap(map, 1 + (i * 7919u) % n);
+	print("sorted", "unmap", n, 1, now() - start, kLookups);
+	sorted_symap_free(map);
+}
+
+struct lookupJob {
+	Symap* map;
+	char** uris;
+	unsigned int n;
+	unsigned int offset;
+};
+
+static void* lookupLoop(void* arg)
+{
+	struct lookupJob* job = (struct lookupJob*)arg;
+	uintptr_t sum = 0;
+	for(unsigned int i = 0; i < kLookups; ++i)
+		sum += symap_map(job->map, job->uris[(i * 7919u + job->offset) % job->n]);
+	sink += sum;
+	return NULL;
+}
+
+static void benchConcurrent(char** uris, unsigned int n, unsigned int nThreads)
+{
+	Symap* map = symap_new();
+	double start = now();
+	for(unsigned int i = 0; i < n; ++i)
+		symap_map(map, uris[i]);
+	print("concurrent", "insert", n, 1, now() - start, n);
+	start = now();
+	for(unsigned int i = 0; i < kLookups; ++i)
+		sink += symap_map(map, uris[(i * 7919u) % n]);
+	print("concurrent", "lookup", n, 1, now() - start, kLookups);
+	start = now();
+	for(unsigned int i = 0; i < kLookups; ++i)
+		sink += (uintptr_t)symap_unmap(map, 1 + (i * 7919u) % n);
+	print("concurrent", "unmap", n, 1, now() - start, kLookups);
+	if(nThreads > 1)
+	{
+		pthread_t threads[nThreads];
+		struct lookupJob jobs[nThreads];
+		start = now();
+		for(unsigned int t = 0; t < nThreads; ++t)
+		{
+			jobs[t].map = map;
+			jobs[t].uris = uris;
+			jobs[t].n = n;
+			jobs[t].offset = t;
+			pthread_create(&threads[t], NULL, lookupLoop, &jobs[t]);
+		}
+		for(unsigned int t = 0; t < nThreads; ++t)
+			pthread_join(threads[t], NULL);
+		// wall time over the lookups of all the threads
+		print("concurrent", "lookup", n, nThreads, now() - start, kLookups * nThreads);
+	}
+	symap_free(map);
+}
+
+int main(int argc, char** argv)
+{
+	unsigned int nThreads = 4;
+	int c;
+	while((c = getopt(argc, argv, "t:h")) != -1)
+	{
+		switch(c)
+		{
+			case 't': nThreads = atoi(optarg); break;
+			default:
+				fprintf(stderr, "usage: %s [-t threads]\n", argv[0]);
+				return 1;
+		}
+	}
+	printf("implementation,operation,nUris,threads,nsPerOp\n");
+	for(unsigned int s = 0; s < sizeof(kSizes) / sizeof(kSizes[0]); ++s)
+	{
+		unsigned int n = kSizes[s];
+		char** uris = makeUris(n);
+		benchSorted(uris, n);
+		benchConcurrent(uris, n, nThreads);
+		freeUris(uris, n);
+	}
+	return 0;
+}
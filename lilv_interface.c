@@ -24,6 +24,11 @@
 
 #include "lilv_interface.h"
 #include "lilv_interface_private.h"
+#include "lv2/lv2plug.in/ns/ext/atom/atom.h"
+#include "lv2/lv2plug.in/ns/ext/midi/midi.h"
+#include "lv2/lv2plug.in/ns/ext/resize-port/resize-port.h"
+#include "lv2/lv2plug.in/ns/ext/state/state.h"
+#include <dlfcn.h>
 #include <math.h>
 #include <string.h>
 #include <stdlib.h>
@@ -143,13 +148,85 @@ print_port(const LilvPlugin* p,
 	}
 	lilv_nodes_free(properties);
 }
+static void* default_allocate(void* handle, size_t size)
+{
+	(void)handle;
+	return calloc(1, size);
+}
+
+static void default_release(void* handle, void* ptr)
+{
+	(void)handle;
+	free(ptr);
+}
+
+static const LV2Apply_Allocator default_allocator = {
+	default_allocate,
+	default_release,
+	NULL
+};
+
+unsigned int LV2Apply_getLatency(LV2Apply* self)
+{
+	if (self->latency_port < 0) {
+		return 0;
+	}
+	float latency = self->ports[self->latency_port].value;
+	return latency > 0 ? (unsigned int)latency : 0;
+}
+
 /** Clean up all resources. */
 void LV2Apply_cleanup(LV2Apply* self)
 {
-	lilv_instance_deactivate(self->instance);
-	lilv_instance_free(self->instance);
-	free(self->ports);
+	for (unsigned k = 0; self->instances && k < self->n_copies; ++k) {
+		LilvInstance* instance = self->instances[k];
+		if (!instance) {
+			continue;
+		}
+		if (self->activated && self->activated[k]) {
+			lilv_instance_deactivate(instance);
+		}
+		/* not created by lilv, see LV2Apply_instantiate() */
+		instance->lv2_descriptor->cleanup(instance->lv2_handle);
+		free(instance);
+		self->instances[k] = NULL;
+	}
+	self->instance = NULL;
+	if (self->library) {
+		dlclose(self->library);
+	}
+	lilv_free(self->bundle_path);
+	self->library = NULL;
+	self->descriptor = NULL;
+	self->bundle_path = NULL;
+	LV2Apply_Allocator* a = &self->allocator;
+	a->release(a->handle, self->instances);
+	a->release(a->handle, self->activated);
+	self->instances = NULL;
+	self->activated = NULL;
+	a->release(a->handle, self->ports);
+	a->release(a->handle, self->port_info);
+	a->release(a->handle, self->in_bufs);
+	a->release(a->handle, self->out_bufs);
+	a->release(a->handle, self->atom_in_bufs);
+	a->release(a->handle, self->atom_out_bufs);
+	self->ports = NULL;
+	self->port_info = NULL;
+	self->name = NULL;
+	self->in_bufs = NULL;
+	self->out_bufs = NULL;
+	self->atom_in_bufs = NULL;
+	self->atom_out_bufs = NULL;
 	free(self->params);
+	self->params = NULL;
+}
+
+/** Clean up and free an LV2Apply returned by LV2Apply_instantiatePlugin() */
+void LV2Apply_free(LV2Apply* self)
+{
+	LV2Apply_Allocator allocator = self->allocator;
+	LV2Apply_cleanup(self);
+	allocator.release(allocator.handle, self);
 }
 
 void LV2Apply_cleanupWorld(LilvWorld* world)
@@ -169,6 +246,143 @@ fatal(LV2Apply* self, void* status, const char* fmt, ...)
 	if(self) LV2Apply_cleanup(self);
 	return status;
 }
+/** Where describe_ports() puts the strings and scale points of the ports */
+typedef struct {
+	bool                 fill;    ///< False to only measure what is needed
+	LV2Apply_ScalePoint* points;
+	unsigned             n_points;
+	char*                strings;
+	size_t               strings_size;
+} PortInfoBuilder;
+
+static const char*
+builder_string(PortInfoBuilder* b, const char* str)
+{
+	if (!str) {
+		return NULL;
+	}
+	size_t size = strlen(str) + 1;
+	char*  ret  = NULL;
+	if (b->fill) {
+		ret = b->strings + b->strings_size;
+		memcpy(ret, str, size);
+	}
+	b->strings_size += size;
+	return ret;
+}
+
+/**
+   Resolve the metadata of all ports, and the name of the plugin.
+   This is called twice: once to measure how much room the strings and
+   scale points take, then to copy them into self->port_info.
+*/
+static void
+describe_ports(LV2Apply* self, LilvWorld* world, const float* mins,
+               const float* maxes, const float* defaults, PortInfoBuilder* b)
+{
+	const LilvPlugin* plugin = self->plugin;
+	LilvNode* lv2_InputPort    = lilv_new_uri(world, LV2_CORE__InputPort);
+	LilvNode* lv2_ControlPort  = lilv_new_uri(world, LV2_CORE__ControlPort);
+	LilvNode* lv2_enumeration  = lilv_new_uri(world, LV2_CORE__enumeration);
+	LilvNode* lv2_integer      = lilv_new_uri(world, LV2_CORE__integer);
+	LilvNode* lv2_toggled      = lilv_new_uri(world, LV2_CORE__toggled);
+	LilvNode* lv2_designation  = lilv_new_uri(world, LV2_CORE__designation);
+	LilvNode* pprops_logarithmic     = lilv_new_uri(world, "http://lv2plug.in/ns/ext/port-props#logarithmic");
+	LilvNode* pprops_hasStrictBounds = lilv_new_uri(world, "http://lv2plug.in/ns/ext/port-props#hasStrictBounds");
+
+	LilvNode* plugin_name = lilv_plugin_get_name(plugin);
+	const char* name = builder_string(b, plugin_name ? lilv_node_as_string(plugin_name) : "");
+	if (b->fill) {
+		self->name = name;
+	}
+	lilv_node_free(plugin_name);
+
+	for (uint32_t i = 0; i < self->n_ports; ++i) {
+		LV2Apply_PortInfo scratch;
+		LV2Apply_PortInfo* info = b->fill ? &self->port_info[i] : &scratch;
+		const LilvPort* port = lilv_plugin_get_port_by_index(plugin, i);
+
+		LilvNode* port_name = lilv_port_get_name(plugin, port);
+		info->name = builder_string(b, lilv_node_as_string(port_name));
+		lilv_node_free(port_name);
+		info->symbol = builder_string(b, lilv_node_as_string(lilv_port_get_symbol(plugin, port)));
+		LilvNode* designation = lilv_port_get(plugin, port, lv2_designation);
+		info->designation = designation ? builder_string(b, lilv_node_as_uri(designation)) : NULL;
+		lilv_node_free(designation);
+
+		info->min = mins[i];
+		info->max = maxes[i];
+		info->default_value = defaults[i];
+		info->is_input = lilv_port_is_a(plugin, port, lv2_InputPort);
+		info->is_logarithmic = lilv_port_has_property(plugin, port, pprops_logarithmic);
+		info->has_strict_bounds = lilv_port_has_property(plugin, port, pprops_hasStrictBounds);
+		info->control_type = kNotControl;
+		if (info->is_input && lilv_port_is_a(plugin, port, lv2_ControlPort)) {
+			if (lilv_port_has_property(plugin, port, lv2_toggled)) {
+				info->control_type = kToggle;
+			} else if (lilv_port_has_property(plugin, port, lv2_enumeration)) {
+				info->control_type = kEnumerated;
+			} else if (lilv_port_has_property(plugin, port, lv2_integer)) {
+				info->control_type = kInteger;
+			} else {
+				info->control_type = kFloat;
+			}
+		}
+
+		LilvScalePoints* points = lilv_port_get_scale_points(plugin, port);
+		info->n_scale_points = 0;
+		info->scale_points = b->fill ? b->points + b->n_points : NULL;
+		LILV_FOREACH(scale_points, it, points) {
+			const LilvScalePoint* point = lilv_scale_points_get(points, it);
+			const char* label = builder_string(b, lilv_node_as_string(lilv_scale_point_get_label(point)));
+			if (b->fill) {
+				b->points[b->n_points].value = lilv_node_as_float(lilv_scale_point_get_value(point));
+				b->points[b->n_points].label = label;
+			}
+			++b->n_points;
+			++info->n_scale_points;
+		}
+		lilv_scale_points_free(points);
+	}
+
+	lilv_node_free(pprops_hasStrictBounds);
+	lilv_node_free(pprops_logarithmic);
+	lilv_node_free(lv2_designation);
+	lilv_node_free(lv2_toggled);
+	lilv_node_free(lv2_integer);
+	lilv_node_free(lv2_enumeration);
+	lilv_node_free(lv2_ControlPort);
+	lilv_node_free(lv2_InputPort);
+}
+
+/**
+   Build self->port_info: the metadata of all ports, their strings and
+   scale points, in a single block.
+*/
+static int
+create_port_info(LV2Apply* self, LilvWorld* world, const float* mins,
+                 const float* maxes, const float* defaults)
+{
+	PortInfoBuilder b;
+	memset(&b, 0, sizeof(b));
+	describe_ports(self, world, mins, maxes, defaults, &b);
+	size_t infos_size = self->n_ports * sizeof(LV2Apply_PortInfo);
+	size_t points_size = b.n_points * sizeof(LV2Apply_ScalePoint);
+	char* block = (char*)self->allocator.allocate(self->allocator.handle,
+		infos_size + points_size + b.strings_size);
+	if (!block) {
+		return 1;
+	}
+	self->port_info = (LV2Apply_PortInfo*)block;
+	b.fill = true;
+	b.points = (LV2Apply_ScalePoint*)(block + infos_size);
+	b.n_points = 0;
+	b.strings = block + infos_size + points_size;
+	b.strings_size = 0;
+	describe_ports(self, world, mins, maxes, defaults, &b);
+	return 0;
+}
+
 /**
    Create port structures from data (via create_port()) for all ports.
 */
@@ -178,7 +392,10 @@ create_ports(LV2Apply* self, LilvWorld* world)
 	const uint32_t n_ports = lilv_plugin_get_num_ports(self->plugin);
 
 	self->n_ports = n_ports;
-	self->ports   = (Port*)calloc(self->n_ports, sizeof(Port));
+	self->ports   = (Port*)self->allocator.allocate(self->allocator.handle, self->n_ports * sizeof(Port));
+	if (!self->ports) {
+		return 1;
+	}
 
 	/* Get default values for all ports */
 	float* minValues = (float*)calloc(n_ports, sizeof(float));
@@ -191,6 +408,11 @@ create_ports(LV2Apply* self, LilvWorld* world)
 	LilvNode* lv2_AudioPort          = lilv_new_uri(world, LV2_CORE__AudioPort);
 	LilvNode* lv2_ControlPort        = lilv_new_uri(world, LV2_CORE__ControlPort);
 	LilvNode* lv2_connectionOptional = lilv_new_uri(world, LV2_CORE__connectionOptional);
+	LilvNode* atom_AtomPort          = lilv_new_uri(world, LV2_ATOM__AtomPort);
+	LilvNode* atom_bufferType        = lilv_new_uri(world, LV2_ATOM__bufferType);
+	LilvNode* atom_Sequence          = lilv_new_uri(world, LV2_ATOM__Sequence);
+	LilvNode* midi_MidiEvent         = lilv_new_uri(world, LV2_MIDI__MidiEvent);
+	LilvNode* rsz_minimumSize        = lilv_new_uri(world, LV2_RESIZE_PORT__minimumSize);
 
 	for (uint32_t i = 0; i < n_ports; ++i) {
 		Port*           port  = &self->ports[i];
@@ -222,25 +444,69 @@ create_ports(LV2Apply* self, LilvWorld* world)
 			} else {
 				++self->n_audio_out;
 			}
+		} else if (lilv_port_is_a(self->plugin, lport, atom_AtomPort)) {
+			LilvNodes* buffer_types = lilv_port_get_value(
+				self->plugin, lport, atom_bufferType);
+			if (lilv_nodes_contains(buffer_types, atom_Sequence)) {
+				port->type = TYPE_ATOM;
+				port->supports_midi = lilv_port_supports_event(
+					self->plugin, lport, midi_MidiEvent);
+				LilvNode* min_size = lilv_port_get(
+					self->plugin, lport, rsz_minimumSize);
+				if (min_size && lilv_node_is_int(min_size)) {
+					port->min_size = lilv_node_as_int(min_size);
+				}
+				lilv_node_free(min_size);
+				if (port->is_input) {
+					++self->n_atom_in;
+				} else {
+					++self->n_atom_out;
+				}
+			} else if (!port->optional) {
+				fprintf(stderr, "Port %d has unsupported buffer type\n", i);
+			}
+			lilv_nodes_free(buffer_types);
 		} else if (!port->optional) {
 			fprintf(stderr, "Port %d has unsupported type\n", i);
 		}
 	}
 
+	lilv_node_free(rsz_minimumSize);
+	lilv_node_free(midi_MidiEvent);
+	lilv_node_free(atom_Sequence);
+	lilv_node_free(atom_bufferType);
+	lilv_node_free(atom_AtomPort);
+
 	lilv_node_free(lv2_connectionOptional);
 	lilv_node_free(lv2_ControlPort);
 	lilv_node_free(lv2_AudioPort);
 	lilv_node_free(lv2_OutputPort);
 	lilv_node_free(lv2_InputPort);
+	int ret = create_port_info(self, world, minValues, maxValues, values);
+	free(minValues);
+	free(maxValues);
 	free(values);
 
-	return 0;
+	return ret;
 }
 
 LV2Apply* LV2Apply_instantiatePlugin(LilvWorld* world, const char* plugin_uri, float sampleRate, const LV2_Feature** features)
+{
+	return LV2Apply_instantiatePluginWithAllocator(world, plugin_uri, sampleRate, features, NULL);
+}
+
+/* An array of `n` entries of `size` bytes, or NULL if `n` is 0 */
+static void*
+allocate_array(LV2Apply* self, size_t n, size_t size)
+{
+	return n ? self->allocator.allocate(self->allocator.handle, n * size) : NULL;
+}
+
+LV2Apply* LV2Apply_describePluginWithAllocator(LilvWorld* world, const char* plugin_uri, const LV2Apply_Allocator* allocator)
 {
 	LV2Apply self;
 	memset(&self, 0, sizeof(self));
+	self.allocator = allocator ? *allocator : default_allocator;
 
 	/* Check that required arguments are given */
 	if (!plugin_uri) {
@@ -265,7 +531,11 @@ LV2Apply* LV2Apply_instantiatePlugin(LilvWorld* world, const char* plugin_uri, f
 
 	/* Create port structures */
 	if (create_ports(&self, world)) {
-		return NULL;
+		return fatal(&self, 0, "Unable to allocate ports for plugin `%s'\n", plugin_uri);
+	}
+	self.latency_port = -1;
+	if (lilv_plugin_has_latency(plugin)) {
+		self.latency_port = lilv_plugin_get_latency_port_index(plugin);
 	}
 
 	LilvNode* rt_feature = lilv_new_uri(world,
@@ -290,20 +560,21 @@ LV2Apply* LV2Apply_instantiatePlugin(LilvWorld* world, const char* plugin_uri, f
 		self.ports[lilv_port_get_index(plugin, port)].value = param->value;
 	}
 
-	/* Prepare arrays for pointers that will hold inputs and outputs */
-	self.in_bufs = calloc(self.n_audio_in, sizeof(float*));
-	self.out_bufs = calloc(self.n_audio_out, sizeof(float*));
-
-	/* Instantiate plugin */
-	self.instance = lilv_plugin_instantiate(
-		self.plugin, sampleRate, features);
-	if(!self.instance) {
-		return fatal(&self, 0, "Unable to instantiate plugin `%s'\n", plugin_uri);
+	/* Prepare arrays for pointers that will hold inputs and outputs,
+	 * right after the ports. Those with no entries are left NULL */
+	self.in_bufs = allocate_array(&self, self.n_audio_in, sizeof(float*));
+	self.out_bufs = allocate_array(&self, self.n_audio_out, sizeof(float*));
+	self.atom_in_bufs = allocate_array(&self, self.n_atom_in, sizeof(void*));
+	self.atom_out_bufs = allocate_array(&self, self.n_atom_out, sizeof(void*));
+	self.n_copies = 1;
+	self.instances = self.allocator.allocate(self.allocator.handle, sizeof(LilvInstance*));
+	self.activated = self.allocator.allocate(self.allocator.handle, sizeof(bool));
+	if (!self.instances || !self.activated) {
+		return fatal(&self, 0, "Unable to allocate memory for plugin `%s'\n", plugin_uri);
 	}
-	lilv_instance_activate(self.instance);
 
 	// Success: let's finally allocate memory and copy
-	LV2Apply* ret = (LV2Apply*)malloc(sizeof(LV2Apply));
+	LV2Apply* ret = (LV2Apply*)self.allocator.allocate(self.allocator.handle, sizeof(LV2Apply));
 	if(!ret){
 		return fatal(&self, 0, "Unable to allocate memory for plugin `%s'\n", plugin_uri);
 	}
@@ -311,7 +582,182 @@ LV2Apply* LV2Apply_instantiatePlugin(LilvWorld* world, const char* plugin_uri, f
 	return ret;
 }
 
-LilvWorld* LV2Apply_initializeWorld()
+LV2Apply* LV2Apply_instantiatePluginWithAllocator(LilvWorld* world, const char* plugin_uri, float sampleRate, const LV2_Feature** features, const LV2Apply_Allocator* allocator)
+{
+	LV2Apply* self = LV2Apply_describePluginWithAllocator(world, plugin_uri, allocator);
+	if (!self) {
+		return NULL;
+	}
+	if (!LV2Apply_openLibrary(self) ||
+	    !LV2Apply_instantiate(self, 0, sampleRate, features)) {
+		LV2Apply_free(self);
+		return NULL;
+	}
+	LV2Apply_activate(self, 0);
+	return self;
+}
+
+/* Grow `*array` from `n` entries of `size` bytes to `n_copies` times as
+   many, repeating the first `n` */
+static bool
+repeat_array(LV2Apply* self, void** array, size_t n, size_t size, unsigned n_copies)
+{
+	/* an empty array stays NULL */
+	if (!n) {
+		return true;
+	}
+	LV2Apply_Allocator* a = &self->allocator;
+	char* grown = (char*)a->allocate(a->handle, n * size * n_copies);
+	if (!grown) {
+		return false;
+	}
+	for (unsigned k = 0; k < n_copies; ++k) {
+		memcpy(grown + k * n * size, *array, n * size);
+	}
+	a->release(a->handle, *array);
+	*array = grown;
+	return true;
+}
+
+bool LV2Apply_setCopies(LV2Apply* self, unsigned int n_copies)
+{
+	if (self->n_copies != 1 || self->instances[0] || n_copies < 1) {
+		return false;
+	}
+	if (n_copies == 1) {
+		return true;
+	}
+	void* ports = self->ports;
+	void* in_bufs = self->in_bufs;
+	void* out_bufs = self->out_bufs;
+	void* atom_in_bufs = self->atom_in_bufs;
+	void* atom_out_bufs = self->atom_out_bufs;
+	void* instances = self->instances;
+	void* activated = self->activated;
+	bool ok = repeat_array(self, &ports, self->n_ports, sizeof(Port), n_copies);
+	self->ports = ports;
+	ok = ok && repeat_array(self, &in_bufs, self->n_audio_in, sizeof(float*), n_copies);
+	self->in_bufs = in_bufs;
+	ok = ok && repeat_array(self, &out_bufs, self->n_audio_out, sizeof(float*), n_copies);
+	self->out_bufs = out_bufs;
+	ok = ok && repeat_array(self, &atom_in_bufs, self->n_atom_in, sizeof(void*), n_copies);
+	self->atom_in_bufs = atom_in_bufs;
+	ok = ok && repeat_array(self, &atom_out_bufs, self->n_atom_out, sizeof(void*), n_copies);
+	self->atom_out_bufs = atom_out_bufs;
+	ok = ok && repeat_array(self, &instances, 1, sizeof(LilvInstance*), n_copies);
+	self->instances = instances;
+	ok = ok && repeat_array(self, &activated, 1, sizeof(bool), n_copies);
+	self->activated = activated;
+	if (!ok) {
+		fprintf(stderr, "error: Unable to allocate %u copies of plugin `%s'\n",
+			n_copies, lilv_node_as_uri(lilv_plugin_get_uri(self->plugin)));
+		return false;
+	}
+	self->n_copies = n_copies;
+	self->n_audio_in *= n_copies;
+	self->n_audio_out *= n_copies;
+	self->n_atom_in *= n_copies;
+	self->n_atom_out *= n_copies;
+	return true;
+}
+
+bool LV2Apply_openLibrary(LV2Apply* self)
+{
+	if (self->descriptor) {
+		return true;
+	}
+	const char* uri = lilv_node_as_uri(lilv_plugin_get_uri(self->plugin));
+	char* library_path = lilv_file_uri_parse(
+		lilv_node_as_uri(lilv_plugin_get_library_uri(self->plugin)), NULL);
+	self->bundle_path = lilv_file_uri_parse(
+		lilv_node_as_uri(lilv_plugin_get_bundle_uri(self->plugin)), NULL);
+	if (!library_path || !self->bundle_path) {
+		fprintf(stderr, "error: Plugin `%s' has no local library\n", uri);
+		lilv_free(library_path);
+		return false;
+	}
+	/* the same lookup as lilv_plugin_instantiate(), which keeps its
+	   libraries in the world */
+	self->library = dlopen(library_path, RTLD_NOW);
+	if (!self->library) {
+		fprintf(stderr, "error: Unable to open library %s (%s)\n",
+			library_path, dlerror());
+		lilv_free(library_path);
+		return false;
+	}
+	LV2_Descriptor_Function get_descriptor =
+		(LV2_Descriptor_Function)dlsym(self->library, "lv2_descriptor");
+	for (uint32_t i = 0; get_descriptor && !self->descriptor; ++i) {
+		const LV2_Descriptor* descriptor = get_descriptor(i);
+		if (!descriptor) {
+			break;
+		}
+		if (!strcmp(descriptor->URI, uri)) {
+			self->descriptor = descriptor;
+		}
+	}
+	if (!self->descriptor) {
+		fprintf(stderr, "error: Plugin `%s' not found in %s\n", uri, library_path);
+	}
+	lilv_free(library_path);
+	return self->descriptor != NULL;
+}
+
+bool LV2Apply_instantiate(LV2Apply* self, unsigned int copy, float sampleRate, const LV2_Feature** features)
+{
+	static const LV2_Feature* const no_features[] = { NULL };
+	const LV2_Descriptor* descriptor = self->descriptor;
+	LV2_Handle handle = NULL;
+	if (descriptor) {
+		handle = descriptor->instantiate(descriptor, sampleRate, self->bundle_path,
+			features ? features : no_features);
+	}
+	LilvInstance* instance = handle ? (LilvInstance*)calloc(1, sizeof(LilvInstance)) : NULL;
+	if (!instance) {
+		fprintf(stderr, "error: Unable to instantiate plugin `%s'\n",
+			descriptor ? descriptor->URI : "(library not open)");
+		if (handle) {
+			descriptor->cleanup(handle);
+		}
+		return false;
+	}
+	instance->lv2_descriptor = descriptor;
+	instance->lv2_handle = handle;
+	/* like lilv, leave all the ports disconnected */
+	for (uint32_t i = 0; i < self->n_ports; ++i) {
+		descriptor->connect_port(handle, i, NULL);
+	}
+	self->instances[copy] = instance;
+	if (copy == 0) {
+		self->instance = instance;
+	}
+	return true;
+}
+
+void LV2Apply_activate(LV2Apply* self, unsigned int copy)
+{
+	lilv_instance_activate(self->instances[copy]);
+	self->activated[copy] = true;
+}
+
+void LV2Apply_connectPort(LV2Apply* self, unsigned int port, void* data)
+{
+	lilv_instance_connect_port(self->instances[port / self->n_ports], port % self->n_ports, data);
+}
+
+void LV2Apply_run(LV2Apply* self, unsigned int nFrames)
+{
+	for (unsigned k = 0; k < self->n_copies; ++k) {
+		lilv_instance_run(self->instances[k], nFrames);
+	}
+}
+
+void LV2Apply_runCopy(LV2Apply* self, unsigned int copy, unsigned int nFrames)
+{
+	lilv_instance_run(self->instances[copy], nFrames);
+}
+
+LilvWorld* LV2Apply_initializeEmptyWorld()
 {
 	/* Create world */
 	LilvWorld* world = lilv_world_new();
@@ -320,6 +766,14 @@ LilvWorld* LV2Apply_initializeWorld()
 		fprintf(stderr, "Initializing LilvWorld failed\n");
 		return NULL;
 	}
+	return world;
+}
+
+LilvWorld* LV2Apply_initializeWorld()
+{
+	LilvWorld* world = LV2Apply_initializeEmptyWorld();
+	if(!world)
+		return NULL;
 	/* Discover world */
 	lilv_world_load_all(world);
 	return world;
@@ -554,14 +1008,14 @@ void LV2Apply_getPortCount(LV2Apply* self, unsigned int* in_audio,
 	*out_audio = 0;
 	*in_ctl = 0;
 	*out_ctl = 0;
-	for (uint32_t p = 0; p < self->n_ports; ++p) {
+	for (uint32_t p = 0; p < self->n_ports * self->n_copies; ++p) {
 		if (self->ports[p].type == TYPE_CONTROL) {
 			if (self->ports[p].is_input) {
 				(*in_ctl)++;
 			} else {
 				(*out_ctl)++;
 			}
-		} else {
+		} else if (self->ports[p].type == TYPE_AUDIO) {
 			if (self->ports[p].is_input) {
 				(*in_audio)++;
 			} else {
@@ -576,153 +1030,151 @@ void LV2Apply_getPortCount(LV2Apply* self, unsigned int* in_audio,
 }
 // in_buf must point to self.n_audio_in arrays n_frames long
 // out_buf must point to self.n_audio_out arrays n_frames long
+// atom_in_bufs and atom_out_bufs must point to atom sequences
 void LV2Apply_connectPorts(LV2Apply* self)
 {
-	/* Connect ports */
-	const LilvPlugin* plugin = self->plugin;
-	const uint32_t n_ports = lilv_plugin_get_num_ports(plugin);
+	/* Connect ports, those of each copy to its share of the buffers */
 	float** in_bufs = self->in_bufs;
 	float** out_bufs = self->out_bufs;
-	for (uint32_t p = 0, i = 0, o = 0; p < n_ports; ++p) {
+	uint32_t ai = 0, ao = 0;
+	for (uint32_t p = 0, i = 0, o = 0; p < self->n_ports * self->n_copies; ++p) {
 		if (self->ports[p].type == TYPE_CONTROL) {
-			lilv_instance_connect_port(self->instance, p, &self->ports[p].value);
+			LV2Apply_connectPort(self, p, &self->ports[p].value);
 		} else if (self->ports[p].type == TYPE_AUDIO) {
 			if (self->ports[p].is_input) {
-				lilv_instance_connect_port(self->instance, p, in_bufs[i++]);
+				LV2Apply_connectPort(self, p, in_bufs[i++]);
 			} else {
-				lilv_instance_connect_port(self->instance, p, out_bufs[o++]);
+				LV2Apply_connectPort(self, p, out_bufs[o++]);
+			}
+		} else if (self->ports[p].type == TYPE_ATOM) {
+			if (self->ports[p].is_input) {
+				LV2Apply_connectPort(self, p, self->atom_in_bufs[ai++]);
+			} else {
+				LV2Apply_connectPort(self, p, self->atom_out_bufs[ao++]);
 			}
 		} else {
-			lilv_instance_connect_port(self->instance, p, NULL);
+			LV2Apply_connectPort(self, p, NULL);
 		}
 	}
 }
 
-void LV2Apply_getPortRanges(LV2Apply* self, unsigned int index, float* min, float* max, float* defaultValue)
+// connect the audio ports only, `offset` frames into in_bufs and out_bufs
+void LV2Apply_connectAudioPorts(LV2Apply* self, unsigned int offset)
 {
-	const LilvPlugin* plugin = self->plugin;
-	const uint32_t num_ports = lilv_plugin_get_num_ports(plugin);
-	if(index >= num_ports)
-		return;
-	float* mins     = (float*)calloc(num_ports, sizeof(float));
-	float* maxes    = (float*)calloc(num_ports, sizeof(float));
-	float* defaults = (float*)calloc(num_ports, sizeof(float));
-	lilv_plugin_get_port_ranges_float(plugin, mins, maxes, defaults);
-
-	*min = mins[index];
-	*max = maxes[index];
-	*defaultValue = defaults[index];
-
-	free(mins);
-	free(maxes);
-	free(defaults);
+	float** in_bufs = self->in_bufs;
+	float** out_bufs = self->out_bufs;
+	for (uint32_t p = 0, i = 0, o = 0; p < self->n_ports * self->n_copies; ++p) {
+		if (self->ports[p].type != TYPE_AUDIO)
+			continue;
+		if (self->ports[p].is_input) {
+			LV2Apply_connectPort(self, p, in_bufs[i++] + offset);
+		} else {
+			LV2Apply_connectPort(self, p, out_bufs[o++] + offset);
+		}
+	}
 }
 
-const char* LV2Apply_getPortName(LV2Apply* self, unsigned int index)
+// the index of the port of the `channel`-th audio input or output, or -1
+int LV2Apply_getAudioPortIndex(LV2Apply* self, unsigned int channel, bool is_input)
 {
-	const LilvPlugin* plugin = self->plugin;
-	const LilvPort* port = lilv_plugin_get_port_by_index(plugin, index);
-	if (!port)
-		return NULL;
-	LilvNode* name = lilv_port_get_name(plugin, port);
-	const char* ret = lilv_node_as_string(name);
-	lilv_node_free(name);
-
-	return ret;
+	for (uint32_t p = 0; p < self->n_ports * self->n_copies; ++p) {
+		if (self->ports[p].type != TYPE_AUDIO || self->ports[p].is_input != is_input)
+			continue;
+		if (0 == channel--)
+			return p;
+	}
+	return -1;
 }
 
-port_type_t LV2Apply_getControlPortType(LV2Apply* self, LilvWorld* world, unsigned int index)
+// the index of the port of the `channel`-th atom input or output, or -1
+int LV2Apply_getAtomPortIndex(LV2Apply* self, unsigned int channel, bool is_input)
 {
-
-	LilvNode* control_class = lilv_new_uri(world, LILV_URI_CONTROL_PORT);
-	LilvNode* input_class = lilv_new_uri(world, LILV_URI_INPUT_PORT);
-
-	LilvNode* enum_property = lilv_new_uri(world, "http://lv2plug.in/ns/lv2core#enumeration");
-	LilvNode* int_property= lilv_new_uri(world, "http://lv2plug.in/ns/lv2core#integer");
-	LilvNode* toggled_property= lilv_new_uri(world, "http://lv2plug.in/ns/lv2core#toggled");
-
-	const LilvPlugin* plugin = self->plugin;
-	const LilvPort* port = lilv_plugin_get_port_by_index(plugin, index);
-	if (!port)
-		return kNotControl;
-	if (!lilv_port_is_a(plugin, port, input_class))
-		return kNotControl;
-	if (!lilv_port_is_a(plugin, port, control_class))
-		return kNotControl;
-
-	port_type_t retVal = kFloat;
-	if(lilv_port_has_property(plugin, port, toggled_property))
-	{
-		retVal = kToggle;
-	}
-	else if (lilv_port_has_property(plugin, port, enum_property))
-	{
-		retVal = kEnumerated;
+	for (uint32_t p = 0; p < self->n_ports * self->n_copies; ++p) {
+		if (self->ports[p].type != TYPE_ATOM || self->ports[p].is_input != is_input)
+			continue;
+		if (0 == channel--)
+			return p;
 	}
-	else if (lilv_port_has_property(plugin, port, int_property))
-	{
-		retVal = kInteger;
-	};
-
-
-	lilv_node_free(control_class);
-	lilv_node_free(input_class);
-	lilv_node_free(enum_property);
-	lilv_node_free(int_property);
-	lilv_node_free(toggled_property);
-
-	return retVal;
+	return -1;
 }
 
-int LV2Apply_getPortIndex(LV2Apply* self, LilvWorld* world, char* symbol)
+const LV2Apply_PortInfo* LV2Apply_getPortInfo(LV2Apply* self, unsigned int index)
 {
-	const LilvPlugin* plugin = self->plugin;
-	LilvNode* symbol_node = lilv_new_string(world, symbol);
-	const LilvPort* port = lilv_plugin_get_port_by_symbol(plugin, symbol_node);
-	int index = lilv_port_get_index(plugin, port);
-	lilv_node_free(symbol_node);
-	return index;
+	if (index >= self->n_ports) {
+		return NULL;
+	}
+	return &self->port_info[index];
 }
 
-bool LV2Apply_isLogarithmic(LV2Apply* self, LilvWorld* world, unsigned int index)
+void LV2Apply_getPortRanges(LV2Apply* self, unsigned int index, float* min, float* max, float* defaultValue)
 {
-	LilvNode* log_property = lilv_new_uri(world, "http://lv2plug.in/ns/ext/port-props#logarithmic");
-
-	const LilvPlugin* plugin = self->plugin;
-	const LilvPort* port = lilv_plugin_get_port_by_index(plugin, index);
-
-	bool ret = false;
-	if(lilv_port_has_property(plugin, port, log_property))
-		ret = true;
-
-	lilv_node_free(log_property);
-
-	return ret;
+	const LV2Apply_PortInfo* info = LV2Apply_getPortInfo(self, index);
+	if (!info)
+		return;
+	*min = info->min;
+	*max = info->max;
+	*defaultValue = info->default_value;
 }
 
-bool LV2Apply_hasStrictBounds(LV2Apply* self, LilvWorld* world, unsigned int index)
+const char* LV2Apply_getPortName(LV2Apply* self, unsigned int index)
 {
-	LilvNode* strict_property = lilv_new_uri(world, "http://lv2plug.in/ns/ext/port-props#hasStrictBounds");
+	const LV2Apply_PortInfo* info = LV2Apply_getPortInfo(self, index);
+	return info ? info->name : NULL;
+}
 
-	const LilvPlugin* plugin = self->plugin;
-	const LilvPort* port = lilv_plugin_get_port_by_index(plugin, index);
+port_type_t LV2Apply_getControlPortType(LV2Apply* self, unsigned int index)
+{
+	const LV2Apply_PortInfo* info = LV2Apply_getPortInfo(self, index);
+	return info ? info->control_type : kNotControl;
+}
 
-	bool ret = false;
-	if(lilv_port_has_property(plugin, port, strict_property))
-		ret = true;
+int LV2Apply_getPortIndex(LV2Apply* self, const char* symbol)
+{
+	for (uint32_t p = 0; p < self->n_ports; ++p) {
+		if (self->port_info[p].symbol && !strcmp(self->port_info[p].symbol, symbol))
+			return p;
+	}
+	return -1;
+}
 
-	lilv_node_free(strict_property);
+bool LV2Apply_isLogarithmic(LV2Apply* self, unsigned int index)
+{
+	const LV2Apply_PortInfo* info = LV2Apply_getPortInfo(self, index);
+	return info && info->is_logarithmic;
+}
 
-	return ret;
+bool LV2Apply_hasStrictBounds(LV2Apply* self, unsigned int index)
+{
+	const LV2Apply_PortInfo* info = LV2Apply_getPortInfo(self, index);
+	return info && info->has_strict_bounds;
 }
 
 const char* LV2Apply_getPluginName(LV2Apply* self)
 {
-	const LilvPlugin* plugin = self->plugin;
-	LilvNode* plugin_name = lilv_plugin_get_name(plugin);
-	const char* name = lilv_node_as_string(plugin_name);
-	lilv_node_free(plugin_name);
+	return self->name;
+}
 
-	return name;
+unsigned int LV2Apply_getPresets(LV2Apply* self, LilvWorld* world, LV2Apply_PresetCallback callback, void* arg)
+{
+	LilvNode* preset_uri = lilv_new_uri(world, LV2_PRESETS__Preset);
+	LilvNode* label_uri = lilv_new_uri(world, LILV_NS_RDFS "label");
+	LilvNodes* presets = lilv_plugin_get_related(self->plugin, preset_uri);
+	unsigned int n = 0;
+	LILV_FOREACH(nodes, i, presets) {
+		const LilvNode* preset = lilv_nodes_get(presets, i);
+		lilv_world_load_resource(world, preset);
+		LilvNode* label = lilv_world_get(world, preset, label_uri, NULL);
+		callback(arg, lilv_node_as_uri(preset), label ? lilv_node_as_string(label) : NULL);
+		lilv_node_free(label);
+		++n;
+	}
+	lilv_nodes_free(presets);
+	lilv_node_free(label_uri);
+	lilv_node_free(preset_uri);
+	return n;
+}
 
+bool LV2Apply_hasStateInterface(LV2Apply* self)
+{
+	return self->instance && lilv_instance_get_extension_data(self->instance, LV2_STATE__interface);
 }
@@ -17,21 +17,117 @@ typedef enum
 
 typedef struct _lv2apply LV2Apply;
 
+typedef struct
+{
+	float value;
+	const char* label;
+} LV2Apply_ScalePoint;
+
+/** The metadata of a port, resolved when the plugin is instantiated */
+typedef struct
+{
+	const char* name;
+	const char* symbol;
+	/** The URI of the lv2:designation of the port, or NULL */
+	const char* designation;
+	/** kNotControl unless this is a control input */
+	port_type_t control_type;
+	/** NAN when the plugin does not specify them */
+	float min;
+	float max;
+	float default_value;
+	bool is_input;
+	bool is_logarithmic;
+	bool has_strict_bounds;
+	unsigned int n_scale_points;
+	const LV2Apply_ScalePoint* scale_points;
+} LV2Apply_PortInfo;
+
+/** Where the memory for an LV2Apply and its port tables comes from */
+typedef struct
+{
+	/** Return `size` zeroed bytes, or NULL */
+	void* (*allocate)(void* handle, size_t size);
+	void (*release)(void* handle, void* ptr);
+	void* handle;
+} LV2Apply_Allocator;
+
 LV2Apply* LV2Apply_instantiatePlugin(LilvWorld* world, const char* plugin_uri, float sampleRate, const LV2_Feature** features);
+LV2Apply* LV2Apply_instantiatePluginWithAllocator(LilvWorld* world, const char* plugin_uri, float sampleRate, const LV2_Feature** features, const LV2Apply_Allocator* allocator);
+/**
+ * Look a plugin up and prepare its ports, without instantiating it. This
+ * uses the world, so it must not run concurrently with anything else using
+ * the same world.
+ */
+LV2Apply* LV2Apply_describePluginWithAllocator(LilvWorld* world, const char* plugin_uri, const LV2Apply_Allocator* allocator);
+/**
+ * Make a plugin returned by LV2Apply_describePluginWithAllocator() run as
+ * `n_copies` instances side by side, each with its own ports. The audio
+ * and atom ports of the copies are counted one copy after the other, so
+ * that channel c of copy k is channel k * (channels per copy) + c, and so
+ * are their indices in the port table. This has to be called before
+ * instantiating the copies.
+ */
+bool LV2Apply_setCopies(LV2Apply* self, unsigned int n_copies);
+/**
+ * Open the library of a plugin returned by
+ * LV2Apply_describePluginWithAllocator() and find the plugin in it. This
+ * uses the world, so it must not run concurrently with anything else
+ * using the same world.
+ */
+bool LV2Apply_openLibrary(LV2Apply* self);
+/**
+ * Instantiate one copy of a plugin, once its library is open. This only
+ * runs the plugin's code, without going through the world, so copies and
+ * plugins can be instantiated from different threads at the same time.
+ */
+bool LV2Apply_instantiate(LV2Apply* self, unsigned int copy, float sampleRate, const LV2_Feature** features);
+/**
+ * Activate an instantiated copy. This only runs the plugin's code, so
+ * copies and plugins can be activated from different threads at the same
+ * time.
+ */
+void LV2Apply_activate(LV2Apply* self, unsigned int copy);
+/** Connect a port, given by its index in the tables of all the copies */
+void LV2Apply_connectPort(LV2Apply* self, unsigned int port, void* data);
+/** Run all the copies, one after the other */
+void LV2Apply_run(LV2Apply* self, unsigned int nFrames);
+void LV2Apply_runCopy(LV2Apply* self, unsigned int copy, unsigned int nFrames);
 LilvWorld* LV2Apply_initializeWorld();
+/** A world with no bundles loaded yet, see lilv_world_load_bundle() */
+LilvWorld* LV2Apply_initializeEmptyWorld();
+/** The latency reported by the plugin in its last run, in frames */
+unsigned int LV2Apply_getLatency(LV2Apply* self);
 void LV2Apply_cleanup(LV2Apply* self);
+void LV2Apply_free(LV2Apply* self);
 void LV2Apply_cleanupWorld(LilvWorld* world);
 void LV2Apply_printPorts(LilvWorld* world, const LilvPlugin* p);
 void LV2Apply_getPortCount(LV2Apply* self, unsigned int* in_audio,
 	unsigned int* out_audio, unsigned int* in_ctl, unsigned int* out_ctl);
 void LV2Apply_connectPorts(LV2Apply* self);
+void LV2Apply_connectAudioPorts(LV2Apply* self, unsigned int offset);
+int LV2Apply_getAudioPortIndex(LV2Apply* self, unsigned int channel, bool is_input);
+int LV2Apply_getAtomPortIndex(LV2Apply* self, unsigned int channel, bool is_input);
+/** The metadata of a port, or NULL if there is no such port. This does not allocate. */
+const LV2Apply_PortInfo* LV2Apply_getPortInfo(LV2Apply* self, unsigned int index);
 void LV2Apply_getPortRanges(LV2Apply* self, unsigned int index, float* min, float* max, float* defaultValue);
 const char* LV2Apply_getPortName(LV2Apply* self, unsigned int index);
-port_type_t LV2Apply_getControlPortType(LV2Apply* self, LilvWorld* world, unsigned int index);
-int LV2Apply_getPortIndex(LV2Apply* self, LilvWorld* world, char* symbol);
-bool LV2Apply_isLogarithmic(LV2Apply* self, LilvWorld* world, unsigned int index);
-bool LV2Apply_hasStrictBounds(LV2Apply* self, LilvWorld* world, unsigned int index);
+port_type_t LV2Apply_getControlPortType(LV2Apply* self, unsigned int index);
+int LV2Apply_getPortIndex(LV2Apply* self, const char* symbol);
+bool LV2Apply_isLogarithmic(LV2Apply* self, unsigned int index);
+bool LV2Apply_hasStrictBounds(LV2Apply* self, unsigned int index);
 const char* LV2Apply_getPluginName(LV2Apply* self);
+typedef void (*LV2Apply_PresetCallback)(void* arg, const char* uri, const char* label);
+/**
+ * Call `callback` with the URI and the label (NULL if it has none) of each
+ * preset of the plugin. This uses the world, in the same way as
+ * LV2Apply_describePluginWithAllocator().
+ *
+ * @return the number of presets
+ */
+unsigned int LV2Apply_getPresets(LV2Apply* self, LilvWorld* world, LV2Apply_PresetCallback callback, void* arg);
+/** True if the plugin saves and restores a state of its own, beyond its control values */
+bool LV2Apply_hasStateInterface(LV2Apply* self);
 
 
 #ifdef __cplusplus
@@ -4,10 +4,11 @@ typedef struct Param {
 	float       value;  ///< Control value
 } Param;
 
-/** Port type (only float ports are supported) */
+/** Port type (float ports and atom sequences are supported) */
 typedef enum {
 	TYPE_CONTROL,
-	TYPE_AUDIO
+	TYPE_AUDIO,
+	TYPE_ATOM
 } PortType;
 
 /** Runtime port information */
@@ -20,12 +21,14 @@ typedef struct {
 	float           value;      ///< Control value (if applicable)
 	bool            is_input;   ///< True iff an input port
 	bool            optional;   ///< True iff connection optional
+	uint32_t        min_size;   ///< Minimum buffer size in bytes (atom ports)
+	bool            supports_midi; ///< True iff an atom port supports MIDI
 } Port;
 
 /** Application state */
 typedef struct _lv2apply {
 	const LilvPlugin* plugin;
-	LilvInstance*     instance;
+	LilvInstance*     instance;   ///< The first copy
 	unsigned          n_params;
 	Param*            params;
 	unsigned          n_ports;
@@ -33,7 +36,21 @@ typedef struct _lv2apply {
 	unsigned          n_audio_out;
 	float** in_bufs;
 	float** out_bufs;
-	Port*             ports;
+	unsigned          n_atom_in;
+	unsigned          n_atom_out;
+	void** atom_in_bufs;
+	void** atom_out_bufs;
+	Port*             ports;      ///< The ports of each copy, one copy after the other
+	LV2Apply_PortInfo* port_info; ///< Metadata of the ports, and their strings
+	const char*       name;       ///< Plugin name, in the block of port_info
+	int               latency_port;
+	unsigned          n_copies;   ///< Instances of the plugin, see LV2Apply_setCopies()
+	LilvInstance**    instances;  ///< The instance of each copy
+	void*             library;    ///< The plugin library, see LV2Apply_openLibrary()
+	const LV2_Descriptor* descriptor; ///< The plugin in the library
+	char*             bundle_path;
+	bool*             activated;  ///< Whether each copy has been activated
 	bool bypass;
+	LV2Apply_Allocator allocator;
 } LV2Apply;
 
@@ -1,10 +1,21 @@
 #include <Bela.h>
 #include <vector>
+#include <atomic>
 #include "Lv2Host.h"
 #include <libraries/OnePole/OnePole.h>
 #include <libraries/Scope/Scope.h>
 
 Lv2Host gLv2Host;
+// bypass() rebuilds the render plan, so it is called from an auxiliary task
+AuxiliaryTask gBypassTask;
+// written by render(), read by updateBypass()
+std::atomic<bool> gPluginsOn[2] = {{false}, {false}};
+
+void updateBypass(void*)
+{
+	for(int n = 0; n < 2 && n < gLv2Host.count(); ++n)
+		gLv2Host.bypass(n, !gPluginsOn[n].load());
+}
 
 Scope scope;
 
@@ -36,10 +47,10 @@ void Bela_userSettings(BelaInitSettings *settings)
 bool setup(BelaContext* context, void* userData)
 {
 	
-	// these should be initialized by Bela_userSettings above
-	if((context->flags & BELA_FLAG_INTERLEAVED) || context->audioSampleRate != context->analogSampleRate)
+	// this should be initialized by Bela_userSettings above
+	if(context->audioSampleRate != context->analogSampleRate)
 	{
-		fprintf(stderr, "Using Lv2Host requires non-interleaved buffers and uniform sample rate\n");
+		fprintf(stderr, "Using Lv2Host requires a uniform sample rate\n");
 		return false;
 	}
 	if(!gLv2Host.setup(context->audioSampleRate, context->audioFrames,
@@ -52,15 +63,14 @@ bool setup(BelaContext* context, void* userData)
 	std::vector<std::string> lv2Chain;
 	lv2Chain.emplace_back("http://calf.sourceforge.net/plugins/SidechainGate");
 	lv2Chain.emplace_back("http://calf.sourceforge.net/plugins/Compressor");
-	for(auto &name : lv2Chain)
-	{
-		gLv2Host.add(name);
-	}
+	gLv2Host.addChain(lv2Chain);
 	if(0 == gLv2Host.count())
 	{
 		fprintf(stderr, "No plugins were successfully instantiated\n");
 		return false;	
 	}
+	gBypassTask = Bela_createAuxiliaryTask(updateBypass, 50, "lv2host-bypass");
+	updateBypass(NULL);
 
 	if(context->analogFrames)
 		gAudioFramesPerAnalogFrame = context->audioFrames / context->analogFrames;
@@ -71,7 +81,7 @@ bool setup(BelaContext* context, void* userData)
 
 	// Gate
 
-	gLv2Host.setPort(0, 6, 1); // Bypass
+	gLv2Host.setPort(0, 6, 0); // Bypass: done by the host instead
 	gLv2Host.setPort(0, 7, 1); // Input
 	gLv2Host.setPort(0, 12, 0.06); // Max Gain Reduction
 	gLv2Host.setPort(0, 13, 0.07); // Threshold
@@ -92,7 +102,7 @@ bool setup(BelaContext* context, void* userData)
 
 	// Compressor
 
-	gLv2Host.setPort(1, 4, 1); // Bypass
+	gLv2Host.setPort(1, 4, 0); // Bypass: done by the host instead
 	gLv2Host.setPort(1, 5, 1); // Input
 	gLv2Host.setPort(1, 10, 0.01); // Threshold
 	gLv2Host.setPort(1, 11, 6); // Ratio
@@ -115,21 +125,19 @@ bool setup(BelaContext* context, void* userData)
 
 void render(BelaContext* context, void* userData)
 {
-	static bool pluginsOn[2] = {false, false};
+	bool pluginsWereOn[2] = {gPluginsOn[0].load(), gPluginsOn[1].load()};
 
 	// Set control values 
 	// Pot 0 -- Gate Threshold
 	float gateThresholdVal = processPot(0, analogReadNI(context, 0, gControlPins[0]), 0.0, 0.5);
 	gLv2Host.setPort(0, 13, gateThresholdVal);
 
-	if(gateThresholdVal == 0.0 && pluginsOn[0]) {
-		gLv2Host.setPort(0, 6, 1);
+	if(gateThresholdVal == 0.0 && gPluginsOn[0]) {
 		rt_printf("Gate OFF\n");
-		pluginsOn[0] = false;
-	} else if (gateThresholdVal > 0.0 && !pluginsOn[0]) {
-		gLv2Host.setPort(0, 6, 0);
+		gPluginsOn[0] = false;
+	} else if (gateThresholdVal > 0.0 && !gPluginsOn[0]) {
 		rt_printf("Gate ON\n");
-		pluginsOn[0] = true;
+		gPluginsOn[0] = true;
 	}
 
 	// Pot 1 -- Gate Ratio
@@ -139,36 +147,46 @@ void render(BelaContext* context, void* userData)
 	// Pot 2 -- Compressor Drive (threshold)
 	float compInputVal = processPot(2, analogReadNI(context, 0, gControlPins[2]), 0.0, 1.0);
 	gLv2Host.setPort(1, 10, compInputVal);
-	if(compInputVal == 0.0 && pluginsOn[1]) {
-		gLv2Host.setPort(1, 4, 1);
+	if(compInputVal == 0.0 && gPluginsOn[1]) {
 		rt_printf("Compressor OFF\n");
-		pluginsOn[1] = false;
-	} else if (compInputVal > 0.0 && !pluginsOn[1]) {
-		gLv2Host.setPort(1, 4, 0);
+		gPluginsOn[1] = false;
+	} else if (compInputVal > 0.0 && !gPluginsOn[1]) {
 		rt_printf("Compressor ON\n");
-		pluginsOn[1] = true;
+		gPluginsOn[1] = true;
 	}
+	if(pluginsWereOn[0] != gPluginsOn[0] || pluginsWereOn[1] != gPluginsOn[1])
+		Bela_scheduleAuxiliaryTask(gBypassTask);
+
 	// Pot 3 -- Compressor Release
 	float compReleaseVal = processPot(3, analogReadNI(context, 0, gControlPins[3]), 0.01, 1999);
 	gLv2Host.setPort(1, 13, compReleaseVal);
 
-	// set inputs and outputs
-	const float* inputs[context->audioInChannels];
-	float* outputs[context->audioOutChannels];
-	for(unsigned int ch = 0; ch < context->audioInChannels; ++ch)
-		inputs[ch] = (float*)&context->audioIn[context->audioFrames * ch];
-	for(unsigned int ch = 0; ch < context->audioOutChannels; ++ch)
-		outputs[ch] = &context->audioOut[context->audioFrames * ch];
-
-	// do the actual processing on the buffers specified above
-	gLv2Host.render(context->audioFrames, inputs, outputs);
+	// non-interleaved buffers are passed to the plugins as they are
+	if(context->flags & BELA_FLAG_INTERLEAVED)
+	{
+		gLv2Host.renderInterleaved(context->audioFrames, context->audioIn, context->audioOut, Lv2Host::kSampleFloat);
+	} else {
+		// set inputs and outputs
+		const float* inputs[context->audioInChannels];
+		float* outputs[context->audioOutChannels];
+		for(unsigned int ch = 0; ch < context->audioInChannels; ++ch)
+			inputs[ch] = (float*)&context->audioIn[context->audioFrames * ch];
+		for(unsigned int ch = 0; ch < context->audioOutChannels; ++ch)
+			outputs[ch] = &context->audioOut[context->audioFrames * ch];
+
+		// do the actual processing on the buffers specified above
+		gLv2Host.render(context->audioFrames, inputs, outputs);
+	}
 
 	float compThres = gLv2Host.getPortValue(1, 10);
 	float compGainReduction = gLv2Host.getPortValue(1, 18);
 
 	// Log input, output, compressor's threshold and compressor's gain reduction into scope
+	bool interleaved = context->flags & BELA_FLAG_INTERLEAVED;
+	unsigned int inStride = interleaved ? context->audioInChannels : 1;
+	unsigned int outStride = interleaved ? context->audioOutChannels : 1;
 	for(unsigned int n = 0; n < context->audioFrames; n++)
-		scope.log(audioReadNI(context, n, 0), context->audioOut[context->audioFrames*0+n], compGainReduction, compThres);
+		scope.log(context->audioIn[n * inStride], context->audioOut[n * outStride], compGainReduction, compThres);
 
 }
 
@@ -16,52 +16,135 @@
 
 #include "symap.h"
 
-#include <assert.h>
-#include <stdbool.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
 
 /**
-  @file symap.c Implementation of Symap, a basic symbol map (string interner).
-
-  This implementation is primitive, but has some desirable qualities: good
-  (O(lg(n)) lookup performance for already-mapped symbols, minimal space
-  overhead, extremely fast (O(1)) reverse mapping (ID to string), simple code,
-  no dependencies.
-
-  The tradeoff is that mapping new symbols may be quite slow.  In other words,
-  this implementation is ideal for use cases with a relatively limited set of
-  symbols, or where most symbols are mapped early.  It will not fare so well
-  with very dynamic sets of symbols.  For that, you're better off with a
-  tree-based implementation (and the associated space cost, especially if you
-  need reverse mapping).
+  @file symap.c Implementation of Symap, a concurrent symbol map (string
+  interner).
+
+  Symbols are kept in an open-addressing hash table of IDs, and their
+  strings are copied into large blocks, so that mapping a new symbol costs
+  O(1) and rarely allocates.
+
+  Any number of threads can map and unmap symbols at the same time. Looking
+  up a symbol that is already mapped and unmapping an ID are lock-free:
+  nothing a reader can reach is ever moved or freed until the map is.
+  Adding a symbol takes a lock. When the hash table grows, the old one is
+  kept, still valid for the symbols it holds, until the map is freed.
 */
 
+/** Strings are copied into blocks of at least this size */
+#define SYMAP_BLOCK_SIZE 4096
+
+/** The first chunk of the ID table has this many entries, the next
+    ones twice as many as the previous one */
+#define SYMAP_FIRST_CHUNK 64
+#define SYMAP_MAX_CHUNKS 26
+
+#define SYMAP_INITIAL_CAPACITY 256
+
+typedef struct {
+	uint32_t hash;
+	char     str[];
+} SymapEntry;
+
+typedef struct SymapTable {
+	/** The IDs, 0 for empty slots */
+	uint32_t*          ids;
+	uint32_t           mask;
+	/** The table this one replaced */
+	struct SymapTable* previous;
+} SymapTable;
+
+typedef struct SymapBlock {
+	struct SymapBlock* next;
+	size_t             used;
+	size_t             size;
+	char               data[];
+} SymapBlock;
+
 struct SymapImpl {
-	/**
-	   Unsorted array of strings, such that the symbol for ID i is found
-	   at symbols[i - 1].
-	*/
-	char** symbols;
+	/** The hash table currently in use */
+	SymapTable* table;
 
 	/**
-	   Array of IDs, sorted by corresponding string in `symbols`.
+	   The entry of each ID, in chunks that never move, such that the
+	   entry for ID i is at index i - 1 of their concatenation.
 	*/
-	uint32_t* index;
+	SymapEntry** chunks[SYMAP_MAX_CHUNKS];
 
-	/**
-	   Number of symbols (number of items in `symbols` and `index`).
-	*/
+	/** Number of symbols */
 	uint32_t size;
+
+	/** Where the strings are copied to */
+	SymapBlock* blocks;
+
+	/** Held while adding symbols */
+	pthread_mutex_t mutex;
 };
 
+static uint32_t
+symap_hash(const char* sym)
+{
+	/* FNV-1a */
+	uint32_t hash = 2166136261u;
+	for (const unsigned char* c = (const unsigned char*)sym; *c; ++c) {
+		hash = (hash ^ *c) * 16777619u;
+	}
+	return hash;
+}
+
+/** Find the chunk and the offset in it of the entry of ID `id` */
+static void
+symap_locate(uint32_t id, uint32_t* chunk, uint32_t* offset)
+{
+	const uint32_t i = id - 1;
+	const uint32_t k = 31 - __builtin_clz(i / SYMAP_FIRST_CHUNK + 1);
+	*chunk  = k;
+	*offset = i - SYMAP_FIRST_CHUNK * ((1u << k) - 1);
+}
+
+static SymapEntry*
+symap_entry(const Symap* map, uint32_t id)
+{
+	uint32_t chunk, offset;
+	symap_locate(id, &chunk, &offset);
+	SymapEntry** entries = __atomic_load_n(&map->chunks[chunk], __ATOMIC_ACQUIRE);
+	return __atomic_load_n(&entries[offset], __ATOMIC_ACQUIRE);
+}
+
+static SymapTable*
+symap_table_new(uint32_t capacity, SymapTable* previous)
+{
+	SymapTable* table = (SymapTable*)malloc(sizeof(SymapTable));
+	if (!table) {
+		return NULL;
+	}
+	table->ids = (uint32_t*)calloc(capacity, sizeof(uint32_t));
+	if (!table->ids) {
+		free(table);
+		return NULL;
+	}
+	table->mask     = capacity - 1;
+	table->previous = previous;
+	return table;
+}
+
 Symap*
 symap_new(void)
 {
-	Symap* map = (Symap*)malloc(sizeof(Symap));
-	map->symbols = NULL;
-	map->index   = NULL;
-	map->size    = 0;
+	Symap* map = (Symap*)calloc(1, sizeof(Symap));
+	if (!map) {
+		return NULL;
+	}
+	map->table = symap_table_new(SYMAP_INITIAL_CAPACITY, NULL);
+	if (!map->table) {
+		free(map);
+		return NULL;
+	}
+	pthread_mutex_init(&map->mutex, NULL);
 	return map;
 }
 
@@ -72,103 +155,153 @@ symap_free(Symap* map)
 		return;
 	}
 
-	for (uint32_t i = 0; i < map->size; ++i) {
-		free(map->symbols[i]);
+	for (SymapTable* t = map->table; t;) {
+		SymapTable* previous = t->previous;
+		free(t->ids);
+		free(t);
+		t = previous;
 	}
-
-	free(map->symbols);
-	free(map->index);
+	for (uint32_t k = 0; k < SYMAP_MAX_CHUNKS; ++k) {
+		free(map->chunks[k]);
+	}
+	for (SymapBlock* b = map->blocks; b;) {
+		SymapBlock* next = b->next;
+		free(b);
+		b = next;
+	}
+	pthread_mutex_destroy(&map->mutex);
 	free(map);
 }
 
-static char*
-symap_strdup(const char* str)
+/** Look `sym` up in `table`, return its ID or 0 */
+static uint32_t
+symap_search(const Symap* map, const SymapTable* table, const char* sym, uint32_t hash)
 {
-	const size_t len  = strlen(str);
-	char*        copy = (char*)malloc(len + 1);
-	memcpy(copy, str, len + 1);
-	return copy;
+	for (uint32_t i = hash & table->mask;; i = (i + 1) & table->mask) {
+		const uint32_t id = __atomic_load_n(&table->ids[i], __ATOMIC_ACQUIRE);
+		if (!id) {
+			return 0;
+		}
+		const SymapEntry* entry = symap_entry(map, id);
+		if (entry->hash == hash && !strcmp(entry->str, sym)) {
+			return id;
+		}
+	}
 }
 
-/**
-   Return the index into map->index (not the ID) corresponding to `sym`,
-   or the index where a new entry for `sym` should be inserted.
-*/
-static uint32_t
-symap_search(const Symap* map, const char* sym, bool* exact)
+/** Put `id` in the first free slot for `hash`, the caller holds the lock */
+static void
+symap_insert(SymapTable* table, uint32_t id, uint32_t hash)
 {
-	*exact = false;
-	if (map->size == 0) {
-		return 0;  // Empty map, insert at 0
-	} else if (strcmp(map->symbols[map->index[map->size - 1] - 1], sym) < 0) {
-		return map->size;  // Greater than last element, append
-	}
-
-	uint32_t lower = 0;
-	uint32_t upper = map->size - 1;
-	uint32_t i     = upper;
-	int      cmp;
-
-	while (upper >= lower) {
-		i   = lower + ((upper - lower) / 2);
-		cmp = strcmp(map->symbols[map->index[i] - 1], sym);
-
-		if (cmp == 0) {
-			*exact = true;
-			return i;
-		} else if (cmp > 0) {
-			if (i == 0) {
-				break;  // Avoid underflow
-			}
-			upper = i - 1;
+	uint32_t i = hash & table->mask;
+	while (table->ids[i]) {
+		i = (i + 1) & table->mask;
+	}
+	__atomic_store_n(&table->ids[i], id, __ATOMIC_RELEASE);
+}
+
+/** Copy `sym` into the string blocks, the caller holds the lock */
+static SymapEntry*
+symap_store(Symap* map, const char* sym, uint32_t hash)
+{
+	const size_t len  = strlen(sym);
+	size_t       size = sizeof(SymapEntry) + len + 1;
+	size = (size + sizeof(uint32_t) - 1) & ~(sizeof(uint32_t) - 1);
+	SymapBlock* block = map->blocks;
+	if (!block || block->size - block->used < size) {
+		const size_t block_size = size > SYMAP_BLOCK_SIZE ? size : SYMAP_BLOCK_SIZE;
+		block = (SymapBlock*)malloc(sizeof(SymapBlock) + block_size);
+		if (!block) {
+			return NULL;
+		}
+		block->used = 0;
+		block->size = block_size;
+		/* Keep filling the current block if this one is just for a
+		   long string */
+		if (map->blocks && size > SYMAP_BLOCK_SIZE) {
+			block->next       = map->blocks->next;
+			map->blocks->next = block;
 		} else {
-			lower = ++i;
+			block->next = map->blocks;
+			map->blocks = block;
 		}
 	}
-
-	assert(!*exact || strcmp(map->symbols[map->index[i] - 1], sym) > 0);
-	return i;
+	SymapEntry* entry = (SymapEntry*)(block->data + block->used);
+	block->used += size;
+	entry->hash = hash;
+	memcpy(entry->str, sym, len + 1);
+	return entry;
 }
 
 uint32_t
 symap_try_map(Symap* map, const char* sym)
 {
-	bool           exact;
-	const uint32_t index = symap_search(map, sym, &exact);
-	if (exact) {
-		assert(!strcmp(map->symbols[map->index[index]], sym));
-		return map->index[index];
-	}
-
-	return 0;
+	const SymapTable* table = __atomic_load_n(&map->table, __ATOMIC_ACQUIRE);
+	return symap_search(map, table, sym, symap_hash(sym));
 }
 
 uint32_t
 symap_map(Symap* map, const char* sym)
 {
-	bool           exact;
-	const uint32_t index = symap_search(map, sym, &exact);
-	if (exact) {
-		assert(!strcmp(map->symbols[map->index[index] - 1], sym));
-		return map->index[index];
+	const uint32_t hash = symap_hash(sym);
+	uint32_t       id   = symap_search(
+		map, __atomic_load_n(&map->table, __ATOMIC_ACQUIRE), sym, hash);
+	if (id) {
+		return id;
 	}
 
-	const uint32_t id  = ++map->size;
-	char* const    str = symap_strdup(sym);
+	pthread_mutex_lock(&map->mutex);
+	/* Another thread may have mapped it in the meantime */
+	id = symap_search(map, map->table, sym, hash);
+	if (id) {
+		pthread_mutex_unlock(&map->mutex);
+		return id;
+	}
 
-	/* Append new symbol to symbols array */
-	map->symbols = (char**)realloc(map->symbols, map->size * sizeof(str));
-	map->symbols[id - 1] = str;
+	id = map->size + 1;
+	uint32_t chunk, offset;
+	symap_locate(id, &chunk, &offset);
+	if (chunk >= SYMAP_MAX_CHUNKS) {
+		pthread_mutex_unlock(&map->mutex);
+		return 0;
+	}
+	if (!map->chunks[chunk]) {
+		SymapEntry** entries = (SymapEntry**)calloc(
+			SYMAP_FIRST_CHUNK << chunk, sizeof(SymapEntry*));
+		if (!entries) {
+			pthread_mutex_unlock(&map->mutex);
+			return 0;
+		}
+		__atomic_store_n(&map->chunks[chunk], entries, __ATOMIC_RELEASE);
+	}
 
-	/* Insert new index element into sorted index */
-	map->index = (uint32_t*)realloc(map->index, map->size * sizeof(uint32_t));
-	if (index < map->size - 1) {
-		memmove(map->index + index + 1,
-		        map->index + index,
-		        (map->size - index - 1) * sizeof(uint32_t));
+	/* Keep the table at most half full */
+	SymapTable* table = map->table;
+	if (2 * id > table->mask + 1) {
+		SymapTable* grown = symap_table_new(2 * (table->mask + 1), table);
+		if (!grown) {
+			pthread_mutex_unlock(&map->mutex);
+			return 0;
+		}
+		for (uint32_t i = 0; i <= table->mask; ++i) {
+			if (table->ids[i]) {
+				symap_insert(grown, table->ids[i], symap_entry(map, table->ids[i])->hash);
+			}
+		}
+		__atomic_store_n(&map->table, grown, __ATOMIC_RELEASE);
+		table = grown;
 	}
 
-	map->index[index] = id;
+	SymapEntry* entry = symap_store(map, sym, hash);
+	if (!entry) {
+		pthread_mutex_unlock(&map->mutex);
+		return 0;
+	}
+	/* Publish the entry before the ID, which makes it reachable */
+	__atomic_store_n(&map->chunks[chunk][offset], entry, __ATOMIC_RELEASE);
+	__atomic_store_n(&map->size, id, __ATOMIC_RELEASE);
+	symap_insert(table, id, hash);
+	pthread_mutex_unlock(&map->mutex);
 
 	return id;
 }
@@ -178,8 +311,8 @@ symap_unmap(Symap* map, uint32_t id)
 {
 	if (id == 0) {
 		return NULL;
-	} else if (id <= map->size) {
-		return map->symbols[id - 1];
+	} else if (id <= __atomic_load_n(&map->size, __ATOMIC_ACQUIRE)) {
+		return symap_entry(map, id)->str;
 	}
 	return NULL;
 }
@@ -192,9 +325,8 @@ static void
 symap_dump(Symap* map)
 {
 	fprintf(stderr, "{\n");
-	for (uint32_t i = 0; i < map->size; ++i) {
-		fprintf(stderr, "\t%u = %s\n",
-		        map->index[i], map->symbols[map->index[i] - 1]);
+	for (uint32_t i = 1; i <= map->size; ++i) {
+		fprintf(stderr, "\t%u = %s\n", i, symap_unmap(map, i));
 	}
 	fprintf(stderr, "}\n");
 }
@@ -215,7 +347,7 @@ main()
 		}
 
 		const uint32_t id = symap_map(map, syms[i]);
-		if (strcmp(map->symbols[id - 1], syms[i])) {
+		if (strcmp(symap_unmap(map, id), syms[i])) {
 			fprintf(stderr, "error: Corrupt symbol table\n");
 			return 1;
 		}
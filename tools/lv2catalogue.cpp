@@ -0,0 +1,102 @@
+/*
+ * Compare how long it takes to get plugins ready to instantiate by
+ * loading every bundle on LV2_PATH, and by loading only their bundles
+ * through the PluginCatalogue index.
+ *
+ * usage: lv2catalogue [-i indexPath] [-r] pluginUri ...
+ */
+#include "../PluginCatalogue.h"
+#include "../lilv_interface.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static double now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// look the plugins up and read their ports, which makes lilv parse their data
+static unsigned int findPlugins(LilvWorld* world, char** uris, unsigned int nUris)
+{
+	unsigned int found = 0;
+	const LilvPlugins* plugins = lilv_world_get_all_plugins(world);
+	for(unsigned int n = 0; n < nUris; ++n)
+	{
+		LilvNode* uri = lilv_new_uri(world, uris[n]);
+		const LilvPlugin* plugin = lilv_plugins_get_by_uri(plugins, uri);
+		lilv_node_free(uri);
+		if(plugin && lilv_plugin_get_num_ports(plugin))
+			++found;
+		else
+			fprintf(stderr, "%s not found\n", uris[n]);
+	}
+	return found;
+}
+
+int main(int argc, char** argv)
+{
+	std::string indexPath = PluginCatalogue::getDefaultPath();
+	bool rebuild = false;
+	int c;
+	while((c = getopt(argc, argv, "i:rh")) != -1)
+	{
+		switch(c)
+		{
+			case 'i': indexPath = optarg; break;
+			case 'r': rebuild = true; break;
+			default:
+				fprintf(stderr, "usage: %s [-i indexPath] [-r] pluginUri ...\n"
+					"\t-i path  where the index is kept (default: %s)\n"
+					"\t-r       rebuild the index first\n",
+					argv[0], PluginCatalogue::getDefaultPath().c_str());
+				return 1;
+		}
+	}
+	char** uris = argv + optind;
+	unsigned int nUris = argc - optind;
+	if(rebuild)
+		unlink(indexPath.c_str());
+
+	double start = now();
+	LilvWorld* world = LV2Apply_initializeWorld();
+	if(!world)
+		return 1;
+	double loadAll = now() - start;
+	unsigned int nFound = findPlugins(world, uris, nUris);
+	double loadAllTotal = now() - start;
+	LV2Apply_cleanupWorld(world);
+	printf("load all bundles:  %8.3f ms, %u/%u plugins ready after %8.3f ms\n",
+		loadAll * 1000, nFound, nUris, loadAllTotal * 1000);
+
+	// the first run rebuilds the index if it is out of date
+	for(unsigned int run = 0; run < 2; ++run)
+	{
+		start = now();
+		world = LV2Apply_initializeEmptyWorld();
+		PluginCatalogue catalogue;
+		if(!world || !catalogue.setup(world, indexPath))
+			return 1;
+		for(unsigned int n = 0; n < nUris; ++n)
+			catalogue.load(uris[n]);
+		nFound = findPlugins(world, uris, nUris);
+		double total = now() - start;
+		struct PluginCatalogue::stats stats = catalogue.getStats();
+		printf("%s %8.3f ms, %u/%u plugins ready after %8.3f ms (%u of %u bundles loaded in %.3f ms)\n",
+			stats.fromIndex ? "catalogue index:  " : "rebuild index:    ",
+			stats.setupSeconds * 1000, nFound, nUris, total * 1000,
+			stats.nLoadedBundles, stats.nBundles, stats.loadSeconds * 1000);
+		catalogue.cleanup();
+		LV2Apply_cleanupWorld(world);
+		if(stats.fromIndex)
+		{
+			printf("speedup: %.1fx\n", loadAllTotal / total);
+			break;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,73 @@
+/*
+ * Render WAV files through a chain of LV2 plugins, faster than real time.
+ *
+ * usage: lv2render [options] -p pluginUri [-p pluginUri ...] -o outputDir file.wav ...
+ */
+#include "../OfflineRenderer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static void usage(const char* name)
+{
+	fprintf(stderr, "usage: %s [options] -p pluginUri [-p pluginUri ...] -o outputDir file.wav ...\n"
+		"\t-p uri      add a plugin to the chain\n"
+		"\t-o dir      where to write the output files, with the same names as the inputs\n"
+		"\t-b frames   block size (default: %u)\n"
+		"\t-j threads  files processed concurrently (default: one per CPU)\n"
+		"\t-c channels output channels (default: as many as the input)\n"
+		"\t-f bits     output format: 16, 24 or 32 (float, default)\n"
+		"\t-l          keep the latency of the chain in the output\n",
+		name, 4096);
+}
+
+int main(int argc, char** argv)
+{
+	struct OfflineRenderer::settings settings;
+	OfflineRenderer::getDefaultSettings(settings);
+	std::string outputDir;
+	int c;
+	while((c = getopt(argc, argv, "p:o:b:j:c:f:lh")) != -1)
+	{
+		switch(c)
+		{
+			case 'p': settings.chain.push_back(optarg); break;
+			case 'o': outputDir = optarg; break;
+			case 'b': settings.blockSize = atoi(optarg); break;
+			case 'j': settings.nThreads = atoi(optarg); break;
+			case 'c': settings.nOutputs = atoi(optarg); break;
+			case 'f': settings.outputBits = atoi(optarg); break;
+			case 'l': settings.compensateLatency = false; break;
+			default:
+				usage(argv[0]);
+				return 1;
+		}
+	}
+	if(optind >= argc || outputDir.empty())
+	{
+		usage(argv[0]);
+		return 1;
+	}
+	std::vector<struct OfflineRenderer::job> jobs;
+	for(int n = optind; n < argc; ++n)
+	{
+		struct OfflineRenderer::job job;
+		job.input = argv[n];
+		const char* name = strrchr(argv[n], '/');
+		job.output = outputDir + "/" + (name ? name + 1 : argv[n]);
+		jobs.push_back(job);
+	}
+	OfflineRenderer renderer;
+	if(!renderer.setup(settings))
+	{
+		fprintf(stderr, "Invalid settings\n");
+		return 1;
+	}
+	bool ok = renderer.process(jobs);
+	struct OfflineRenderer::stats stats = renderer.getStats();
+	printf("%u files (%u failed), %llu frames in %.3f s: %.0f frames/s\n",
+		stats.nFiles, stats.nFailed, (unsigned long long)stats.nFrames, stats.seconds,
+		stats.seconds > 0 ? stats.nFrames / stats.seconds : 0);
+	return ok ? 0 : 1;
+}